@@ -0,0 +1,97 @@
+/*
+ * Convert the binary validation file written by the `--format bin` flag of
+ * compare_acetime into the equivalent validation_data.json file, which is
+ * byte-for-byte identical to the output of the `--format json` flag.
+ *
+ * Usage:
+ * $ ./bin2json.out validation_data.bin > validation_data.json
+ */
+
+#include <stdio.h>
+#include <stdlib.h> // exit()
+#include "binary_validation.h"
+
+static void printItem(const BinReader &reader, const BinZone &zone, uint32_t i) {
+  const char indent[] = "          ";
+  int64_t dt = zone.dateTimes[i];
+  printf("%s\"epoch\": %lld,\n", indent, (long long) zone.epochSeconds[i]);
+  printf("%s\"total_offset\": %d,\n", indent, zone.totalOffsets[i]);
+  printf("%s\"dst_offset\": %d,\n", indent, zone.dstOffsets[i]);
+  printf("%s\"y\": %d,\n", indent, binYear(dt));
+  printf("%s\"M\": %d,\n", indent, binMonth(dt));
+  printf("%s\"d\": %d,\n", indent, binDay(dt));
+  printf("%s\"h\": %d,\n", indent, binHour(dt));
+  printf("%s\"m\": %d,\n", indent, binMinute(dt));
+  printf("%s\"s\": %d,\n", indent, binSecond(dt));
+  printf("%s\"abbrev\": \"%s\",\n", indent,
+      reader.string(zone.abbrevIndexes[i]));
+  printf("%s\"type\": \"%c\"\n", indent, zone.types[i]);
+}
+
+static void printItems(
+    const BinReader &reader,
+    const BinZone &zone,
+    uint32_t begin,
+    uint32_t end) {
+
+  const char indent3[] = "        ";
+  for (uint32_t i = begin; i < end; i++) {
+    printf("%s{\n", indent3);
+    printItem(reader, zone, i);
+    printf("%s}%s\n", indent3, (i < end - 1) ? "," : "");
+  }
+}
+
+static void printJson(const BinReader &reader) {
+  const char indent0[] = "  ";
+  const char indent1[] = "    ";
+  const char indent2[] = "      ";
+
+  const BinHeader &header = reader.header();
+  printf("{\n");
+  printf("%s\"start_year\": %d,\n", indent0, header.startYear);
+  printf("%s\"until_year\": %d,\n", indent0, header.untilYear);
+  printf("%s\"epoch_year\": %d,\n", indent0, header.epochYear);
+  printf("%s\"scope\": \"%s\",\n", indent0, header.scope);
+  printf("%s\"source\": \"%s\",\n", indent0, header.source);
+  printf("%s\"version\": \"%s\",\n", indent0, header.version);
+  printf("%s\"tz_version\": \"%s\",\n", indent0, header.tzVersion);
+  printf("%s\"has_valid_abbrev\": %s,\n", indent0,
+      header.hasValidAbbrev ? "true" : "false");
+  printf("%s\"has_valid_dst\": %s,\n", indent0,
+      header.hasValidDst ? "true" : "false");
+  printf("%s\"offset_granularity\": %d,\n", indent0,
+      header.offsetGranularity);
+  printf("%s\"test_data\": {\n", indent0);
+
+  uint32_t numZones = reader.numZones();
+  for (uint32_t z = 0; z < numZones; z++) {
+    BinZone zone = reader.zone(z);
+    printf("%s\"%s\": {\n", indent1, zone.name);
+
+    printf("%s\"%s\": [\n", indent2, "transitions");
+    printItems(reader, zone, 0, zone.numTransitions);
+    printf("%s],\n", indent2);
+
+    printf("%s\"%s\": [\n", indent2, "samples");
+    printItems(reader, zone, zone.numTransitions, zone.numItems());
+    printf("%s]\n", indent2);
+
+    printf("%s}%s\n", indent1, (z < numZones - 1) ? "," : "");
+  }
+
+  printf("%s}\n", indent0);
+  printf("}\n");
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    fprintf(stderr, "Usage: bin2json.out validation_data.bin\n");
+    exit(1);
+  }
+
+  BinReader reader;
+  if (reader.open(argv[1])) exit(1);
+  printJson(reader);
+  return 0;
+}
@@ -0,0 +1,736 @@
+#include <fcntl.h> // open()
+#include <stdio.h> // snprintf()
+#include <stdlib.h> // mkstemp(), getenv()
+#include <string.h> // memcpy(), strncpy(), memcmp(), strcmp()
+#include <sys/mman.h> // mmap(), munmap()
+#include <sys/stat.h> // fstat()
+#include <unistd.h> // close(), unlink()
+#include "binary_validation.h"
+
+static void copyString(char *dst, const char *src) {
+  strncpy(dst, src, kBinHeaderStringSize - 1);
+  dst[kBinHeaderStringSize - 1] = '\0';
+}
+
+void binHeaderInit(
+    BinHeader *header,
+    int startYear,
+    int untilYear,
+    int epochYear,
+    const char *scope,
+    const char *source,
+    const char *version,
+    const char *tzVersion,
+    bool hasValidAbbrev,
+    bool hasValidDst,
+    int offsetGranularity) {
+
+  memset(header, 0, sizeof(BinHeader));
+  memcpy(header->magic, BIN_HEADER_MAGIC, sizeof(header->magic));
+  header->byteOrderMark = kBinByteOrderMark;
+  header->formatVersion = kBinFormatVersion;
+  header->startYear = startYear;
+  header->untilYear = untilYear;
+  header->epochYear = epochYear;
+  header->offsetGranularity = offsetGranularity;
+  header->hasValidAbbrev = hasValidAbbrev;
+  header->hasValidDst = hasValidDst;
+  copyString(header->scope, scope);
+  copyString(header->source, source);
+  copyString(header->version, version);
+  copyString(header->tzVersion, tzVersion);
+}
+
+//-----------------------------------------------------------------------------
+
+int8_t BinWriter::write(const void *data, size_t size) {
+  if (size == 0) return 0;
+  if (fwrite(data, 1, size, file) != size) {
+    fprintf(stderr, "BinWriter: write failed\n");
+    return 1;
+  }
+  offset += size;
+  return 0;
+}
+
+int8_t BinWriter::writePadding() {
+  static const char zeros[8] = {0};
+  size_t remainder = offset % 8;
+  if (remainder == 0) return 0;
+  return write(zeros, 8 - remainder);
+}
+
+int8_t BinWriter::intern(const char *s, uint32_t *index) {
+  auto it = stringIndexes.find(s);
+  if (it != stringIndexes.end()) {
+    *index = it->second;
+    return 0;
+  }
+  uint32_t newIndex = strings.size();
+  strings.emplace_back(s);
+  stringIndexes.emplace(s, newIndex);
+  *index = newIndex;
+  return 0;
+}
+
+int8_t BinWriter::writeHeader(const BinHeader &header) {
+  return write(&header, sizeof(header));
+}
+
+int8_t BinWriter::writeZone(
+    const char *zoneName,
+    const BinItem *items,
+    uint32_t numTransitions,
+    uint32_t numSamples) {
+
+  BinZoneIndex zone;
+  memset(&zone, 0, sizeof(zone));
+  zone.offset = offset;
+  zone.numTransitions = numTransitions;
+  zone.numSamples = numSamples;
+  intern(zoneName, &zone.nameIndex);
+
+  uint32_t n = numTransitions + numSamples;
+  epochSeconds.resize(n);
+  dateTimes.resize(n);
+  totalOffsets.resize(n);
+  dstOffsets.resize(n);
+  abbrevIndexes.resize(n);
+  types.resize(n);
+  for (uint32_t i = 0; i < n; i++) {
+    const BinItem &item = items[i];
+    uint32_t abbrevIndex;
+    intern(item.abbrev, &abbrevIndex);
+    if (abbrevIndex > UINT16_MAX) {
+      fprintf(stderr, "BinWriter: too many strings\n");
+      return 1;
+    }
+    epochSeconds[i] = item.epochSeconds;
+    dateTimes[i] = binPackDateTime(item.year, item.month, item.day,
+        item.hour, item.minute, item.second);
+    totalOffsets[i] = item.totalOffset;
+    dstOffsets[i] = item.dstOffset;
+    abbrevIndexes[i] = abbrevIndex;
+    types[i] = item.type;
+  }
+
+  int8_t err = write(epochSeconds.data(), n * sizeof(int64_t))
+      || write(dateTimes.data(), n * sizeof(int64_t))
+      || write(totalOffsets.data(), n * sizeof(int32_t))
+      || write(dstOffsets.data(), n * sizeof(int32_t))
+      || write(abbrevIndexes.data(), n * sizeof(uint16_t))
+      || write(types.data(), n * sizeof(char))
+      || writePadding();
+  if (err) return err;
+
+  zones.push_back(zone);
+  return 0;
+}
+
+int8_t BinWriter::finish() {
+  BinTrailer trailer;
+  memset(&trailer, 0, sizeof(trailer));
+  trailer.indexOffset = offset;
+  trailer.numZones = zones.size();
+  memcpy(trailer.magic, BIN_TRAILER_MAGIC, sizeof(trailer.magic));
+
+  if (write(zones.data(), zones.size() * sizeof(BinZoneIndex))) return 1;
+
+  // String table
+  trailer.stringsOffset = offset;
+  uint32_t numStrings = strings.size();
+  std::vector<uint32_t> stringOffsets;
+  uint32_t charsOffset = 0;
+  for (const std::string &s : strings) {
+    stringOffsets.push_back(charsOffset);
+    charsOffset += s.size() + 1;
+  }
+  if (write(&numStrings, sizeof(numStrings))) return 1;
+  if (write(stringOffsets.data(), numStrings * sizeof(uint32_t))) return 1;
+  for (const std::string &s : strings) {
+    if (write(s.c_str(), s.size() + 1)) return 1;
+  }
+  if (writePadding()) return 1;
+
+  if (write(&trailer, sizeof(trailer))) return 1;
+  if (fflush(file) != 0) {
+    fprintf(stderr, "BinWriter: flush failed\n");
+    return 1;
+  }
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+int8_t BinReader::open(const char *path) {
+  close();
+
+  int fd = ::open(path, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "Unable to open '%s'\n", path);
+    return 1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    fprintf(stderr, "Unable to stat '%s'\n", path);
+    ::close(fd);
+    return 1;
+  }
+  size = st.st_size;
+  if (size < sizeof(BinHeader) + sizeof(BinTrailer)) {
+    fprintf(stderr, "File '%s' is too short\n", path);
+    ::close(fd);
+    size = 0;
+    return 1;
+  }
+  void *addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (addr == MAP_FAILED) {
+    fprintf(stderr, "Unable to mmap '%s'\n", path);
+    size = 0;
+    return 1;
+  }
+  data = (const uint8_t *) addr;
+
+  if (validate(path)) {
+    close();
+    return 1;
+  }
+  return 0;
+}
+
+int8_t BinReader::validate(const char *path) {
+  headerPtr = (const BinHeader *) data;
+  trailerPtr = (const BinTrailer *) (data + size - sizeof(BinTrailer));
+
+  if (memcmp(headerPtr->magic, BIN_HEADER_MAGIC, sizeof(headerPtr->magic))
+      || memcmp(trailerPtr->magic, BIN_TRAILER_MAGIC,
+          sizeof(trailerPtr->magic))) {
+    fprintf(stderr, "File '%s' is not a binary validation file\n", path);
+    return 1;
+  }
+  if (headerPtr->byteOrderMark != kBinByteOrderMark) {
+    fprintf(stderr, "File '%s' has a different byte order\n", path);
+    return 1;
+  }
+  if (headerPtr->formatVersion != kBinFormatVersion) {
+    fprintf(stderr, "File '%s' has unsupported format version %u\n",
+        path, headerPtr->formatVersion);
+    return 1;
+  }
+
+  // Zone index and string table must lie between the header and the trailer.
+  uint64_t end = size - sizeof(BinTrailer);
+  uint64_t indexEnd = trailerPtr->indexOffset
+      + (uint64_t) trailerPtr->numZones * sizeof(BinZoneIndex);
+  if (trailerPtr->indexOffset < sizeof(BinHeader)
+      || trailerPtr->indexOffset % 8 != 0
+      || indexEnd > trailerPtr->stringsOffset
+      || trailerPtr->stringsOffset + sizeof(uint32_t) > end) {
+    fprintf(stderr, "File '%s' has an invalid trailer\n", path);
+    return 1;
+  }
+  index = (const BinZoneIndex *) (data + trailerPtr->indexOffset);
+
+  numStringsValue = *(const uint32_t *) (data + trailerPtr->stringsOffset);
+  uint64_t charsOffset = trailerPtr->stringsOffset + sizeof(uint32_t)
+      + (uint64_t) numStringsValue * sizeof(uint32_t);
+  // The last byte before the trailer is a NUL terminator or a padding byte, so
+  // every string inside the table is terminated.
+  if (charsOffset > end || data[end - 1] != '\0') {
+    fprintf(stderr, "File '%s' has an invalid string table\n", path);
+    return 1;
+  }
+  stringOffsets = (const uint32_t *) (data + trailerPtr->stringsOffset
+      + sizeof(uint32_t));
+  chars = (const char *) (data + charsOffset);
+  for (uint32_t i = 0; i < numStringsValue; i++) {
+    if (charsOffset + stringOffsets[i] >= end) {
+      fprintf(stderr, "File '%s' has an invalid string offset\n", path);
+      return 1;
+    }
+  }
+
+  for (uint32_t i = 0; i < trailerPtr->numZones; i++) {
+    const BinZoneIndex &zone = index[i];
+    uint64_t n = (uint64_t) zone.numTransitions + zone.numSamples;
+    uint64_t blockSize = n * (2 * sizeof(int64_t) + 2 * sizeof(int32_t)
+        + sizeof(uint16_t) + sizeof(char));
+    if (zone.offset < sizeof(BinHeader)
+        || zone.offset % 8 != 0
+        || zone.offset + blockSize > trailerPtr->indexOffset
+        || zone.nameIndex >= numStringsValue) {
+      fprintf(stderr, "File '%s' has an invalid index for zone %u\n",
+          path, i);
+      return 1;
+    }
+    zoneIndexes.emplace(string(zone.nameIndex), i);
+  }
+  return 0;
+}
+
+void BinReader::close() {
+  if (data != nullptr) munmap((void *) data, size);
+  data = nullptr;
+  size = 0;
+  headerPtr = nullptr;
+  trailerPtr = nullptr;
+  index = nullptr;
+  numStringsValue = 0;
+  stringOffsets = nullptr;
+  chars = nullptr;
+  zoneIndexes.clear();
+}
+
+BinZone BinReader::zone(uint32_t i) const {
+  const BinZoneIndex &entry = index[i];
+  uint32_t n = entry.numTransitions + entry.numSamples;
+  const uint8_t *p = data + entry.offset;
+
+  BinZone zone;
+  zone.name = string(entry.nameIndex);
+  zone.numTransitions = entry.numTransitions;
+  zone.numSamples = entry.numSamples;
+  zone.epochSeconds = (const int64_t *) p;
+  p += n * sizeof(int64_t);
+  zone.dateTimes = (const int64_t *) p;
+  p += n * sizeof(int64_t);
+  zone.totalOffsets = (const int32_t *) p;
+  p += n * sizeof(int32_t);
+  zone.dstOffsets = (const int32_t *) p;
+  p += n * sizeof(int32_t);
+  zone.abbrevIndexes = (const uint16_t *) p;
+  p += n * sizeof(uint16_t);
+  zone.types = (const char *) p;
+  return zone;
+}
+
+int32_t BinReader::findZone(const char *zoneName) const {
+  auto it = zoneIndexes.find(zoneName);
+  return (it == zoneIndexes.end()) ? -1 : it->second;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * A minimal JSON reader for the files written by the compare_xxx programs:
+ * objects, arrays, strings with all the JSON escapes, integers, booleans, and
+ * null, which is read as an empty string in the string fields, like
+ * flatten.py does for the 'abbrev'. Unknown fields are skipped. The file is read by a
+ * single thread, so it uses getc_unlocked() instead of getc().
+ */
+struct JsonInput {
+  FILE *file;
+  long line;
+};
+
+static int8_t jsonError(JsonInput *in, const char *message) {
+  fprintf(stderr, "binReadJson: line %ld: %s\n", in->line, message);
+  return 1;
+}
+
+/** Skip whitespace, and return the next character without consuming it. */
+static int jsonPeek(JsonInput *in) {
+  int c;
+  while ((c = getc_unlocked(in->file)) != EOF) {
+    if (c == '\n') {
+      in->line++;
+    } else if (c != ' ' && c != '\t' && c != '\r') {
+      ungetc(c, in->file);
+      break;
+    }
+  }
+  return c;
+}
+
+static int8_t jsonExpect(JsonInput *in, char expected) {
+  if (jsonPeek(in) != expected) {
+    char message[32];
+    snprintf(message, sizeof(message), "expected '%c'", expected);
+    return jsonError(in, message);
+  }
+  getc_unlocked(in->file);
+  return 0;
+}
+
+/** Read the 4 hex digits of a \u escape into 'code'. */
+static int8_t jsonReadHex4(JsonInput *in, uint32_t *code) {
+  *code = 0;
+  for (int i = 0; i < 4; i++) {
+    int c = getc_unlocked(in->file);
+    uint32_t digit;
+    if (c >= '0' && c <= '9') digit = c - '0';
+    else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+    else return jsonError(in, "invalid \\u escape in string");
+    *code = (*code << 4) | digit;
+  }
+  return 0;
+}
+
+/**
+ * Read the rest of a \u escape, and append its code point to 's' in UTF-8.
+ * A UTF-16 surrogate pair is given by 2 consecutive escapes.
+ */
+static int8_t jsonReadUnicodeEscape(JsonInput *in, std::string *s) {
+  uint32_t code;
+  if (jsonReadHex4(in, &code)) return 1;
+  if (code >= 0xDC00 && code <= 0xDFFF) {
+    return jsonError(in, "unpaired surrogate in string");
+  }
+  if (code >= 0xD800 && code <= 0xDBFF) {
+    uint32_t low;
+    if (getc_unlocked(in->file) != '\\' || getc_unlocked(in->file) != 'u'
+        || jsonReadHex4(in, &low) || low < 0xDC00 || low > 0xDFFF) {
+      return jsonError(in, "unpaired surrogate in string");
+    }
+    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+  }
+
+  if (code < 0x80) {
+    s->push_back((char) code);
+  } else if (code < 0x800) {
+    s->push_back((char) (0xC0 | (code >> 6)));
+    s->push_back((char) (0x80 | (code & 0x3F)));
+  } else if (code < 0x10000) {
+    s->push_back((char) (0xE0 | (code >> 12)));
+    s->push_back((char) (0x80 | ((code >> 6) & 0x3F)));
+    s->push_back((char) (0x80 | (code & 0x3F)));
+  } else {
+    s->push_back((char) (0xF0 | (code >> 18)));
+    s->push_back((char) (0x80 | ((code >> 12) & 0x3F)));
+    s->push_back((char) (0x80 | ((code >> 6) & 0x3F)));
+    s->push_back((char) (0x80 | (code & 0x3F)));
+  }
+  return 0;
+}
+
+static int8_t jsonReadString(JsonInput *in, std::string *s) {
+  if (jsonExpect(in, '"')) return 1;
+  s->clear();
+  int c;
+  while ((c = getc_unlocked(in->file)) != '"') {
+    if (c == EOF || c == '\n') return jsonError(in, "unterminated string");
+    if (c == '\\') {
+      c = getc_unlocked(in->file);
+      switch (c) {
+        case '"': case '\\': case '/': break;
+        case 'b': c = '\b'; break;
+        case 'f': c = '\f'; break;
+        case 'n': c = '\n'; break;
+        case 'r': c = '\r'; break;
+        case 't': c = '\t'; break;
+        case 'u':
+          if (jsonReadUnicodeEscape(in, s)) return 1;
+          continue;
+        default: return jsonError(in, "invalid escape in string");
+      }
+    }
+    s->push_back((char) c);
+  }
+  return 0;
+}
+
+/** Read a string value, or a null which is read as an empty string. */
+static int8_t jsonReadStringOrNull(JsonInput *in, std::string *s) {
+  if (jsonPeek(in) != 'n') return jsonReadString(in, s);
+  char word[6] = {0};
+  if (fscanf(in->file, "%5[a-z]", word) != 1 || strcmp(word, "null") != 0) {
+    return jsonError(in, "expected a string");
+  }
+  s->clear();
+  return 0;
+}
+
+static int8_t jsonReadInt(JsonInput *in, int64_t *value) {
+  int c = jsonPeek(in);
+  bool negative = (c == '-');
+  if (negative) getc_unlocked(in->file);
+  uint64_t v = 0;
+  int numDigits = 0;
+  while ((c = getc_unlocked(in->file)) >= '0' && c <= '9') {
+    v = v * 10 + (c - '0');
+    numDigits++;
+  }
+  if (c != EOF) ungetc(c, in->file);
+  if (numDigits == 0) return jsonError(in, "expected an integer");
+  *value = negative ? -(int64_t) v : (int64_t) v;
+  return 0;
+}
+
+static int8_t jsonReadBool(JsonInput *in, bool *value) {
+  char word[6] = {0};
+  jsonPeek(in);
+  if (fscanf(in->file, "%5[a-z]", word) != 1) {
+    return jsonError(in, "expected a boolean");
+  }
+  if (strcmp(word, "true") == 0) {
+    *value = true;
+  } else if (strcmp(word, "false") == 0) {
+    *value = false;
+  } else {
+    return jsonError(in, "expected a boolean");
+  }
+  return 0;
+}
+
+static int8_t jsonSkipValue(JsonInput *in) {
+  int c = jsonPeek(in);
+  if (c == '"') {
+    std::string s;
+    return jsonReadString(in, &s);
+  }
+  if (c == '{' || c == '[') {
+    char close = (c == '{') ? '}' : ']';
+    getc_unlocked(in->file);
+    if (jsonPeek(in) == close) {
+      getc_unlocked(in->file);
+      return 0;
+    }
+    while (true) {
+      if (c == '{') {
+        std::string key;
+        if (jsonReadString(in, &key) || jsonExpect(in, ':')) return 1;
+      }
+      if (jsonSkipValue(in)) return 1;
+      int next = jsonPeek(in);
+      getc_unlocked(in->file);
+      if (next == close) return 0;
+      if (next != ',') return jsonError(in, "expected ',' or end of block");
+    }
+  }
+  // A number, a boolean, or null.
+  char word[32];
+  if (fscanf(in->file, "%31[-+.0-9a-zA-Z]", word) != 1) {
+    return jsonError(in, "unexpected character");
+  }
+  return 0;
+}
+
+/**
+ * Read an object, calling 'member(key)' after the ':' of each member, which
+ * must consume its value.
+ */
+template <typename F>
+static int8_t jsonReadObject(JsonInput *in, F member) {
+  if (jsonExpect(in, '{')) return 1;
+  if (jsonPeek(in) == '}') {
+    getc_unlocked(in->file);
+    return 0;
+  }
+  std::string key;
+  while (true) {
+    if (jsonReadString(in, &key) || jsonExpect(in, ':')) return 1;
+    if (member(key)) return 1;
+    int next = jsonPeek(in);
+    getc_unlocked(in->file);
+    if (next == '}') return 0;
+    if (next != ',') return jsonError(in, "expected ',' or '}'");
+  }
+}
+
+/**
+ * Read an array of items, appending them to 'items', and their abbreviations
+ * to 'abbrevs'. The abbrev pointers of the items are set by the caller, after
+ * 'abbrevs' stops growing.
+ */
+static int8_t jsonReadItems(
+    JsonInput *in,
+    std::vector<BinItem> *items,
+    std::vector<std::string> *abbrevs) {
+
+  if (jsonExpect(in, '[')) return 1;
+  if (jsonPeek(in) == ']') {
+    getc_unlocked(in->file);
+    return 0;
+  }
+  while (true) {
+    BinItem item;
+    memset(&item, 0, sizeof(item));
+    std::string abbrev;
+    int8_t err = jsonReadObject(in, [&](const std::string &key) -> int8_t {
+      int64_t v = 0;
+      if (key == "abbrev") return jsonReadStringOrNull(in, &abbrev);
+      if (key == "type") {
+        std::string type;
+        if (jsonReadStringOrNull(in, &type)) return 1;
+        item.type = type.empty() ? '\0' : type[0];
+        return 0;
+      }
+      if (key != "epoch" && key != "total_offset" && key != "dst_offset"
+          && key != "y" && key != "M" && key != "d"
+          && key != "h" && key != "m" && key != "s") {
+        return jsonSkipValue(in);
+      }
+      if (jsonReadInt(in, &v)) return 1;
+      if (key == "epoch") item.epochSeconds = v;
+      else if (key == "total_offset") item.totalOffset = v;
+      else if (key == "dst_offset") item.dstOffset = v;
+      else if (key == "y") item.year = v;
+      else if (key == "M") item.month = v;
+      else if (key == "d") item.day = v;
+      else if (key == "h") item.hour = v;
+      else if (key == "m") item.minute = v;
+      else item.second = v;
+      return 0;
+    });
+    if (err) return err;
+    items->push_back(item);
+    abbrevs->push_back(abbrev);
+
+    int next = jsonPeek(in);
+    getc_unlocked(in->file);
+    if (next == ']') return 0;
+    if (next != ',') return jsonError(in, "expected ',' or ']'");
+  }
+}
+
+static int8_t jsonReadZone(
+    JsonInput *in,
+    const std::string &zoneName,
+    BinJsonHandler *handler) {
+
+  std::vector<BinItem> transitions;
+  std::vector<BinItem> samples;
+  std::vector<std::string> transitionAbbrevs;
+  std::vector<std::string> sampleAbbrevs;
+  int8_t err = jsonReadObject(in, [&](const std::string &key) -> int8_t {
+    if (key == "transitions") {
+      return jsonReadItems(in, &transitions, &transitionAbbrevs);
+    }
+    if (key == "samples") return jsonReadItems(in, &samples, &sampleAbbrevs);
+    return jsonSkipValue(in);
+  });
+  if (err) return err;
+
+  // Transitions first, then samples, as expected by BinJsonHandler::zone().
+  for (size_t i = 0; i < transitions.size(); i++) {
+    transitions[i].abbrev = transitionAbbrevs[i].c_str();
+  }
+  for (size_t i = 0; i < samples.size(); i++) {
+    samples[i].abbrev = sampleAbbrevs[i].c_str();
+    transitions.push_back(samples[i]);
+  }
+  return handler->zone(zoneName.c_str(), transitions.data(),
+      transitions.size() - samples.size(), samples.size());
+}
+
+int8_t binReadJson(FILE *file, BinJsonHandler *handler) {
+  JsonInput input = {file, 1};
+  JsonInput *in = &input;
+
+  int64_t startYear = 0;
+  int64_t untilYear = 0;
+  int64_t epochYear = 0;
+  int64_t offsetGranularity = 1;
+  bool hasValidAbbrev = false;
+  bool hasValidDst = false;
+  std::string scope;
+  std::string source;
+  std::string version;
+  std::string tzVersion;
+  bool hasTestData = false;
+
+  int8_t err = jsonReadObject(in, [&](const std::string &key) -> int8_t {
+    if (key == "start_year") return jsonReadInt(in, &startYear);
+    if (key == "until_year") return jsonReadInt(in, &untilYear);
+    if (key == "epoch_year") return jsonReadInt(in, &epochYear);
+    if (key == "offset_granularity") {
+      return jsonReadInt(in, &offsetGranularity);
+    }
+    if (key == "has_valid_abbrev") return jsonReadBool(in, &hasValidAbbrev);
+    if (key == "has_valid_dst") return jsonReadBool(in, &hasValidDst);
+    if (key == "scope") return jsonReadStringOrNull(in, &scope);
+    if (key == "source") return jsonReadStringOrNull(in, &source);
+    if (key == "version") return jsonReadStringOrNull(in, &version);
+    if (key == "tz_version") return jsonReadStringOrNull(in, &tzVersion);
+    if (key != "test_data") return jsonSkipValue(in);
+
+    // The compare_xxx programs write the 'test_data' after all the other
+    // top-level fields, so the header is complete at this point.
+    hasTestData = true;
+    BinHeader header;
+    binHeaderInit(&header, startYear, untilYear, epochYear, scope.c_str(),
+        source.c_str(), version.c_str(), tzVersion.c_str(), hasValidAbbrev,
+        hasValidDst, offsetGranularity);
+    if (handler->header(header)) return 1;
+    return jsonReadObject(in, [&](const std::string &zoneName) -> int8_t {
+      return jsonReadZone(in, zoneName, handler);
+    });
+  });
+  if (err) return err;
+  if (!hasTestData) return jsonError(in, "missing 'test_data'");
+  return handler->finish();
+}
+
+/** Pass the contents of the JSON file to a BinWriter. */
+class BinJsonWriter : public BinJsonHandler {
+  public:
+    explicit BinJsonWriter(BinWriter *writer) : writer(writer) {}
+
+    int8_t header(const BinHeader &header) override {
+      return writer->writeHeader(header);
+    }
+
+    int8_t zone(
+        const char *zoneName,
+        const BinItem *items,
+        uint32_t numTransitions,
+        uint32_t numSamples) override {
+      return writer->writeZone(zoneName, items, numTransitions, numSamples);
+    }
+
+    int8_t finish() override {
+      return writer->finish();
+    }
+
+  private:
+    BinWriter *writer;
+};
+
+int8_t binConvertJson(FILE *file, BinWriter *writer) {
+  BinJsonWriter handler(writer);
+  return binReadJson(file, &handler);
+}
+
+int8_t binOpenFile(BinReader *reader, const char *path) {
+  FILE *in = fopen(path, "rb");
+  if (in == nullptr) {
+    fprintf(stderr, "Unable to open '%s'\n", path);
+    return 1;
+  }
+  char magic[8];
+  bool isBin = fread(magic, sizeof(magic), 1, in) == 1
+      && memcmp(magic, BIN_HEADER_MAGIC, sizeof(magic)) == 0;
+  if (isBin) {
+    fclose(in);
+    return reader->open(path);
+  }
+  rewind(in);
+
+  const char *tmpDir = getenv("TMPDIR");
+  if (tmpDir == nullptr || tmpDir[0] == '\0') tmpDir = "/tmp";
+  char tmpPath[4096];
+  int size = snprintf(tmpPath, sizeof(tmpPath), "%s/binary_validation_XXXXXX",
+      tmpDir);
+  int fd = (size < 0 || size >= (int) sizeof(tmpPath)) ? -1 : mkstemp(tmpPath);
+  FILE *out = (fd < 0) ? nullptr : fdopen(fd, "wb");
+  if (out == nullptr) {
+    fprintf(stderr, "Unable to create temporary file for '%s'\n", path);
+    if (fd >= 0) {
+      ::close(fd);
+      unlink(tmpPath);
+    }
+    fclose(in);
+    return 1;
+  }
+
+  BinWriter writer(out);
+  int8_t err = binConvertJson(in, &writer);
+  fclose(in);
+  if (fclose(out) != 0) err = 1;
+  if (!err) err = reader->open(tmpPath);
+  unlink(tmpPath);
+  if (err) fprintf(stderr, "Unable to convert '%s'\n", path);
+  return err;
+}
@@ -0,0 +1,299 @@
+#ifndef BINARY_VALIDATION_H
+#define BINARY_VALIDATION_H
+
+/*
+ * A binary, columnar alternative to the validation_data.json file, which can be
+ * memory-mapped and read without parsing. All integers use the byte order of
+ * the host which wrote the file, as recorded by BinHeader::byteOrderMark. The
+ * file is written sequentially so that it can be sent through a pipe:
+ *
+ * BinHeader
+ * zone block, for each zone:
+ *    int64_t epochSeconds[n]
+ *    int64_t dateTime[n] (packed by binPackDateTime())
+ *    int32_t totalOffset[n]
+ *    int32_t dstOffset[n]
+ *    uint16_t abbrevIndex[n] (into the string table)
+ *    char type[n]
+ *    padding to a multiple of 8 bytes
+ *    where n = numTransitions + numSamples, transitions first
+ * BinZoneIndex[numZones]
+ * string table:
+ *    uint32_t numStrings
+ *    uint32_t offsets[numStrings] (relative to the first character)
+ *    NUL-terminated characters
+ *    padding to a multiple of 8 bytes
+ * BinTrailer
+ *
+ * A reader finds the BinTrailer at the end of the file, then the BinZoneIndex,
+ * which locates the zone block of each zone in O(1).
+ */
+
+#include <stdint.h>
+#include <stdio.h> // FILE
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/** Magic bytes at the start of the file. */
+#define BIN_HEADER_MAGIC "ATVBIN01"
+
+/** Magic bytes at the end of the file. */
+#define BIN_TRAILER_MAGIC "ATVBEND1"
+
+/** Written as-is by the writer, so that the reader can detect the byte order. */
+const uint32_t kBinByteOrderMark = 0x01020304;
+
+/** Version of the layout described above. */
+const uint32_t kBinFormatVersion = 1;
+
+/** Size of the string fields of BinHeader, including the NUL terminator. */
+const int kBinHeaderStringSize = 32;
+
+/** Fixed header at offset 0. Holds the top-level fields of the JSON file. */
+struct BinHeader {
+  char magic[8];
+  uint32_t byteOrderMark;
+  uint32_t formatVersion;
+  int32_t startYear;
+  int32_t untilYear;
+  int32_t epochYear;
+  int32_t offsetGranularity;
+  uint8_t hasValidAbbrev;
+  uint8_t hasValidDst;
+  uint8_t reserved[6];
+  char scope[kBinHeaderStringSize];
+  char source[kBinHeaderStringSize];
+  char version[kBinHeaderStringSize];
+  char tzVersion[kBinHeaderStringSize];
+};
+
+/** Location of the zone block of a single zone. */
+struct BinZoneIndex {
+  uint64_t offset;
+  uint32_t numTransitions;
+  uint32_t numSamples;
+  uint32_t nameIndex; // into the string table
+  uint32_t reserved;
+};
+
+/** Fixed trailer at the end of the file. */
+struct BinTrailer {
+  uint64_t indexOffset;
+  uint64_t stringsOffset;
+  uint32_t numZones;
+  uint32_t reserved;
+  char magic[8];
+};
+
+/** Initialize the BinHeader. Strings longer than the fields are truncated. */
+void binHeaderInit(
+    BinHeader *header,
+    int startYear,
+    int untilYear,
+    int epochYear,
+    const char *scope,
+    const char *source,
+    const char *version,
+    const char *tzVersion,
+    bool hasValidAbbrev,
+    bool hasValidDst,
+    int offsetGranularity);
+
+/** Pack the date and time components into a single int64_t. */
+inline int64_t binPackDateTime(
+    int year, int month, int day, int hour, int minute, int second) {
+  return ((int64_t) year << 26)
+      | ((int64_t) month << 22)
+      | ((int64_t) day << 17)
+      | ((int64_t) hour << 12)
+      | ((int64_t) minute << 6)
+      | (int64_t) second;
+}
+
+inline int binYear(int64_t dt) { return (int) (dt >> 26); }
+inline int binMonth(int64_t dt) { return (int) ((dt >> 22) & 0xF); }
+inline int binDay(int64_t dt) { return (int) ((dt >> 17) & 0x1F); }
+inline int binHour(int64_t dt) { return (int) ((dt >> 12) & 0x1F); }
+inline int binMinute(int64_t dt) { return (int) ((dt >> 6) & 0x3F); }
+inline int binSecond(int64_t dt) { return (int) (dt & 0x3F); }
+
+//-----------------------------------------------------------------------------
+
+/** A single test item, in the form accepted by BinWriter. */
+struct BinItem {
+  int64_t epochSeconds;
+  int32_t totalOffset;
+  int32_t dstOffset;
+  int year;
+  int month;
+  int day;
+  int hour;
+  int minute;
+  int second;
+  const char *abbrev;
+  char type;
+};
+
+/**
+ * Write the binary format to a FILE, one zone at a time. The FILE is written
+ * sequentially, so it can be the STDOUT. All methods return 0 on success, and
+ * non-zero after printing an error on the STDERR.
+ */
+class BinWriter {
+  public:
+    explicit BinWriter(FILE *file) : file(file) {}
+
+    /** Write the header. Must be called first. */
+    int8_t writeHeader(const BinHeader &header);
+
+    /**
+     * Write the zone block of a single zone. The 'items' contains the
+     * 'numTransitions' transitions followed by the 'numSamples' samples.
+     */
+    int8_t writeZone(
+        const char *zoneName,
+        const BinItem *items,
+        uint32_t numTransitions,
+        uint32_t numSamples);
+
+    /** Write the zone index, the string table, and the trailer. */
+    int8_t finish();
+
+  private:
+    int8_t write(const void *data, size_t size);
+    int8_t writePadding();
+    int8_t intern(const char *s, uint32_t *index);
+
+    FILE *file;
+    uint64_t offset = 0;
+    std::vector<BinZoneIndex> zones;
+    std::vector<std::string> strings;
+    std::unordered_map<std::string, uint32_t> stringIndexes;
+    // Column buffers, reused across zones.
+    std::vector<int64_t> epochSeconds;
+    std::vector<int64_t> dateTimes;
+    std::vector<int32_t> totalOffsets;
+    std::vector<int32_t> dstOffsets;
+    std::vector<uint16_t> abbrevIndexes;
+    std::vector<char> types;
+};
+
+/**
+ * Receives the contents of a validation_data.json file from binReadJson(), in
+ * the same order as the methods of a BinWriter. Each method returns 0 on
+ * success, and non-zero to stop the reading.
+ */
+class BinJsonHandler {
+  public:
+    virtual ~BinJsonHandler() = default;
+
+    /** Receive the top-level fields, before the first zone. */
+    virtual int8_t header(const BinHeader &header) = 0;
+
+    /**
+     * Receive a single zone. The 'items' contains the 'numTransitions'
+     * transitions followed by the 'numSamples' samples, and is valid only
+     * during the call.
+     */
+    virtual int8_t zone(
+        const char *zoneName,
+        const BinItem *items,
+        uint32_t numTransitions,
+        uint32_t numSamples) = 0;
+
+    /** Called after the last zone. */
+    virtual int8_t finish() = 0;
+};
+
+/**
+ * Read the validation_data.json file from 'file', and pass it to the 'handler'
+ * one zone at a time, so that only a single zone is held in memory. The
+ * 'test_data' must be the last top-level field, as written by the compare_xxx
+ * programs. Returns 0 on success, and non-zero after printing an error on the
+ * STDERR, or if the handler returned non-zero.
+ */
+int8_t binReadJson(FILE *file, BinJsonHandler *handler);
+
+/** Convert the JSON file read from 'file' into the binary format. */
+int8_t binConvertJson(FILE *file, BinWriter *writer);
+
+//-----------------------------------------------------------------------------
+
+/** A read-only view of the columns of a single zone in a BinReader. */
+struct BinZone {
+  const char *name;
+  uint32_t numTransitions;
+  uint32_t numSamples;
+  const int64_t *epochSeconds;
+  const int64_t *dateTimes;
+  const int32_t *totalOffsets;
+  const int32_t *dstOffsets;
+  const uint16_t *abbrevIndexes;
+  const char *types;
+
+  /** Number of items, transitions first, then samples. */
+  uint32_t numItems() const { return numTransitions + numSamples; }
+};
+
+/**
+ * Memory-map a file written by BinWriter, and provide O(1) access to each zone.
+ * The returned pointers are valid until close() or the destructor.
+ */
+class BinReader {
+  public:
+    BinReader() = default;
+    ~BinReader() { close(); }
+    BinReader(const BinReader&) = delete;
+    BinReader& operator=(const BinReader&) = delete;
+
+    /**
+     * Open and validate the file. Returns 0 on success, and non-zero after
+     * printing an error on the STDERR.
+     */
+    int8_t open(const char *path);
+
+    /** Unmap the file. */
+    void close();
+
+    const BinHeader &header() const { return *headerPtr; }
+
+    uint32_t numZones() const { return trailerPtr->numZones; }
+
+    /** Return the zone at 'index', in the order written by the BinWriter. */
+    BinZone zone(uint32_t index) const;
+
+    /** Return the index of the given zone, or -1 if not found. */
+    int32_t findZone(const char *zoneName) const;
+
+    /** Return the string at the given index of the string table. */
+    const char *string(uint32_t index) const {
+      return chars + stringOffsets[index];
+    }
+
+    uint32_t numStrings() const { return numStringsValue; }
+
+  private:
+    int8_t validate(const char *path);
+
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+    const BinHeader *headerPtr = nullptr;
+    const BinTrailer *trailerPtr = nullptr;
+    const BinZoneIndex *index = nullptr;
+    uint32_t numStringsValue = 0;
+    const uint32_t *stringOffsets = nullptr;
+    const char *chars = nullptr;
+    std::unordered_map<std::string, int32_t> zoneIndexes;
+};
+
+/**
+ * Open the validation file at 'path' in the 'reader'. A file which does not
+ * start with BIN_HEADER_MAGIC is read as a JSON file, and converted into a
+ * temporary binary file under $TMPDIR (or /tmp), which is unlinked as soon as
+ * it is mapped. Returns 0
+ * on success, and non-zero after printing an error on the STDERR.
+ */
+int8_t binOpenFile(BinReader *reader, const char *path);
+
+#endif
@@ -0,0 +1,16 @@
+/*
+ * Convert a validation_data.json file written by any of the compare_xxx
+ * programs into the binary validation file, which can be given to the
+ * `--verify` flag of compare_acetime, or converted back using bin2json.
+ *
+ * Usage:
+ * $ ./json2bin.out < validation_data.json > validation_data.bin
+ */
+
+#include <stdio.h>
+#include "binary_validation.h"
+
+int main() {
+  BinWriter writer(stdout);
+  return binConvertJson(stdin, &writer) ? 1 : 0;
+}
@@ -8,16 +8,43 @@
  *    --start_year start
  *    --until_year until
  *    --epoch_year year
+ *    --scope (basic|extended|complete)
+ *    [--sampling_interval hours]
+ *    [--min_gap hours]
+ *    [--jobs num]
+ *    [--chunk_years years]
+ *    [--shard index/count]
+ *    [--costs costs.txt]
+ *    [--costs_out costs.txt]
+ *    [--stats stats.json]
+ *    [--cache_dir dir]
+ *    [--cache_size size]
+ *    [--benchmark]
+ *    [--use_internal_transitions]
+ *    [--check_transitions]
+ *    [--format (json|bin)]
+ *    [--verify baseline.(bin|json) [--fail_fast]]
  *    < zones.txt
- *    > validation_data.json
+ *    > validation_data.json (or validation_data.bin, or the --verify report)
  */
 
 #include <string.h> // strcmp()
 #include <stdio.h> // fgets()
+#include <atomic>
+#include <chrono>
+#include <functional> // ref()
+#include <memory> // unique_ptr
+#include <string>
+#include <thread>
+#include <vector>
 #include <Arduino.h>
 #include <AceTime.h>
 #include "test_data.h"
 #include "sampling.h"
+#include "shard.h"
+#include "stats.h"
+#include "result_cache.h"
+#include "verify.h"
 
 using namespace ace_time;
 
@@ -26,91 +53,605 @@ int16_t startYear = 2000;
 int16_t untilYear = 2100;
 int16_t epochYear = 2050;
 
+// Version of the items generated by sampling.cpp, added to the keys of the
+// result cache. Increment it whenever a change of the code changes the output,
+// such as a change of the scanner or of the lookups of a TestItem.
+const int kOutputVersion = 1;
+
 const int kScopeTypeBasic = 0;
 const int kScopeTypeExtended = 1;
 const int kScopeTypeComplete = 2;
 int scopeType = kScopeTypeExtended;
 const char *scopeString = "extended";
 
-// Cache and buffers for AceTime
-constexpr uint8_t CACHE_SIZE = 2;
+int samplingInterval = 22; // hours
+int minGap = 0; // hours, 0 means the stride is fixed at samplingInterval
+int numJobs = 1;
+int chunkYears = 100; // years of each job, within a 100-year epoch window
+Shard shard = {0, 1};
+const char *costsFile = nullptr;
+const char *costsOutFile = nullptr;
+const char *statsFile = nullptr;
+const char *cacheDir = nullptr;
+int cacheSize = 2; // number of ZoneProcessors in each ZoneProcessorCache
+bool benchmark = false;
+bool useInternalTransitions = false;
+bool checkTransitions = false;
+const char *verifyFile = nullptr;
+bool failFast = false;
+
+const int kFormatJson = 0;
+const int kFormatBin = 1;
+int formatType = kFormatJson;
+
+// Writer of the --format bin output.
+BinWriter *binWriter = nullptr;
+
+// Number of zones whose internal transitions did not match the scanned
+// transitions, for --check_transitions.
+std::atomic<int> numTransitionMismatches(0);
+
+// Number of zones whose internal transitions could not all be read.
+int numFailedZones = 0;
+
+/**
+ * Counters of the ZoneProcessorCaches of all worker threads. A cache miss
+ * rebinds one of the ZoneProcessors of the cache to a different zone, which
+ * forces it to recalculate its transitions through initForYear() on its next
+ * lookup.
+ */
+struct CacheStats {
+  std::atomic<long> numHits;
+  std::atomic<long> numMisses;
+};
+
+CacheStats cacheStats;
+
+/** Print the cacheStats on the STDERR. */
+void printCacheStats() {
+  fprintf(stderr, "ZoneProcessorCache: size %d, %ld hits, %ld misses\n",
+      cacheSize, cacheStats.numHits.load(), cacheStats.numMisses.load());
+}
+
+/**
+ * The ZoneManager ZM of the ZoneProcessor type ZP, with its ZoneProcessorCache
+ * of --cache_size ZoneProcessors, for a single worker thread. The
+ * ZoneProcessors mutate their internal transition cache on every lookup, so
+ * they cannot be shared across threads. The --scope flag selects one of the 3
+ * instantiations once, in readAndProcessZones(), and everything below it is
+ * instantiated for the concrete ZoneProcessor type.
+ */
+template <typename ZP, typename ZM>
+struct ScopedZoneManager {
+  typedef ZP Processor;
+
+  template <typename ZI>
+  ScopedZoneManager(uint16_t registrySize, const ZI* const* registry) :
+    processors(new ZP[cacheSize]),
+    boundZones(cacheSize),
+    cache(processors, cacheSize),
+    manager(registrySize, registry, cache)
+  {}
+
+  ~ScopedZoneManager() {
+    delete[] processors;
+  }
+
+  ScopedZoneManager(const ScopedZoneManager&) = delete;
+  ScopedZoneManager& operator=(const ScopedZoneManager&) = delete;
+
+  /**
+   * Return the ZoneProcessor bound to 'zoneName', or nullptr if the zone is
+   * not found. The lookup is counted as a cache miss if the returned
+   * ZoneProcessor was last returned for a different zone name.
+   */
+  ZP *getZoneProcessor(const char *zoneName) {
+    ZP *processor = manager.getZoneProcessor(zoneName);
+    if (processor == nullptr) return nullptr;
+
+    std::string& bound = boundZones[processor - processors];
+    if (bound == zoneName) {
+      cacheStats.numHits++;
+    } else {
+      cacheStats.numMisses++;
+      bound = zoneName;
+    }
+    return processor;
+  }
 
-BasicZoneProcessorCache<CACHE_SIZE> basicZoneProcessorCache;
-BasicZoneManager basicZoneManager(
-    zonedb::kZoneAndLinkRegistrySize,
-    zonedb::kZoneAndLinkRegistry,
-    basicZoneProcessorCache);
+  ZP *processors;
+  std::vector<std::string> boundZones; // zone name of each of the processors
+  ZoneProcessorCacheBaseTemplate<ZP> cache;
+  ZM manager;
+};
 
-ExtendedZoneProcessorCache<CACHE_SIZE> extendedZoneProcessorCache;
-ExtendedZoneManager extendedZoneManager(
-    zonedbx::kZoneAndLinkRegistrySize,
-    zonedbx::kZoneAndLinkRegistry,
-    extendedZoneProcessorCache);
+/** One ScopedZoneManager per worker thread. */
+template <typename SZM>
+using ZoneManagers = std::vector<std::unique_ptr<SZM>>;
 
-CompleteZoneProcessorCache<CACHE_SIZE> completeZoneProcessorCache;
-CompleteZoneManager completeZoneManager(
-    zonedbc::kZoneAndLinkRegistrySize,
-    zonedbc::kZoneAndLinkRegistry,
-    completeZoneProcessorCache);
+/**
+ * A zone to be processed, the index of its TestEntry in the TestData of the
+ * current batch, whether that entry was loaded from the --cache_dir, the
+ * accumulated processing time over all chunks, for the --costs_out file, the
+ * time and lookups of each phase, for the --stats file, and the state of its
+ * comparison against the --verify baseline.
+ */
+struct ZoneJob {
+  const char *zoneName;
+  int entryIndex;
+  bool cached;
+  bool failed; // the internal transitions of the zone are incomplete
+  double seconds;
+  ZoneStats stats;
+  ZoneVerification verification;
+};
+
+/** Return the seconds elapsed since 'startTime'. */
+static double secondsSince(std::chrono::steady_clock::time_point startTime) {
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - startTime;
+  return elapsed.count();
+}
 
 //-----------------------------------------------------------------------------
 
-/** Insert TestItems for the given 'zoneName' into test_data. */
-int8_t processZone(TestData *testData, int i, const char *zoneName) {
-  fprintf(stderr, "[%d] Zone %s", i, zoneName);
-  TimeZone tz;
-  if (scopeType == kScopeTypeBasic) {
-    tz = basicZoneManager.createForZoneName(zoneName);
-  } else if (scopeType == kScopeTypeExtended) {
-    tz = extendedZoneManager.createForZoneName(zoneName);
-  } else if (scopeType == kScopeTypeComplete) {
-    tz = completeZoneManager.createForZoneName(zoneName);
+/** Print the start of the output in the format selected by --format. */
+int8_t printHeader() {
+  const char *tzVersion = zonedbx::kZoneContext.tzVersion;
+  if (formatType == kFormatBin) {
+    BinHeader header;
+    binHeaderInit(&header, startYear, untilYear, epochYear, scopeString,
+        "AceTime", ACE_TIME_VERSION_STRING, tzVersion,
+        true /*hasValidAbbrev*/, true /*hasValidDst*/,
+        1 /*offsetGranularity*/);
+    return binWriter->writeHeader(header);
+  } else {
+    printJsonHeader(startYear, untilYear, epochYear, scopeString,
+        ACE_TIME_VERSION_STRING, tzVersion);
+    return 0;
+  }
+}
+
+/** Print the given entry in the format selected by --format. */
+int8_t printEntry(const TestEntry *entry, bool first) {
+  if (formatType == kFormatBin) {
+    return writeBinEntry(binWriter, entry);
+  } else {
+    printJsonEntry(entry, first);
+    return 0;
   }
+}
+
+/** Print the end of the output in the format selected by --format. */
+int8_t printFooter() {
+  if (formatType == kFormatBin) {
+    return binWriter->finish();
+  } else {
+    printJsonFooter();
+    return 0;
+  }
+}
 
-  // Create entry for a single zone
-  TestEntry *entry = testDataNewEntry(testData);
-  strncpy(entry->zone_name, zoneName, ZONE_NAME_SIZE - 1);
-  entry->zone_name[ZONE_NAME_SIZE - 1] = '\0';
+//-----------------------------------------------------------------------------
+
+/**
+ * The years [start, until) of a single zone, processed by a worker thread as a
+ * single unit of work. The TestItems go into the collections of the chunk, and
+ * are appended to the TestEntry of the zone by mergeChunk() after all chunks of
+ * the current epoch window are done. The time and lookups are also kept in the
+ * chunk, and added to the ZoneJob at the same time, so that no two threads
+ * write into the same ZoneJob.
+ */
+struct ChunkJob {
+  int jobIndex;
+  int16_t start;
+  int16_t until;
+  TestCollection transitions;
+  TestCollection samples;
+  double seconds;
+  ZoneStats stats;
+  bool failed;
+};
+
+/**
+ * Insert the TestItems of the years [chunk.start, chunk.until) for the zone of
+ * 'job' into the collections of the 'chunk'. The Epoch::currentEpochYear()
+ * must already be set to the epoch of the chunk by the caller.
+ */
+template <typename SZM>
+void processZoneChunk(
+    SZM& manager,
+    const ZoneJob& job,
+    ChunkJob& chunk,
+    int64_t epochOffset) {
+
+  auto startTime = std::chrono::steady_clock::now();
+  const char *zoneName = job.zoneName;
+  const int16_t start = chunk.start;
+  const int16_t until = chunk.until;
+  auto *processor = manager.getZoneProcessor(zoneName);
+
+  // Log each zone only once, on its first chunk, using a single fprintf() so
+  // that the lines from different threads do not interleave.
+  if (start == startYear) {
+    fprintf(stderr, "[%d] Zone %s%s\n", chunk.jobIndex, zoneName,
+        (processor == nullptr) ? ": not found" : "");
+  }
 
   // If zone is not supported, retain the empty entry.
-  if (tz.isError()) {
-    fprintf(stderr, ": not found\n");
-    return 1;
+  if (processor == nullptr) return;
+
+  samplingStats = SamplingStats();
+  auto phaseTime = std::chrono::steady_clock::now();
+  if (useInternalTransitions) {
+    chunk.failed = addInternalTransitionsForChunk(
+        &chunk.transitions, zoneName, *processor, start, until, epochOffset);
+    if (checkTransitions && ! chunk.failed) {
+      // Cross-check the items of this chunk against the scanned transitions.
+      TestCollection expected;
+      testCollectionInit(&expected);
+      addTransitionsForChunk(
+          &expected, zoneName, *processor, start, until, epochOffset,
+          samplingInterval, minGap);
+      if (compareTransitions(zoneName, &chunk.transitions, &expected)) {
+        numTransitionMismatches++;
+      }
+      testCollectionClear(&expected);
+    }
   } else {
-    fprintf(stderr, "\n");
+    addTransitionsForChunk(
+        &chunk.transitions, zoneName, *processor, start, until, epochOffset,
+        samplingInterval, minGap);
   }
+  phaseStatsAdd(&chunk.stats.transitions, secondsSince(phaseTime),
+      samplingStats);
 
+  samplingStats = SamplingStats();
+  phaseTime = std::chrono::steady_clock::now();
+  addMonthlySamplesForChunk(
+      &chunk.samples, zoneName, *processor, start, until, epochOffset);
+  phaseStatsAdd(&chunk.stats.samples, secondsSince(phaseTime), samplingStats);
+
+  chunk.seconds += secondsSince(startTime);
+}
+
+/**
+ * Append the TestItems of the 'chunk' to the given 'entry', and its time and
+ * lookups to the 'job'. The scanner starts each chunk one day before its first
+ * year, so a transition near the end of the previous chunk can be found by
+ * both chunks. Such a transition is not after the last transition already in
+ * the entry, and is dropped. The chunks of a zone must be merged in order.
+ */
+static void mergeChunk(TestEntry *entry, ZoneJob& job, const ChunkJob& chunk) {
+  const TestCollection& transitions = chunk.transitions;
+  for (int k = 0; k < transitions.numItems; k++) {
+    const TestItem& item = transitions.items[k];
+    int n = entry->transitions.numItems;
+    if (n > 0
+        && item.epochSeconds <= entry->transitions.items[n - 1].epochSeconds) {
+      continue;
+    }
+    *testCollectionNewItem(&entry->transitions) = item;
+  }
+  for (int k = 0; k < chunk.samples.numItems; k++) {
+    *testCollectionNewItem(&entry->samples) = chunk.samples.items[k];
+  }
+
+  if (chunk.failed && ! job.failed) {
+    job.failed = true;
+    numFailedZones++;
+  }
+  job.seconds += chunk.seconds;
+  phaseStatsAdd(&job.stats.transitions, chunk.stats.transitions.seconds,
+      chunk.stats.transitions.counts);
+  phaseStatsAdd(&job.stats.samples, chunk.stats.samples.seconds,
+      chunk.stats.samples.counts);
+}
+
+/**
+ * Process the 'chunks' using 'numJobs' worker threads. Each worker pulls the
+ * next chunk from a shared counter, so the order of completion is arbitrary,
+ * but each chunk writes only into its own collections, so the output does not
+ * depend on the scheduling.
+ */
+template <typename SZM>
+void processChunks(
+    ZoneManagers<SZM>& managers,
+    const std::vector<ZoneJob>& jobs,
+    std::vector<ChunkJob>& chunks,
+    int64_t epochOffset) {
+
+  std::atomic<int> next(0);
+  const int numChunks = chunks.size();
+  auto worker = [&](SZM& manager) {
+    for (;;) {
+      int c = next++;
+      if (c >= numChunks) break;
+      ChunkJob& chunk = chunks[c];
+      processZoneChunk(manager, jobs[chunk.jobIndex], chunk, epochOffset);
+    }
+  };
+
+  if (numJobs <= 1) {
+    worker(*managers[0]);
+    return;
+  }
+
+  std::vector<std::thread> threads;
+  for (int j = 0; j < numJobs; j++) {
+    threads.emplace_back(worker, std::ref(*managers[j]));
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+/**
+ * Set the 'key' of the result cache of the given zone. The zone data is
+ * compiled into the zonedb of AceTime, which is generated from a single TZDB
+ * version by each release, so the library version, the TZDB version and the
+ * --scope identify the ZoneInfo of the zone. The kOutputVersion stands for this
+ * program itself.
+ */
+static void zoneResultKey(ResultKey *key, const char *zoneName) {
+  resultKeyInit(key);
+  resultKeyAddString(key, "AceTime");
+  resultKeyAddInt(key, kOutputVersion);
+  resultKeyAddString(key, ACE_TIME_VERSION_STRING);
+  resultKeyAddString(key, zonedbx::kZoneContext.tzVersion);
+  resultKeyAddString(key, scopeString);
+  resultKeyAddInt(key, startYear);
+  resultKeyAddInt(key, untilYear);
+  resultKeyAddInt(key, epochYear);
+  resultKeyAddInt(key, samplingInterval);
+  resultKeyAddInt(key, minGap);
+  resultKeyAddInt(key, useInternalTransitions);
+  resultKeyAddString(key, zoneName);
+}
+
+/**
+ * Process all zones in 'jobs' and print them on the STDOUT. The zones are
+ * processed in batches, and each batch is printed and freed as soon as it is
+ * done, so that only a single batch is held in memory. A single thread uses a
+ * batch of one zone. Multiple threads use a few zones per thread, so that the
+ * threads stay busy until the end of each batch.
+ *
+ * AceTime uses 32-bit epoch seconds, so the [startYear, untilYear) interval is
+ * processed in windows of 100 years, each with its own
+ * Epoch::currentEpochYear(). The current epoch year is a global variable
+ * inside AceTime, so it is changed only here, between windows, when none of the
+ * worker threads are running. Each window is split into chunks of
+ * --chunk_years years, and every (zone, chunk) pair of the batch is a separate
+ * job for the worker threads, so that a few zones over a long range can still
+ * keep all threads busy. The chunks of each zone are merged in order at the
+ * end of each window.
+ *
+ * With --cache_dir, the entries of the batch are first loaded from the cache,
+ * and only the other zones are processed, then stored into the cache before
+ * the batch is printed. The cache is accessed only here, outside of the
+ * worker threads.
+ *
+ * With --verify, each entry is compared against the baseline instead of being
+ * printed. With --fail_fast, the new items of each zone are also compared at
+ * the end of every window, and a zone which has failed gets no more chunks, so
+ * its processing stops at the end of the window of its first mismatch.
+ */
+template <typename SZM>
+int8_t processZones(ZoneManagers<SZM>& managers, std::vector<ZoneJob>& jobs) {
   // Number of seconds to add to unix seconds to get the requested epoch
   // seconds.
   int64_t epochOffset = - LocalDate::forComponents(epochYear, 1, 1)
       .toUnixSeconds64();
 
-  addTransitions(
-      &entry->transitions,
-      zoneName,
-      tz,
-      startYear,
-      untilYear,
-      epochOffset);
-
-  addMonthlySamples(
-      &entry->samples,
-      zoneName,
-      tz,
-      startYear,
-      untilYear,
-      epochOffset);
+  const int batchSize = (numJobs <= 1) ? 1 : numJobs * 4;
+  const int numZones = jobs.size();
+  for (int begin = 0; begin < numZones; begin += batchSize) {
+    int end = begin + batchSize;
+    if (end > numZones) end = numZones;
+
+    // Create entry for each zone of the batch.
+    TestData testData;
+    testDataInitPresized(&testData, end - begin, startYear, untilYear);
+    for (int i = begin; i < end; i++) {
+      TestEntry *entry = testDataNewEntry(&testData);
+      strncpy(entry->zone_name, jobs[i].zoneName, ZONE_NAME_SIZE - 1);
+      entry->zone_name[ZONE_NAME_SIZE - 1] = '\0';
+      jobs[i].entryIndex = testData.num_entries - 1;
+      jobs[i].cached = false;
+      jobs[i].failed = false;
+      if (verifyFile != nullptr) {
+        verifyZoneInit(&jobs[i].verification, jobs[i].zoneName);
+      }
+      if (cacheDir != nullptr) {
+        ResultKey key;
+        zoneResultKey(&key, jobs[i].zoneName);
+        if (resultCacheLoad(cacheDir, key, entry) == 0) {
+          fprintf(stderr, "[%d] Zone %s: cached\n", i, jobs[i].zoneName);
+          jobs[i].cached = true;
+        }
+      }
+    }
+
+    for (int16_t window = startYear; window < untilYear; window += 100) {
+      Epoch::currentEpochYear(window + 50);
+      int16_t windowUntil = window + 100;
+      if (windowUntil > untilYear) windowUntil = untilYear;
+
+      // Create the chunks of the window, grouped by zone, in order of years.
+      std::vector<ChunkJob> chunks;
+      for (int i = begin; i < end; i++) {
+        if (jobs[i].cached) continue;
+        if (failFast && jobs[i].verification.failed) continue;
+        for (int16_t start = window; start < windowUntil;
+            start += chunkYears) {
+          int16_t until = start + chunkYears;
+          if (until > windowUntil) until = windowUntil;
+          ChunkJob chunk = {i, start, until, {}, {}, 0.0, {}, false};
+          testCollectionInit(&chunk.transitions);
+          testCollectionInit(&chunk.samples);
+          chunks.push_back(chunk);
+        }
+      }
+
+      processChunks(managers, jobs, chunks, epochOffset);
+
+      for (ChunkJob& chunk : chunks) {
+        ZoneJob& job = jobs[chunk.jobIndex];
+        mergeChunk(&testData.entries[job.entryIndex], job, chunk);
+        testCollectionClear(&chunk.transitions);
+        testCollectionClear(&chunk.samples);
+      }
+
+      if (failFast) {
+        for (int i = begin; i < end; i++) {
+          verifyZone(&jobs[i].verification,
+              &testData.entries[jobs[i].entryIndex]);
+        }
+      }
+    }
+
+    if (cacheDir != nullptr) {
+      for (int i = begin; i < end; i++) {
+        if (jobs[i].cached) continue;
+        // The entry of a zone stopped by --fail_fast is incomplete.
+        if (failFast && jobs[i].verification.failed) continue;
+        if (jobs[i].failed) continue;
+        ResultKey key;
+        zoneResultKey(&key, jobs[i].zoneName);
+        resultCacheStore(cacheDir, key, &testData.entries[jobs[i].entryIndex]);
+      }
+    }
 
+    int8_t err = 0;
+    for (int z = 0; !err && z < testData.num_entries; z++) {
+      auto outputTime = std::chrono::steady_clock::now();
+      if (verifyFile != nullptr) {
+        verifyFinishZone(&jobs[begin + z].verification, &testData.entries[z]);
+      } else {
+        err = printEntry(&testData.entries[z], begin + z == 0);
+      }
+      phaseStatsAdd(&jobs[begin + z].stats.output, secondsSince(outputTime),
+          SamplingStats());
+    }
+    testDataClear(&testData);
+    if (err) return err;
+  }
   return 0;
 }
 
+/**
+ * Benchmark the ZoneProcessorCache for --benchmark, by converting the 2nd of
+ * each month of [startYear, untilYear) in every zone, with the zones
+ * interleaved in round-robin order, like a server which handles requests from
+ * users in many different zones. Each conversion looks up its zone through the
+ * ZoneManager, so a --cache_size smaller than the number of zones causes a
+ * cache miss and a reset of a ZoneProcessor on almost every conversion.
+ *
+ * The conversions are done twice, with the same findByLocalDateTime() lookup:
+ * through the virtual function of the ZoneProcessor base class, as a TimeZone
+ * does, then through the qualified function of the concrete ZoneProcessor
+ * type, as the sampling functions do, so that the difference is only the cost
+ * of the virtual dispatch. Uses a single thread, and prints the throughput on
+ * the STDOUT.
+ */
+template <typename SZM>
+int8_t runBenchmark(SZM& manager, const std::vector<ZoneJob>& jobs) {
+  typedef typename SZM::Processor ZP;
+  double seconds[2] = {0.0, 0.0};
+  long numConversions[2] = {0, 0};
+  for (int pass = 0; pass < 2; pass++) {
+    auto startTime = std::chrono::steady_clock::now();
+    for (int16_t start = startYear; start < untilYear; start += 100) {
+      Epoch::currentEpochYear(start + 50);
+      int16_t until = start + 100;
+      if (until > untilYear) until = untilYear;
+      for (int16_t year = start; year < until; year++) {
+        for (uint8_t month = 1; month <= 12; month++) {
+          auto ldt = LocalDateTime::forComponents(year, month, 2, 0, 0, 0);
+          for (const ZoneJob& job : jobs) {
+            ZP *processor = manager.getZoneProcessor(job.zoneName);
+            if (processor == nullptr) continue;
+            const ZoneProcessor *base = processor;
+            FindResult result = (pass == 0)
+                ? base->findByLocalDateTime(ldt)
+                : processor->ZP::findByLocalDateTime(ldt);
+            if (result.type != FindResult::kTypeNotFound) {
+              numConversions[pass]++;
+            }
+          }
+        }
+      }
+    }
+    seconds[pass] = secondsSince(startTime);
+  }
+
+  const char * const names[2] = {"virtual", "qualified"};
+  for (int pass = 0; pass < 2; pass++) {
+    printf("Benchmark: %s: scope %s, %d zones, cache size %d, "
+        "%ld conversions in %.3f s (%.0f conversions/s)\n",
+        names[pass], scopeString, (int) jobs.size(), cacheSize,
+        numConversions[pass], seconds[pass],
+        (seconds[pass] > 0) ? numConversions[pass] / seconds[pass] : 0.0);
+  }
+  return 0;
+}
+
+/** Number of zones in the summary of the slowest zones of the --stats file. */
+const int kNumSlowestZones = 20;
+
+/** Write the statistics of each zone into the --stats file. */
+int8_t writeZoneStats(const std::vector<ZoneJob>& jobs) {
+  std::vector<ZoneStats> stats;
+  for (const ZoneJob& job : jobs) {
+    stats.push_back(job.stats);
+  }
+  return writeStats(statsFile, stats, kNumSlowestZones);
+}
+
+/** Write the processing time of each zone into the --costs_out file. */
+int8_t writeCosts(const std::vector<ZoneJob>& jobs) {
+  FILE *f = fopen(costsOutFile, "w");
+  if (f == NULL) {
+    fprintf(stderr, "Unable to open costs file '%s'\n", costsOutFile);
+    return 1;
+  }
+  for (const ZoneJob& job : jobs) {
+    fprintf(f, "%s %.6f\n", job.zoneName, job.seconds);
+  }
+  fclose(f);
+  return 0;
+}
+
+/**
+ * Create the ScopedZoneManager of each worker thread for the registry of the
+ * scope, then run the --benchmark, or process the zones in 'jobs' and print
+ * them on the STDOUT, or compare them against the --verify baseline.
+ */
+template <typename ZP, typename ZM, typename ZI>
+int8_t processScope(
+    std::vector<ZoneJob>& jobs,
+    uint16_t registrySize,
+    const ZI* const* registry) {
+
+  typedef ScopedZoneManager<ZP, ZM> SZM;
+  ZoneManagers<SZM> managers;
+  for (int j = 0; j < numJobs; j++) {
+    managers.emplace_back(new SZM(registrySize, registry));
+  }
+
+  if (benchmark) return runBenchmark(*managers[0], jobs);
+  if (verifyFile != nullptr) return processZones(managers, jobs);
+  return printHeader() || processZones(managers, jobs) || printFooter();
+}
+
 /**
  * Read the list of zones from the 'zones.txt' in the stdin. Ignore blank lines
- * and comments (starting with '#'), and process each zone, one per line.
+ * and comments (starting with '#'). Then process the zones, one per line, which
+ * belong to the current shard, and print them on the STDOUT.
  */
-int8_t readAndProcessZones(TestData *testData) {
+int8_t readAndProcessZones() {
+  std::vector<char *> zoneNames;
   char line[MAX_LINE_SIZE];
-  int i = 0;
   while (true) {
     // fgets() always NUL-terminates
     char *s = fgets(line, MAX_LINE_SIZE, stdin);
@@ -141,11 +682,40 @@ int8_t readAndProcessZones(TestData *testData) {
     char* word = strtok_r(str, delim, &saveptr);
     if (word == NULL) continue;
 
-    processZone(testData, i, word);
-    i++;
+    zoneNames.push_back(strdup(word));
   }
 
-  return 0;
+  // Select the zones of this shard.
+  std::vector<bool> selected;
+  std::vector<const char *> names(zoneNames.begin(), zoneNames.end());
+  if (shardSelect(&shard, costsFile, names, selected)) return 1;
+
+  // Create a job for each selected zone
+  std::vector<ZoneJob> jobs;
+  for (size_t i = 0; i < zoneNames.size(); i++) {
+    if (selected[i]) {
+      jobs.push_back(
+          ZoneJob{zoneNames[i], -1, false, false, 0.0,
+              ZoneStats{zoneNames[i], {}, {}, {}}, {}});
+    }
+  }
+
+  // Select the instantiation of the scope once, here.
+  int8_t err;
+  if (scopeType == kScopeTypeBasic) {
+    err = processScope<BasicZoneProcessor, BasicZoneManager>(
+        jobs, zonedb::kZoneAndLinkRegistrySize, zonedb::kZoneAndLinkRegistry);
+  } else if (scopeType == kScopeTypeExtended) {
+    err = processScope<ExtendedZoneProcessor, ExtendedZoneManager>(
+        jobs, zonedbx::kZoneAndLinkRegistrySize, zonedbx::kZoneAndLinkRegistry);
+  } else {
+    err = processScope<CompleteZoneProcessor, CompleteZoneManager>(
+        jobs, zonedbc::kZoneAndLinkRegistrySize, zonedbc::kZoneAndLinkRegistry);
+  }
+  if (!err && costsOutFile != nullptr) err = writeCosts(jobs);
+  if (!err && statsFile != nullptr) err = writeZoneStats(jobs);
+  for (char *zoneName : zoneNames) free(zoneName);
+  return err;
 }
 
 //-----------------------------------------------------------------------------
@@ -154,6 +724,15 @@ void usageAndExit() {
   fprintf(stderr,
     "Usage: compare_acetime.out\n"
     "   --start_year start --until_year until --epoch_year year\n"
+    "   --scope (basic|extended|complete)\n"
+    "   [--sampling_interval hours] [--min_gap hours] [--jobs num]\n"
+    "   [--chunk_years years]\n"
+    "   [--shard index/count] [--costs file] [--costs_out file]\n"
+    "   [--stats file] [--cache_size size] [--benchmark]\n"
+    "   [--cache_dir dir]\n"
+    "   [--use_internal_transitions] [--check_transitions]\n"
+    "   [--format (json|bin)]\n"
+    "   [--verify baseline.(bin|json) [--fail_fast]]\n"
     "   < zones.txt\n");
   exit(1);
 }
@@ -173,6 +752,12 @@ void processCommandLine(int argc, const char* const* argv) {
   const char *until = "";
   const char *epoch = "";
   const char *scope = "";
+  const char *jobs = "1";
+  const char *chunk = "100";
+  const char *interval = "22";
+  const char *gap = "0";
+  const char *format = "json";
+  const char *cache = "2";
 
   shift(argc, argv);
   while (argc > 0) {
@@ -192,6 +777,65 @@ void processCommandLine(int argc, const char* const* argv) {
       shift(argc, argv);
       if (argc == 0) usageAndExit();
       scope = argv[0];
+    } else if (argEquals(argv[0], "--sampling_interval")) {
+      shift(argc, argv);
+      if (argc == 0) usageAndExit();
+      interval = argv[0];
+    } else if (argEquals(argv[0], "--min_gap")) {
+      shift(argc, argv);
+      if (argc == 0) usageAndExit();
+      gap = argv[0];
+    } else if (argEquals(argv[0], "--jobs")) {
+      shift(argc, argv);
+      if (argc == 0) usageAndExit();
+      jobs = argv[0];
+    } else if (argEquals(argv[0], "--chunk_years")) {
+      shift(argc, argv);
+      if (argc == 0) usageAndExit();
+      chunk = argv[0];
+    } else if (argEquals(argv[0], "--shard")) {
+      shift(argc, argv);
+      if (argc == 0) usageAndExit();
+      if (shardParse(&shard, argv[0])) {
+        fprintf(stderr, "Invalid --shard '%s'\n", argv[0]);
+        usageAndExit();
+      }
+    } else if (argEquals(argv[0], "--costs")) {
+      shift(argc, argv);
+      if (argc == 0) usageAndExit();
+      costsFile = argv[0];
+    } else if (argEquals(argv[0], "--costs_out")) {
+      shift(argc, argv);
+      if (argc == 0) usageAndExit();
+      costsOutFile = argv[0];
+    } else if (argEquals(argv[0], "--stats")) {
+      shift(argc, argv);
+      if (argc == 0) usageAndExit();
+      statsFile = argv[0];
+    } else if (argEquals(argv[0], "--cache_dir")) {
+      shift(argc, argv);
+      if (argc == 0) usageAndExit();
+      cacheDir = argv[0];
+    } else if (argEquals(argv[0], "--cache_size")) {
+      shift(argc, argv);
+      if (argc == 0) usageAndExit();
+      cache = argv[0];
+    } else if (argEquals(argv[0], "--benchmark")) {
+      benchmark = true;
+    } else if (argEquals(argv[0], "--format")) {
+      shift(argc, argv);
+      if (argc == 0) usageAndExit();
+      format = argv[0];
+    } else if (argEquals(argv[0], "--use_internal_transitions")) {
+      useInternalTransitions = true;
+    } else if (argEquals(argv[0], "--check_transitions")) {
+      checkTransitions = true;
+    } else if (argEquals(argv[0], "--verify")) {
+      shift(argc, argv);
+      if (argc == 0) usageAndExit();
+      verifyFile = argv[0];
+    } else if (argEquals(argv[0], "--fail_fast")) {
+      failFast = true;
     } else if (argEquals(argv[0], "--")) {
       shift(argc, argv);
       break;
@@ -224,6 +868,43 @@ void processCommandLine(int argc, const char* const* argv) {
   startYear = atoi(start);
   untilYear = atoi(until);
   epochYear = atoi(epoch);
+  numJobs = atoi(jobs);
+  chunkYears = atoi(chunk);
+  cacheSize = atoi(cache);
+  samplingInterval = atoi(interval);
+  minGap = atoi(gap);
+  // The stride must fit in the 32-bit acetime_t, so limit both to 1 year.
+  if (samplingInterval < 1 || samplingInterval > 8760) {
+    fprintf(stderr, "Invalid --sampling_interval: %s\n", interval);
+    usageAndExit();
+  }
+  if (minGap < 0 || minGap > 8760) {
+    fprintf(stderr, "Invalid --min_gap: %s\n", gap);
+    usageAndExit();
+  }
+  if (numJobs < 1) {
+    fprintf(stderr, "Invalid --jobs: %s\n", jobs);
+    usageAndExit();
+  }
+  // A chunk must fit inside a single 100-year epoch window.
+  if (chunkYears < 1 || chunkYears > 100) {
+    fprintf(stderr, "Invalid --chunk_years: %s\n", chunk);
+    usageAndExit();
+  }
+  // The ZoneProcessorCache holds at most 255 ZoneProcessors.
+  if (cacheSize < 1 || cacheSize > 255) {
+    fprintf(stderr, "Invalid --cache_size: %s\n", cache);
+    usageAndExit();
+  }
+  if (checkTransitions && ! useInternalTransitions) {
+    fprintf(stderr, "Flag --check_transitions requires "
+        "--use_internal_transitions\n");
+    usageAndExit();
+  }
+  if (failFast && verifyFile == nullptr) {
+    fprintf(stderr, "Flag --fail_fast requires --verify\n");
+    usageAndExit();
+  }
   if (strcmp(scope, "basic") == 0) {
     scopeType = kScopeTypeBasic;
     scopeString = scope;
@@ -238,20 +919,48 @@ void processCommandLine(int argc, const char* const* argv) {
     usageAndExit();
   }
 
+  if (strcmp(format, "json") == 0) {
+    formatType = kFormatJson;
+  } else if (strcmp(format, "bin") == 0) {
+    formatType = kFormatBin;
+    binWriter = new BinWriter(stdout);
+  } else {
+    fprintf(stderr, "Invalid --format: %s\n", format);
+    usageAndExit();
+  }
+
+  if (cacheDir != nullptr && resultCacheOpen(cacheDir)) exit(1);
+  if (verifyFile != nullptr
+      && verifyOpen(verifyFile, startYear, untilYear, epochYear, scopeString)) {
+    exit(1);
+  }
+
   // Configure the current epoch year.
   Epoch::currentEpochYear(epochYear);
 
   // Process the zones on the STDIN.
-  TestData testData;
-  testDataInit(&testData);
-  int8_t err = readAndProcessZones(&testData);
+  int8_t err = readAndProcessZones();
   if (err) exit(1);
 
-  printJson(&testData, startYear, untilYear, epochYear, scope,
-    ACE_TIME_VERSION_STRING, zonedbx::kZoneContext.tzVersion);
-
   // Cleanup
-  testDataClear(&testData);
+  delete binWriter;
+  printAllocStats();
+  printCacheStats();
+  if (cacheDir != nullptr) printResultCacheStats();
+
+  // The zones of the baseline are all expected only from an unsharded run.
+  if (verifyFile != nullptr && verifyFinish(shard.count == 1)) exit(1);
+
+  if (numTransitionMismatches > 0) {
+    fprintf(stderr, "%d zone(s) with mismatched internal transitions\n",
+        (int) numTransitionMismatches);
+    exit(1);
+  }
+  if (numFailedZones > 0) {
+    fprintf(stderr, "%d zone(s) with incomplete internal transitions\n",
+        numFailedZones);
+    exit(1);
+  }
 }
 
 //-----------------------------------------------------------------------------
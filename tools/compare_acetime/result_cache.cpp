@@ -0,0 +1,171 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h> // memcmp(), strncmp(), strlen()
+#include <sys/stat.h> // mkdir()
+#include <unistd.h> // getpid()
+#include "result_cache.h"
+
+/** Identifies a result cache file, and the version of its layout. */
+#define RESULT_CACHE_MAGIC "AVRC0001"
+#define RESULT_CACHE_MAGIC_SIZE 8
+
+/** Longest path of a file in the cache directory. */
+#define MAX_PATH_SIZE 1024
+
+ResultCacheStats resultCacheStats;
+
+void printResultCacheStats() {
+  fprintf(stderr, "Result cache: %ld hits, %ld misses\n",
+      resultCacheStats.numHits, resultCacheStats.numMisses);
+}
+
+int8_t resultCacheOpen(const char *cacheDir) {
+  if (mkdir(cacheDir, 0777) != 0 && errno != EEXIST) {
+    fprintf(stderr, "Unable to create cache directory '%s'\n", cacheDir);
+    return 1;
+  }
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+void resultKeyInit(ResultKey *key) {
+  key->hash = 14695981039346656037ull;
+}
+
+void resultKeyAdd(ResultKey *key, const void *data, size_t n) {
+  const uint8_t *p = (const uint8_t *) data;
+  uint64_t hash = key->hash;
+  for (size_t i = 0; i < n; i++) {
+    hash = (hash ^ p[i]) * 1099511628211ull;
+  }
+  key->hash = hash;
+}
+
+void resultKeyAddString(ResultKey *key, const char *s) {
+  resultKeyAdd(key, s, strlen(s) + 1);
+}
+
+void resultKeyAddInt(ResultKey *key, long value) {
+  char buf[24];
+  snprintf(buf, sizeof(buf), "%ld", value);
+  resultKeyAddString(key, buf);
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * Fixed header of a cache file. It is followed by the transitions then the
+ * samples, each one a TestItem followed by its abbreviation, because the
+ * abbrevIndex is valid only in the process which interned it.
+ */
+struct ResultHeader {
+  char magic[RESULT_CACHE_MAGIC_SIZE];
+  char zoneName[ZONE_NAME_SIZE];
+  int32_t numTransitions;
+  int32_t numSamples;
+};
+
+static void resultCachePath(
+    char *path,
+    const char *cacheDir,
+    const ResultKey& key) {
+  snprintf(path, MAX_PATH_SIZE, "%s/%016llx.entry",
+      cacheDir, (unsigned long long) key.hash);
+}
+
+static int8_t readCollection(
+    FILE *f,
+    TestCollection *collection,
+    int numItems) {
+  for (int i = 0; i < numItems; i++) {
+    TestItem *item = testCollectionNewItem(collection);
+    char abbrev[MAX_ABBREV_SIZE];
+    if (fread(item, sizeof(*item), 1, f) != 1) return 1;
+    if (fread(abbrev, sizeof(abbrev), 1, f) != 1) return 1;
+    abbrev[MAX_ABBREV_SIZE - 1] = '\0';
+    item->abbrevIndex = abbrevIntern(abbrev);
+  }
+  return 0;
+}
+
+static int8_t writeCollection(FILE *f, const TestCollection *collection) {
+  for (int i = 0; i < collection->numItems; i++) {
+    const TestItem *item = &collection->items[i];
+    char abbrev[MAX_ABBREV_SIZE] = {0};
+    strncpy(abbrev, abbrevString(item->abbrevIndex), MAX_ABBREV_SIZE - 1);
+    if (fwrite(item, sizeof(*item), 1, f) != 1) return 1;
+    if (fwrite(abbrev, sizeof(abbrev), 1, f) != 1) return 1;
+  }
+  return 0;
+}
+
+int8_t resultCacheLoad(
+    const char *cacheDir,
+    const ResultKey& key,
+    TestEntry *entry) {
+  char path[MAX_PATH_SIZE];
+  resultCachePath(path, cacheDir, key);
+  FILE *f = fopen(path, "rb");
+  if (f == nullptr) {
+    resultCacheStats.numMisses++;
+    return 1;
+  }
+
+  ResultHeader header;
+  bool err = fread(&header, sizeof(header), 1, f) != 1
+      || memcmp(header.magic, RESULT_CACHE_MAGIC, sizeof(header.magic)) != 0
+      || strncmp(header.zoneName, entry->zone_name, ZONE_NAME_SIZE) != 0
+      || header.numTransitions < 0
+      || header.numSamples < 0;
+  if (!err) {
+    err = readCollection(f, &entry->transitions, header.numTransitions)
+        || readCollection(f, &entry->samples, header.numSamples)
+        || fgetc(f) != EOF;
+  }
+  fclose(f);
+
+  if (err) {
+    // Discard the partial items of a truncated or foreign file.
+    entry->transitions.numItems = 0;
+    entry->samples.numItems = 0;
+    resultCacheStats.numMisses++;
+    return 1;
+  }
+  resultCacheStats.numHits++;
+  return 0;
+}
+
+int8_t resultCacheStore(
+    const char *cacheDir,
+    const ResultKey& key,
+    const TestEntry *entry) {
+  char path[MAX_PATH_SIZE];
+  char tmpPath[MAX_PATH_SIZE + 32];
+  resultCachePath(path, cacheDir, key);
+  snprintf(tmpPath, sizeof(tmpPath), "%s.%d.tmp", path, (int) getpid());
+
+  FILE *f = fopen(tmpPath, "wb");
+  if (f == nullptr) {
+    fprintf(stderr, "Unable to open cache file '%s'\n", tmpPath);
+    return 1;
+  }
+
+  ResultHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, RESULT_CACHE_MAGIC, sizeof(header.magic));
+  memcpy(header.zoneName, entry->zone_name, ZONE_NAME_SIZE);
+  header.numTransitions = entry->transitions.numItems;
+  header.numSamples = entry->samples.numItems;
+
+  bool err = fwrite(&header, sizeof(header), 1, f) != 1
+      || writeCollection(f, &entry->transitions)
+      || writeCollection(f, &entry->samples);
+  if (fclose(f) != 0) err = true;
+  if (!err && rename(tmpPath, path) != 0) err = true;
+  if (err) {
+    fprintf(stderr, "Unable to write cache file '%s'\n", path);
+    remove(tmpPath);
+  }
+  return err ? 1 : 0;
+}
@@ -0,0 +1,72 @@
+#ifndef COMPARE_ACETIME_RESULT_CACHE_H
+#define COMPARE_ACETIME_RESULT_CACHE_H
+
+#include <stddef.h> // size_t
+#include <stdint.h>
+#include "test_data.h"
+
+/**
+ * A directory of the TestEntry of each zone from previous runs, given by the
+ * '--cache_dir dir' flag, so that a rerun recomputes only the zones whose
+ * inputs have changed, and an interrupted run resumes where it stopped. Each
+ * zone is stored in its own file, named by a ResultKey which hashes everything
+ * that determines the TestEntry: the zone name, the zone data, the flags, and
+ * the library version.
+ *
+ * None of these functions are thread-safe. They are called only between
+ * batches, when no worker thread is running.
+ */
+struct ResultKey {
+  uint64_t hash; // 64-bit FNV-1a
+};
+
+/** Counters of the result cache, printed by printResultCacheStats(). */
+struct ResultCacheStats {
+  long numHits;
+  long numMisses;
+};
+
+extern ResultCacheStats resultCacheStats;
+
+/** Print the resultCacheStats on the STDERR. */
+void printResultCacheStats();
+
+/**
+ * Create the 'cacheDir' if it does not exist. Returns 0 on success, 1 on
+ * failure.
+ */
+int8_t resultCacheOpen(const char *cacheDir);
+
+/** Initialize the given key to the hash of no data. */
+void resultKeyInit(ResultKey *key);
+
+/** Add the 'n' bytes of 'data' to the key. */
+void resultKeyAdd(ResultKey *key, const void *data, size_t n);
+
+/** Add the string 's', including its terminating NUL, to the key. */
+void resultKeyAddString(ResultKey *key, const char *s);
+
+/** Add the decimal value of 'value' to the key. */
+void resultKeyAddInt(ResultKey *key, long value);
+
+/**
+ * Append the items stored under 'key' in 'cacheDir' to the given empty
+ * 'entry'. Returns 0 on a hit, 1 if there is no valid file for the key, or if
+ * it was written for a zone other than the zone_name of the entry.
+ */
+int8_t resultCacheLoad(
+    const char *cacheDir,
+    const ResultKey& key,
+    TestEntry *entry);
+
+/**
+ * Store the given 'entry' under 'key' in 'cacheDir'. The file is written under
+ * a temporary name, then renamed, so that an interrupted run never leaves a
+ * partial file behind. Returns 0 on success, 1 on failure.
+ */
+int8_t resultCacheStore(
+    const char *cacheDir,
+    const ResultKey& key,
+    const TestEntry *entry);
+
+#endif
@@ -1,5 +1,4 @@
 #include <stdint.h>
-#include <string.h> // strncpy()
 #include <stdio.h> // printf()
 #include <Arduino.h>
 #include <AceTime.h>
@@ -7,52 +6,124 @@
 
 using namespace ace_time;
 
-static const int SAMPLING_INTERVAL_HOURS = 22;
+thread_local SamplingStats samplingStats;
 
-static int8_t createTestItemFromEpochSeconds(
-    TestItem *ti,
-    const TimeZone& tz,
+// Lookups on the concrete ZoneProcessor type ZP. The qualified calls bypass the
+// virtual functions of the ZoneProcessor, so that they can be inlined. Each
+// lookup is counted in samplingStats.
+
+template <typename ZP>
+static FindResult findForEpochSeconds(
+    const ZP& processor, acetime_t epochSeconds) {
+  samplingStats.numFindByEpochSeconds++;
+  return processor.ZP::findByEpochSeconds(epochSeconds);
+}
+
+template <typename ZP>
+static FindResult findForLocalDateTime(
+    const ZP& processor, const LocalDateTime& ldt) {
+  samplingStats.numFindByLocalDateTime++;
+  return processor.ZP::findByLocalDateTime(ldt);
+}
+
+/** Return the total UTC offset of the given FindResult. */
+static int32_t totalOffsetSeconds(const FindResult& result) {
+  return result.stdOffsetSeconds + result.dstOffsetSeconds;
+}
+
+/**
+ * An instant with the FindResult of its lookup, and its local date time. All
+ * fields of a TestItem are derived from a single Instant, so that an item
+ * costs a single lookup.
+ *
+ * The FindResult::abbrev points into the transitions of the ZoneProcessor,
+ * which are overwritten by a later lookup in a different year, while the
+ * Instant is still held. So the abbreviation is interned at lookup time into
+ * 'abbrevIndex', and the pointer is cleared.
+ */
+struct Instant {
+  acetime_t epochSeconds;
+  FindResult result; // 'abbrev' is always nullptr
+  uint16_t abbrevIndex; // index from abbrevIntern(), if found
+  LocalDateTime ldt; // isError() if the zone has no data for the instant
+};
+
+// Create the Instant of a lookup, before any other lookup on the processor.
+static Instant makeInstant(
     acetime_t epochSeconds,
+    FindResult result,
+    const LocalDateTime& ldt) {
+  uint16_t abbrevIndex = (result.type != FindResult::kTypeNotFound
+      && result.abbrev != nullptr) ? abbrevIntern(result.abbrev) : 0;
+  result.abbrev = nullptr;
+  return Instant{epochSeconds, result, abbrevIndex, ldt};
+}
+
+// Look up the Instant of 'epochSeconds'. The local date time is derived from
+// the offsets of the same lookup, like ZonedDateTime::forEpochSeconds().
+template <typename ZP>
+static Instant findInstant(const ZP& processor, acetime_t epochSeconds) {
+  FindResult result = findForEpochSeconds(processor, epochSeconds);
+  LocalDateTime ldt = (result.type == FindResult::kTypeNotFound)
+      ? LocalDateTime::forError()
+      : LocalDateTime::forEpochSeconds(
+          epochSeconds + totalOffsetSeconds(result), result.fold);
+  return makeInstant(epochSeconds, result, ldt);
+}
+
+// Same as ZonedDateTime::forLocalDateTime(ldt).toEpochSeconds(). The requested
+// offsets give the same epoch seconds for all result types, including a gap.
+template <typename ZP>
+static acetime_t epochSecondsForLocalDateTime(
+    const ZP& processor, const LocalDateTime& ldt) {
+  FindResult result = findForLocalDateTime(processor, ldt);
+  if (result.type == FindResult::kTypeNotFound) {
+    return LocalDate::kInvalidEpochSeconds;
+  }
+  return ldt.toEpochSeconds()
+      - (result.reqStdOffsetSeconds + result.reqDstOffsetSeconds);
+}
+
+//-----------------------------------------------------------------------------
+
+static int8_t createTestItemFromInstant(
+    TestItem *ti,
+    const Instant& instant,
     char type,
     int64_t epochOffset) {
 
-  ZonedDateTime zdt = ZonedDateTime::forEpochSeconds(epochSeconds, tz);
-  if (zdt.isError()) return 1;
+  const LocalDateTime& ldt = instant.ldt;
+  if (ldt.isError()) return 1;
 
-  int64_t unixSeconds = epochSeconds
+  int64_t unixSeconds = instant.epochSeconds
       + Epoch::secondsToCurrentEpochFromUnixEpoch64();
   ti->epochSeconds = unixSeconds + epochOffset;
-  ti->year = zdt.year();
-  ti->month = zdt.month();
-  ti->day = zdt.day();
-  ti->hour = zdt.hour();
-  ti->minute = zdt.minute();
-  ti->second = zdt.second();
+  ti->year = ldt.year();
+  ti->month = ldt.month();
+  ti->day = ldt.day();
+  ti->hour = ldt.hour();
+  ti->minute = ldt.minute();
+  ti->second = ldt.second();
   ti->type = type;
 
-  ZonedExtra extra = ZonedExtra::forEpochSeconds(epochSeconds, tz);
-  if (zdt.isError()) return 1;
-
-  strncpy(ti->abbrev, extra.abbrev(), ZonedExtra::kAbbrevSize);
-  ti->abbrev[ZonedExtra::kAbbrevSize - 1] = '\0';
-  ti->dstOffset = extra.dstOffset().toSeconds();
-  ti->utcOffset = extra.timeOffset().toSeconds();
+  const FindResult& result = instant.result;
+  ti->abbrevIndex = instant.abbrevIndex;
+  ti->dstOffset = result.dstOffsetSeconds;
+  ti->utcOffset = totalOffsetSeconds(result);
 
   return 0;
 }
 
-static int8_t addTestItemFromEpochSeconds(
+static int8_t addTestItemFromInstant(
     TestCollection *collection,
     const char *zoneName,
-    const TimeZone& tz,
-    acetime_t epochSeconds,
+    const Instant& instant,
     char type,
     int64_t epochOffset) {
 
   (void) zoneName;
   TestItem *ti = testCollectionNewItem(collection);
-  int8_t err = createTestItemFromEpochSeconds(ti, tz, epochSeconds, type,
-      epochOffset);
+  int8_t err = createTestItemFromInstant(ti, instant, type, epochOffset);
   if (err) {
     testCollectionDeleteItem(collection);
     return err;
@@ -63,26 +134,25 @@ static int8_t addTestItemFromEpochSeconds(
 
 //-----------------------------------------------------------------------------
 
-// Return a non-zero code if a transition is detected from `s` to `t`:
+// Return a non-zero code if a transition is detected between the results of
+// two lookups:
 // * -1 - error
 // * 0 - no transition
 // * 1 - regular transition (total UTC offset is different)
 // * 2 - silent transition (both STD or DST changed and canceled each other)
-static int8_t isTransition(acetime_t t1, acetime_t t2, const TimeZone &tz)
+static int8_t classifyTransition(const FindResult& r1, const FindResult& r2)
 {
-  ZonedExtra ze1 = ZonedExtra::forEpochSeconds(t1, tz);
-  if (ze1.isError()) return -1;
-  ZonedExtra ze2 = ZonedExtra::forEpochSeconds(t2, tz);
-  if (ze2.isError()) return -1;
+  if (r1.type == FindResult::kTypeNotFound) return -1;
+  if (r2.type == FindResult::kTypeNotFound) return -1;
 
   // total UTC offsets
-  int32_t offset1 = ze1.timeOffset().toSeconds();
-  int32_t offset2 = ze2.timeOffset().toSeconds();
+  int32_t offset1 = totalOffsetSeconds(r1);
+  int32_t offset2 = totalOffsetSeconds(r2);
 
   if (offset1 != offset2) {
     // total UTC offset changed
     return 1;
-  } else if (ze1.stdOffset().toSeconds() != ze2.stdOffset().toSeconds()) {
+  } else if (r1.stdOffsetSeconds != r2.stdOffsetSeconds) {
     // the STD offset changed, but was canceled out by the DST offset
     return 2;
   }
@@ -90,114 +160,262 @@ static int8_t isTransition(acetime_t t1, acetime_t t2, const TimeZone &tz)
 }
 
 // Do a binary search to find the transition within the interval [left,
-// right) to within 1-second accuracy, and return the transition as a tuple of
-// (tleft, tright). Returns kInvalidEpochSeconds upon error (which should
-// not happen).
+// right) to within 1-second accuracy, and update 'left' and 'right' to the
+// Instants on either side of the transition. The result of the lookup of the
+// left end is reused, so each iteration costs a single lookup.
 //
 // Returns the following error code:
 // * -1 - error
 // * 0 - no transition
 // * 1 - transition (total UTC offset is different)
 // * 2 - silent transition (both STD and DST changed and cancelled each other)
+template <typename ZP>
 static int8_t binarySearchTransition(
-  acetime_t left, acetime_t right,
-  acetime_t* tleft, acetime_t* tright,
-  const TimeZone& tz)
+  Instant* left, Instant* right,
+  const ZP& processor)
 {
-  int8_t result = 0;
+  samplingStats.numBinarySearches++;
   for (;;) {
-    acetime_t delta_seconds = right - left;
+    samplingStats.numBinarySearchIterations++;
+    acetime_t delta_seconds = right->epochSeconds - left->epochSeconds;
     delta_seconds /= 2;
     if (delta_seconds == 0) {
-      result = isTransition(left, right, tz);
-      break;
+      return classifyTransition(left->result, right->result);
     }
 
-    acetime_t mid = left + delta_seconds;
-    result = isTransition(left, mid, tz);
+    Instant mid = findInstant(processor, left->epochSeconds + delta_seconds);
+    int8_t result = classifyTransition(left->result, mid.result);
     switch (result) {
       case -1:
         return result;
       case 0:
-        left = mid;
+        *left = mid;
         break;
       case 1:
       case 2:
-        right = mid;
+        *right = mid;
         break;
     }
   }
-
-  *tleft = left;
-  *tright = right;
-  return result;
 }
 
+// Longest stride of the gallop. Every month has at least 28 days, so a step of
+// at most 28 days ends in either the same local month or the next one, and
+// cannot step over a whole month without checking it against ruleMonths.
+static const acetime_t MAX_GALLOP_SECONDS = 28 * 24 * 3600;
+
+template <typename ZP>
 void addTransitionsForChunk(
     TestCollection *collection,
     const char *zoneName,
-    const TimeZone &tz,
+    ZP& processor,
     int16_t startYear,
     int16_t untilYear,
-    int64_t epochOffset) {
+    int64_t epochOffset,
+    int samplingIntervalHours,
+    int minGapHours) {
+
+  const acetime_t minStride = (acetime_t) samplingIntervalHours * 3600;
+  acetime_t maxStride = (acetime_t) minGapHours * 3600;
+  if (maxStride > MAX_GALLOP_SECONDS) maxStride = MAX_GALLOP_SECONDS;
+  if (maxStride < minStride) maxStride = minStride;
 
-  auto zdt = ZonedDateTime::forComponents(startYear, 1, 1, 0, 0, 0, tz);
-  if (zdt.isError()) return;
+  // Bit (m-1) is set if a transition was found in local month 'm'.
+  uint16_t ruleMonths = 0;
 
-  acetime_t t = zdt.toEpochSeconds();
+  acetime_t t = epochSecondsForLocalDateTime(
+      processor, LocalDateTime::forComponents(startYear, 1, 1, 0, 0, 0));
+  if (t == LocalDate::kInvalidEpochSeconds) return;
   t -= 86400; // go back one day because local TZ may not be UTC
 
-  zdt = ZonedDateTime::forEpochSeconds(t, tz);
-  if (zdt.isError()) return;
+  // Each step looks up only the next Instant, and compares it with the
+  // Instant of the previous step.
+  Instant prev = findInstant(processor, t);
+  if (prev.ldt.isError()) return;
+  acetime_t stride = minStride;
   for (;;) {
-    acetime_t nextt = t + SAMPLING_INTERVAL_HOURS * 3600;
-    ZonedDateTime nextzdt = ZonedDateTime::forEpochSeconds(nextt, tz);
-    if (nextzdt.isError()) continue;
-    if (nextzdt.year() >= untilYear) break;
+    // Use the minimum stride in the months where transitions occur.
+    if (ruleMonths & (1 << (prev.ldt.month() - 1))) stride = minStride;
+
+    Instant next = findInstant(processor, prev.epochSeconds + stride);
+    // The zone has no data for the next step. Retrying the same lookup would
+    // never end, so stop the scan, as for an error of classifyTransition().
+    if (next.ldt.isError()) break;
+    if (stride > minStride) {
+      // Retry with the minimum stride if the step would end in a month with
+      // transitions, or after the end of the interval.
+      if (next.ldt.year() >= untilYear
+          || (ruleMonths & (1 << (next.ldt.month() - 1)))) {
+        stride = minStride;
+        continue;
+      }
+    }
+    if (next.ldt.year() >= untilYear) break;
 
     // Look for utc offset transition
-    int8_t result = isTransition(t, nextt, tz);
+    int8_t result = classifyTransition(prev.result, next.result);
     if (result < 0) break;
 
     // Check if transition found
     if (result > 0) {
-      acetime_t left, right;
-      int8_t result = binarySearchTransition(t, nextt, &left, &right, tz);
+      Instant left = prev;
+      Instant right = next;
+      int8_t result = binarySearchTransition(&left, &right, processor);
       if (result == 1) {
         // normal transition
-        addTestItemFromEpochSeconds(
-            collection, zoneName, tz, left, 'A', epochOffset);
-        addTestItemFromEpochSeconds(
-            collection, zoneName, tz, right, 'B', epochOffset);
+        addTestItemFromInstant(collection, zoneName, left, 'A', epochOffset);
+        addTestItemFromInstant(collection, zoneName, right, 'B', epochOffset);
       } else if (result == 2) {
         // silent transition
-        addTestItemFromEpochSeconds(
-            collection, zoneName, tz, left, 'a', epochOffset);
-        addTestItemFromEpochSeconds(
-            collection, zoneName, tz, right, 'b', epochOffset);
+        addTestItemFromInstant(collection, zoneName, left, 'a', epochOffset);
+        addTestItemFromInstant(collection, zoneName, right, 'b', epochOffset);
       }
+
+      if (! right.ldt.isError()) {
+        ruleMonths |= (uint16_t) (1 << (right.ldt.month() - 1));
+      }
+      stride = minStride;
+    } else {
+      stride *= 2;
+      if (stride > maxStride) stride = maxStride;
+    }
+
+    prev = next;
+  }
+}
+
+//-----------------------------------------------------------------------------
+
+// Maximum number of transitions read from the ZoneProcessor for a single year.
+// The transition cache of the ExtendedZoneProcessor spans 14 months, so this is
+// larger than the number of transitions in any year of the TZDB.
+static const uint8_t MAX_TRANSITIONS_PER_YEAR = 16;
+
+// Read the start times of the transitions in the internal cache of the
+// BasicZoneProcessor, which must already be initialized for the year. Returns
+// the number of transitions in the cache, of which only the first
+// MAX_TRANSITIONS_PER_YEAR are copied into 'startTimes'.
+static int readProcessorTransitions(
+    BasicZoneProcessor& processor,
+    acetime_t *startTimes) {
+
+  int n = 0;
+  for (uint8_t i = 0; i < processor.getNumTransitions(); i++) {
+    if (n < MAX_TRANSITIONS_PER_YEAR) {
+      startTimes[n] = processor.getTransition(i)->startEpochSeconds;
     }
+    n++;
+  }
+  return n;
+}
 
-    t = nextt;
+// Read the start times of the active transitions in the TransitionStorage of
+// the ExtendedZoneProcessor or CompleteZoneProcessor, which must already be
+// initialized for the year. Returns the same as above.
+template <typename ZP>
+static int readTransitionStorage(ZP& processor, acetime_t *startTimes) {
+  const auto& storage = processor.getTransitionStorage();
+  int n = 0;
+  for (auto t = storage.getActivePoolBegin();
+      t != storage.getActivePoolEnd();
+      ++t) {
+    if (n < MAX_TRANSITIONS_PER_YEAR) startTimes[n] = (*t)->startEpochSeconds;
+    n++;
   }
+  return n;
+}
+
+static int readProcessorTransitions(
+    ExtendedZoneProcessor& processor,
+    acetime_t *startTimes) {
+  return readTransitionStorage(processor, startTimes);
 }
 
-void addTransitions(
+static int readProcessorTransitions(
+    CompleteZoneProcessor& processor,
+    acetime_t *startTimes) {
+  return readTransitionStorage(processor, startTimes);
+}
+
+// The processor caches the transitions of a window which is a little larger
+// than the requested year, so transitions whose local start year is not 'year'
+// are skipped. They are picked up when their own year is processed. Each
+// candidate is then classified by comparing the second before and after the
+// transition, which also filters out phantom transitions that are only
+// artifacts of the implementation. This costs a handful of lookups per
+// transition, instead of the many thousands of lookups needed to scan a year
+// in steps of the sampling interval.
+template <typename ZP>
+int8_t addInternalTransitionsForChunk(
     TestCollection *collection,
     const char *zoneName,
-    const TimeZone &tz,
+    ZP& processor,
     int16_t startYear,
     int16_t untilYear,
     int64_t epochOffset) {
 
-  // Loop in chunks of 100 years, to avoid overflowing unix_seconds.
-  for (int16_t start = startYear; start < untilYear; start += 100) {
-    int16_t epochYear = start + 50;
-    Epoch::currentEpochYear(epochYear);
-    int16_t until = start + 100;
-    if (until > untilYear) until = untilYear;
-    addTransitionsForChunk(collection, zoneName, tz, start, until, epochOffset);
+  acetime_t startTimes[MAX_TRANSITIONS_PER_YEAR];
+  for (int16_t year = startYear; year < untilYear; year++) {
+    // Copy the start times before doing any lookups, which may reinitialize
+    // the processor for a different year.
+    if (! processor.initForYear(year)) continue;
+    int numTransitions = readProcessorTransitions(processor, startTimes);
+    if (numTransitions > MAX_TRANSITIONS_PER_YEAR) {
+      fprintf(stderr, "ERROR %s %d: %d internal transitions, max is %d\n",
+          zoneName, year, numTransitions, MAX_TRANSITIONS_PER_YEAR);
+      return 1;
+    }
+
+    for (int i = 0; i < numTransitions; i++) {
+      Instant instant = findInstant(processor, startTimes[i]);
+      if (instant.ldt.isError() || instant.ldt.year() != year) continue;
+
+      Instant before = findInstant(processor, instant.epochSeconds - 1);
+      int8_t result = classifyTransition(before.result, instant.result);
+      if (result == 1) {
+        // normal transition
+        addTestItemFromInstant(
+            collection, zoneName, before, 'A', epochOffset);
+        addTestItemFromInstant(
+            collection, zoneName, instant, 'B', epochOffset);
+      } else if (result == 2) {
+        // silent transition
+        addTestItemFromInstant(
+            collection, zoneName, before, 'a', epochOffset);
+        addTestItemFromInstant(
+            collection, zoneName, instant, 'b', epochOffset);
+      }
+    }
+  }
+  return 0;
+}
+
+int compareTransitions(
+    const char *zoneName,
+    const TestCollection *observed,
+    const TestCollection *expected) {
+
+  int mismatches = 0;
+  if (observed->numItems != expected->numItems) {
+    fprintf(stderr, "ERROR %s transitions: num observed (%d) != expected (%d)\n",
+        zoneName, observed->numItems, expected->numItems);
+    mismatches++;
   }
+
+  int n = (observed->numItems < expected->numItems)
+      ? observed->numItems : expected->numItems;
+  for (int i = 0; i < n; i++) {
+    const TestItem *obs = &observed->items[i];
+    const TestItem *exp = &expected->items[i];
+    if (obs->epochSeconds != exp->epochSeconds || obs->type != exp->type) {
+      fprintf(stderr,
+          "ERROR %s transitions: obs[%d] (%ld, %c) != exp[%d] (%ld, %c)\n",
+          zoneName, i, (long) obs->epochSeconds, obs->type,
+          i, (long) exp->epochSeconds, exp->type);
+      mismatches++;
+    }
+  }
+  return mismatches;
 }
 
 //-----------------------------------------------------------------------------
@@ -214,10 +432,11 @@ void addTransitions(
 // But if that day of the month (with the time of 00:00) is ambiguous, I use a
 // loop to try subsequent days of month to find a day that works.  The first
 // attempt is marked with a type 'S'; subsequent attempts are marked with a 'T'.
+template <typename ZP>
 void addMonthlySamplesForChunk(
     TestCollection *collection,
     const char* zoneName,
-    const TimeZone& tz,
+    ZP& processor,
     int16_t startYear,
     int16_t untilYear,
     int64_t epochOffset) {
@@ -227,40 +446,42 @@ void addMonthlySamplesForChunk(
       char type = 'S';
       for (int d = 2; d <= 28; d++) {
         LocalDateTime ldt = LocalDateTime::forComponents(y, m, d, 0, 0, 0);
-        ZonedExtra extra = ZonedExtra::forLocalDateTime(ldt, tz);
-        if (extra.type() == ZonedExtra::kTypeExact
-            || extra.type() == ZonedExtra::kTypeOverlap) {
-          ZonedDateTime zdt = ZonedDateTime::forLocalDateTime(ldt, tz);
-          if (!zdt.isError()) {
-            acetime_t epochSeconds = zdt.toEpochSeconds();
-            if (epochSeconds != LocalDate::kInvalidEpochSeconds) {
-              addTestItemFromEpochSeconds(
-                  collection, zoneName, tz, epochSeconds, type, epochOffset);
-              break;
-            }
+        // For an exact or overlap (fold=0) match, the requested offsets are
+        // the offsets of the instant, so the item is created from this single
+        // lookup.
+        FindResult result = findForLocalDateTime(processor, ldt);
+        if (result.type == FindResult::kTypeExact
+            || result.type == FindResult::kTypeOverlap) {
+          acetime_t localSeconds = ldt.toEpochSeconds();
+          if (localSeconds != LocalDate::kInvalidEpochSeconds) {
+            acetime_t epochSeconds = localSeconds
+                - (result.reqStdOffsetSeconds + result.reqDstOffsetSeconds);
+            Instant instant = makeInstant(epochSeconds, result, ldt);
+            addTestItemFromInstant(
+                collection, zoneName, instant, type, epochOffset);
+            break;
           }
         }
         type = 'T';
+        samplingStats.numSampleRetries++;
       }
     }
   }
 }
 
-void addMonthlySamples(
-    TestCollection *collection,
-    const char* zoneName,
-    const TimeZone& tz,
-    int16_t startYear,
-    int16_t untilYear,
-    int64_t epochOffset) {
+//-----------------------------------------------------------------------------
 
-  // Loop in chunks of 100 years, to avoid overflowing unix_seconds.
-  for (int16_t start = startYear; start < untilYear; start += 100) {
-    int16_t epochYear = start + 50;
-    Epoch::currentEpochYear(epochYear);
-    int16_t until = start + 100;
-    if (until > untilYear) until = untilYear;
-    addMonthlySamplesForChunk(
-        collection, zoneName, tz, start, until, epochOffset);
-  }
-}
+// Instantiations for the processor of each scope.
+
+#define INSTANTIATE_SAMPLING(ZP) \
+  template void addTransitionsForChunk<ZP>( \
+      TestCollection *, const char *, ZP&, int16_t, int16_t, int64_t, \
+      int, int); \
+  template int8_t addInternalTransitionsForChunk<ZP>( \
+      TestCollection *, const char *, ZP&, int16_t, int16_t, int64_t); \
+  template void addMonthlySamplesForChunk<ZP>( \
+      TestCollection *, const char *, ZP&, int16_t, int16_t, int64_t);
+
+INSTANTIATE_SAMPLING(BasicZoneProcessor)
+INSTANTIATE_SAMPLING(ExtendedZoneProcessor)
+INSTANTIATE_SAMPLING(CompleteZoneProcessor)
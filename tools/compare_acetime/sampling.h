@@ -1,33 +1,97 @@
 #ifndef COMPARE_ACETIME_SAMPLING_H
 #define COMPARE_ACETIME_SAMPLING_H
 
+#include <AceTime.h>
 #include "test_data.h"
 
-namespace ace_time {
-class TimeZone;
-}
+/**
+ * Counters of the ZoneProcessor lookups made by the functions below on the
+ * current thread. The caller resets them before each phase of a zone, and
+ * reads them after the phase, for the --stats file.
+ */
+struct SamplingStats {
+  long numFindByEpochSeconds; // ZoneProcessor::findByEpochSeconds()
+  long numFindByLocalDateTime; // ZoneProcessor::findByLocalDateTime()
+  long numBinarySearches; // transitions located by binary search
+  long numBinarySearchIterations; // over all binary searches
+  long numSampleRetries; // 'T' retries of addMonthlySamplesForChunk()
+};
+
+extern thread_local SamplingStats samplingStats;
+
+// The functions below are templates on the concrete ZoneProcessor type ZP
+// (BasicZoneProcessor, ExtendedZoneProcessor or CompleteZoneProcessor), and
+// call the lookups of the 'processor' directly instead of going through the
+// virtual functions behind a TimeZone, so that each scope gets its own fully
+// inlined instantiation. The 'processor' must already be bound to 'zoneName',
+// for example by ZoneManager::getZoneProcessor(). The instantiations for the
+// 3 processor types are in sampling.cpp.
 
 /**
  * Add a TestItem for one second before a DST transition, and right at the
- * the DST transition.
+ * the DST transition, for the years [startYear, untilYear). The interval must
+ * fit inside the 32-bit epoch seconds of the current Epoch::currentEpochYear(),
+ * so the caller must split long intervals into chunks of 100 years.
+ *
+ * The transitions are found by scanning with a stride which starts at
+ * 'samplingIntervalHours' and doubles after every step without a transition,
+ * up to 'minGapHours' but at most 28 days, so that a step never skips a whole
+ * month. The stride falls back to 'samplingIntervalHours' after each
+ * transition, and during the months in which a transition was already found in
+ * an earlier year. Two transitions closer than 'minGapHours' to each other can
+ * be missed, for example a pair which restores the original UTC offset within
+ * a single stride before any of its months has been seen. If 'minGapHours' is
+ * less than or equal to 'samplingIntervalHours', the stride is fixed.
  */
-void addTransitions(
+template <typename ZP>
+void addTransitionsForChunk(
     TestCollection *collection,
     const char *zoneName,
-    const ace_time::TimeZone& tz,
+    ZP& processor,
+    int16_t startYear,
+    int16_t untilYear,
+    int64_t epochOffset,
+    int samplingIntervalHours,
+    int minGapHours);
+
+/**
+ * Same as addTransitionsForChunk(), but instead of scanning the interval, read
+ * the transitions of each year directly from the internal transition cache of
+ * the 'processor'. Phantom transitions (which change neither the total UTC
+ * offset nor the STD offset) are dropped. Similar to the
+ * --use_internal_transitions flag of `compare_acetz`. Returns non-zero, after
+ * printing an error on the STDERR, if a year has more transitions than can be
+ * read, in which case the 'collection' is incomplete.
+ */
+template <typename ZP>
+int8_t addInternalTransitionsForChunk(
+    TestCollection *collection,
+    const char *zoneName,
+    ZP& processor,
     int16_t startYear,
     int16_t untilYear,
     int64_t epochOffset);
 
+/**
+ * Compare the 'observed' transitions against the 'expected' transitions, and
+ * print the differences on the STDERR. Returns the number of mismatches.
+ */
+int compareTransitions(
+    const char *zoneName,
+    const TestCollection *observed,
+    const TestCollection *expected);
+
 /**
  * Add a TestItem for the 1st of each month (using the local time)
  * as a sanity sample, to make sure things are working, even for timezones with
- * no DST transitions.
+ * no DST transitions. The same chunking restriction as
+ * addTransitionsForChunk() applies.
  */
-void addMonthlySamples(
+template <typename ZP>
+void addMonthlySamplesForChunk(
     TestCollection *collection,
     const char *zoneName,
-    const ace_time::TimeZone& tz,
+    ZP& processor,
     int16_t startYear,
     int16_t untilYear,
     int64_t epochOffset);
@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h> // strtol()
+#include <string.h> // strchr()
+#include <algorithm> // sort()
+#include <map>
+#include <string>
+#include "shard.h"
+
+static const int MAX_COST_LINE_SIZE = 512;
+
+int shardParse(Shard *shard, const char *s) {
+  char *end;
+  long index = strtol(s, &end, 10);
+  if (end == s || *end != '/') return 1;
+  const char *t = end + 1;
+  long count = strtol(t, &end, 10);
+  if (end == t || *end != '\0') return 1;
+  if (count < 1 || index < 0 || index >= count) return 1;
+
+  shard->index = (int) index;
+  shard->count = (int) count;
+  return 0;
+}
+
+/**
+ * Read the "zone cost" lines of the given file into 'costs'. Blank lines and
+ * comments (starting with '#') are ignored. Returns 1 if the file cannot be
+ * opened.
+ */
+static int readCosts(
+    const char *costsFile,
+    std::map<std::string, double>& costs) {
+
+  FILE *f = fopen(costsFile, "r");
+  if (f == NULL) return 1;
+
+  char line[MAX_COST_LINE_SIZE];
+  while (fgets(line, MAX_COST_LINE_SIZE, f) != NULL) {
+    char* comment = strchr(line, '#');
+    if (comment != NULL) comment[0] = '\0';
+
+    char zoneName[MAX_COST_LINE_SIZE];
+    double cost;
+    if (sscanf(line, "%s %lf", zoneName, &cost) != 2) continue;
+    costs[zoneName] = cost;
+  }
+  fclose(f);
+  return 0;
+}
+
+int shardSelect(
+    const Shard *shard,
+    const char *costsFile,
+    const std::vector<const char *>& zoneNames,
+    std::vector<bool>& selected) {
+
+  int numZones = zoneNames.size();
+  std::vector<double> zoneCosts(numZones, 1.0);
+
+  // Look up the cost of each zone, using the average for unknown zones.
+  if (costsFile != NULL) {
+    std::map<std::string, double> costs;
+    if (readCosts(costsFile, costs)) {
+      fprintf(stderr, "Unable to read costs file '%s'\n", costsFile);
+      return 1;
+    }
+
+    double average = 1.0;
+    if (! costs.empty()) {
+      double sum = 0.0;
+      for (const auto& p : costs) sum += p.second;
+      average = sum / costs.size();
+    }
+
+    for (int i = 0; i < numZones; i++) {
+      auto it = costs.find(zoneNames[i]);
+      zoneCosts[i] = (it != costs.end()) ? it->second : average;
+    }
+  }
+
+  // Sort by descending cost, breaking ties by input order, so that every
+  // shard computes the same assignment.
+  std::vector<int> order(numZones);
+  for (int i = 0; i < numZones; i++) order[i] = i;
+  std::sort(order.begin(), order.end(), [&](int a, int b) {
+    if (zoneCosts[a] != zoneCosts[b]) return zoneCosts[a] > zoneCosts[b];
+    return a < b;
+  });
+
+  // Assign the most expensive remaining zone to the least loaded shard.
+  selected.assign(numZones, false);
+  std::vector<double> shardLoads(shard->count, 0.0);
+  for (int i : order) {
+    int best = 0;
+    for (int s = 1; s < shard->count; s++) {
+      if (shardLoads[s] < shardLoads[best]) best = s;
+    }
+    shardLoads[best] += zoneCosts[i];
+    selected[i] = (best == shard->index);
+  }
+
+  return 0;
+}
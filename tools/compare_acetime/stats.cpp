@@ -0,0 +1,105 @@
+#include <stdio.h> // fopen(), fprintf()
+#include <algorithm> // sort()
+#include "stats.h"
+
+void phaseStatsAdd(
+    PhaseStats *phase,
+    double seconds,
+    const SamplingStats& counts) {
+  phase->seconds += seconds;
+  phase->counts.numFindByEpochSeconds += counts.numFindByEpochSeconds;
+  phase->counts.numFindByLocalDateTime += counts.numFindByLocalDateTime;
+  phase->counts.numBinarySearches += counts.numBinarySearches;
+  phase->counts.numBinarySearchIterations += counts.numBinarySearchIterations;
+  phase->counts.numSampleRetries += counts.numSampleRetries;
+}
+
+static double zoneSeconds(const ZoneStats& stats) {
+  return stats.transitions.seconds + stats.samples.seconds
+      + stats.output.seconds;
+}
+
+static void printPhase(
+    FILE *f,
+    const char *indent,
+    const char *name,
+    const PhaseStats& phase) {
+  const SamplingStats& c = phase.counts;
+  fprintf(f, "%s\"%s\": {\"seconds\": %.6f, "
+      "\"find_by_epoch_seconds\": %ld, "
+      "\"find_by_local_date_time\": %ld, "
+      "\"binary_searches\": %ld, "
+      "\"binary_search_iterations\": %ld, "
+      "\"sample_retries\": %ld}",
+      indent, name, phase.seconds,
+      c.numFindByEpochSeconds, c.numFindByLocalDateTime, c.numBinarySearches,
+      c.numBinarySearchIterations, c.numSampleRetries);
+}
+
+/** Print the fields of the given ZoneStats, without the enclosing braces. */
+static void printPhases(FILE *f, const char *indent, const ZoneStats& stats) {
+  fprintf(f, "%s\"seconds\": %.6f,\n", indent, zoneSeconds(stats));
+  printPhase(f, indent, "transitions", stats.transitions);
+  fprintf(f, ",\n");
+  printPhase(f, indent, "samples", stats.samples);
+  fprintf(f, ",\n");
+  printPhase(f, indent, "output", stats.output);
+  fprintf(f, "\n");
+}
+
+int8_t writeStats(
+    const char *fileName,
+    const std::vector<ZoneStats>& stats,
+    int numSlowest) {
+
+  FILE *f = fopen(fileName, "w");
+  if (f == NULL) {
+    fprintf(stderr, "Unable to open stats file '%s'\n", fileName);
+    return 1;
+  }
+
+  ZoneStats total = {"total", {}, {}, {}};
+  for (const ZoneStats& zone : stats) {
+    phaseStatsAdd(&total.transitions, zone.transitions.seconds,
+        zone.transitions.counts);
+    phaseStatsAdd(&total.samples, zone.samples.seconds, zone.samples.counts);
+    phaseStatsAdd(&total.output, zone.output.seconds, zone.output.counts);
+  }
+
+  // Sort by decreasing total time, keeping the input order of ties.
+  std::vector<const ZoneStats *> slowest;
+  for (const ZoneStats& zone : stats) slowest.push_back(&zone);
+  std::stable_sort(slowest.begin(), slowest.end(),
+      [](const ZoneStats *a, const ZoneStats *b) {
+        return zoneSeconds(*a) > zoneSeconds(*b);
+      });
+  if ((int) slowest.size() > numSlowest) slowest.resize(numSlowest);
+
+  fprintf(f, "{\n");
+  fprintf(f, "  \"num_zones\": %d,\n", (int) stats.size());
+  fprintf(f, "  \"total\": {\n");
+  printPhases(f, "    ", total);
+  fprintf(f, "  },\n");
+
+  fprintf(f, "  \"slowest\": [");
+  for (size_t i = 0; i < slowest.size(); i++) {
+    fprintf(f, "%s\n    {\"zone\": \"%s\", \"seconds\": %.6f}",
+        (i == 0) ? "" : ",", slowest[i]->zoneName, zoneSeconds(*slowest[i]));
+  }
+  fprintf(f, "\n  ],\n");
+
+  fprintf(f, "  \"zones\": {");
+  for (size_t i = 0; i < stats.size(); i++) {
+    fprintf(f, "%s\n    \"%s\": {\n",
+        (i == 0) ? "" : ",", stats[i].zoneName);
+    printPhases(f, "      ", stats[i]);
+    fprintf(f, "    }");
+  }
+  fprintf(f, "\n  }\n");
+  fprintf(f, "}\n");
+
+  int8_t err = ferror(f) ? 1 : 0;
+  if (fclose(f) != 0) err = 1;
+  if (err) fprintf(stderr, "Unable to write stats file '%s'\n", fileName);
+  return err;
+}
@@ -0,0 +1,44 @@
+#ifndef COMPARE_ACETIME_STATS_H
+#define COMPARE_ACETIME_STATS_H
+
+#include <stdint.h>
+#include <vector>
+#include "sampling.h"
+
+/** Wall time and AceTime lookup counters of a single phase of a zone. */
+struct PhaseStats {
+  double seconds;
+  SamplingStats counts;
+};
+
+/** Add the 'seconds' and 'counts' of one chunk into the given PhaseStats. */
+void phaseStatsAdd(
+    PhaseStats *phase,
+    double seconds,
+    const SamplingStats& counts);
+
+/**
+ * Statistics of a single zone, accumulated over all of its chunks, for the
+ * --stats file. The 'output' phase is the time spent writing the TestEntry of
+ * the zone in the JSON or binary format, and has no lookups.
+ */
+struct ZoneStats {
+  const char *zoneName;
+  PhaseStats transitions;
+  PhaseStats samples;
+  PhaseStats output;
+};
+
+/**
+ * Write the given ZoneStats into the JSON file 'fileName'. The file contains
+ * the totals of each phase over all zones, a summary of the 'numSlowest'
+ * slowest zones sorted by decreasing total time, and the phases of each zone
+ * in the order of 'stats'. Returns 0 on success, 1 if the file cannot be
+ * written.
+ */
+int8_t writeStats(
+    const char *fileName,
+    const std::vector<ZoneStats>& stats,
+    int numSlowest);
+
+#endif
@@ -1,18 +1,175 @@
 #include <stdio.h>
-#include <stdlib.h> // realloc()
+#include <stdlib.h> // malloc(), realloc()
+#include <string.h> // memcpy(), strlen(), strcmp()
+#include <vector>
 #include "test_data.h"
 
+AllocStats allocStats;
+
+void printAllocStats() {
+  fprintf(stderr,
+      "Allocations: %ld mallocs (%ld bytes), %ld reallocs, %ld arena copies\n",
+      allocStats.numMallocs.load(), allocStats.numBytes.load(),
+      allocStats.numReallocs.load(), allocStats.numArenaCopies.load());
+}
+
+//-----------------------------------------------------------------------------
+
+// Size of the open addressing hash table of abbrevIntern(), a power of 2 which
+// is at least twice MAX_ABBREVS.
+static const uint32_t ABBREV_HASH_SIZE = 2 * MAX_ABBREVS;
+
+// Size of the per-thread cache of abbrevIntern(), a power of 2.
+static const uint32_t ABBREV_CACHE_SIZE = 64;
+
+// The entries of the table are never modified after they are added, so
+// abbrevString() reads them without the mutex.
+static std::mutex abbrevMutex;
+static char abbrevs[MAX_ABBREVS][MAX_ABBREV_SIZE];
+static int numAbbrevs = 0;
+static uint16_t abbrevSlots[ABBREV_HASH_SIZE]; // index + 1, 0 means empty
+
+/** An entry of the per-thread cache of abbrevIntern(). */
+struct AbbrevCacheEntry {
+  char key[MAX_ABBREV_SIZE];
+  uint16_t index; // index + 1, 0 means empty
+};
+
+uint16_t abbrevIntern(const char *abbrev) {
+  // FNV-1a hash of the truncated abbreviation
+  char key[MAX_ABBREV_SIZE];
+  uint32_t hash = 2166136261u;
+  int len = 0;
+  for (; len < MAX_ABBREV_SIZE - 1 && abbrev[len] != '\0'; len++) {
+    key[len] = abbrev[len];
+    hash = (hash ^ (uint8_t) abbrev[len]) * 16777619u;
+  }
+  key[len] = '\0';
+
+  // Most lookups are found in the cache of the thread, without the mutex.
+  thread_local AbbrevCacheEntry cache[ABBREV_CACHE_SIZE];
+  AbbrevCacheEntry &cached = cache[hash & (ABBREV_CACHE_SIZE - 1)];
+  if (cached.index != 0 && strcmp(cached.key, key) == 0) {
+    return cached.index - 1;
+  }
+
+  uint16_t index;
+  {
+    std::lock_guard<std::mutex> lock(abbrevMutex);
+    uint32_t slot = hash & (ABBREV_HASH_SIZE - 1);
+    for (;;) {
+      uint16_t entry = abbrevSlots[slot];
+      if (entry == 0 || strcmp(abbrevs[entry - 1], key) == 0) break;
+      slot = (slot + 1) & (ABBREV_HASH_SIZE - 1);
+    }
+
+    if (abbrevSlots[slot] != 0) {
+      index = abbrevSlots[slot] - 1;
+    } else {
+      if (numAbbrevs >= MAX_ABBREVS) {
+        fprintf(stderr, "Too many abbreviations (max %d)\n", MAX_ABBREVS);
+        exit(1);
+      }
+      memcpy(abbrevs[numAbbrevs], key, len + 1);
+      index = (uint16_t) numAbbrevs++;
+      abbrevSlots[slot] = index + 1;
+    }
+  }
+
+  memcpy(cached.key, key, len + 1);
+  cached.index = index + 1;
+  return index;
+}
+
+const char *abbrevString(uint16_t index) {
+  return abbrevs[index];
+}
+
+//-----------------------------------------------------------------------------
+
+/** Alignment of each allocation in the arena. */
+static const size_t ARENA_ALIGNMENT = 16;
+
+/** A single block of memory of an Arena. The data follows the header. */
+struct ArenaBlock {
+  ArenaBlock *next;
+  size_t capacity;
+  size_t used;
+};
+
+/** Round up the size to the ARENA_ALIGNMENT. */
+static constexpr size_t arenaRound(size_t size) {
+  return (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+}
+
+/** Size of the ArenaBlock header, rounded up to the ARENA_ALIGNMENT. */
+static const size_t ARENA_HEADER_SIZE = arenaRound(sizeof(ArenaBlock));
+
+void arenaInit(Arena *arena, size_t blockSize) {
+  arena->blocks = nullptr;
+  arena->blockSize = blockSize;
+}
+
+void *arenaAlloc(Arena *arena, size_t size) {
+  size = arenaRound(size);
+  std::lock_guard<std::mutex> lock(arena->mutex);
+  ArenaBlock *block = arena->blocks;
+  if (block == nullptr || block->used + size > block->capacity) {
+    size_t capacity = (size > arena->blockSize) ? size : arena->blockSize;
+    block = (ArenaBlock *) malloc(ARENA_HEADER_SIZE + capacity);
+    if (block == nullptr) {
+      fprintf(stderr, "arenaAlloc(): malloc failure\n");
+      exit(1);
+    }
+    allocStats.numMallocs++;
+    allocStats.numBytes += (long) (ARENA_HEADER_SIZE + capacity);
+    block->next = arena->blocks;
+    block->capacity = capacity;
+    block->used = 0;
+    arena->blocks = block;
+  }
+  void *p = (char *) block + ARENA_HEADER_SIZE + block->used;
+  block->used += size;
+  return p;
+}
+
+void arenaClear(Arena *arena) {
+  ArenaBlock *block = arena->blocks;
+  while (block != nullptr) {
+    ArenaBlock *next = block->next;
+    free(block);
+    block = next;
+  }
+  arena->blocks = nullptr;
+}
+
+//-----------------------------------------------------------------------------
+
 void testCollectionInit(TestCollection *collection)
 {
   collection->numItems = 0;
   collection->capacity = 0;
   collection->items = NULL;
+  collection->arena = NULL;
   testCollectionResize(collection, 10);
 }
 
+void testCollectionInitArena(
+    TestCollection *collection,
+    Arena *arena,
+    int capacity)
+{
+  collection->numItems = 0;
+  collection->capacity = capacity;
+  collection->items = (TestItem*) arenaAlloc(
+      arena, sizeof(TestItem) * capacity);
+  collection->arena = arena;
+}
+
 void testCollectionClear(TestCollection *collection)
 {
-  free(collection->items);
+  // Items in an arena are freed with the arena.
+  if (collection->arena == NULL) free(collection->items);
   collection->numItems = 0;
   collection->capacity = 0;
   collection->items = NULL;
@@ -20,12 +177,25 @@ void testCollectionClear(TestCollection *collection)
 
 void testCollectionResize(TestCollection *collection, int newsize)
 {
+  if (collection->arena != NULL) {
+    // The old items are abandoned until the arena is cleared.
+    TestItem* newitems = (TestItem*) arenaAlloc(
+        collection->arena, sizeof(TestItem) * newsize);
+    memcpy(newitems, collection->items,
+        sizeof(TestItem) * collection->numItems);
+    allocStats.numArenaCopies++;
+    collection->items = newitems;
+    collection->capacity = newsize;
+    return;
+  }
+
   TestItem* newitems = (TestItem*) realloc(
       collection->items, sizeof(TestItem) * newsize);
   if (newitems == NULL) {
     fprintf(stderr, "testCollectionResize(): realloc failure\n");
     exit(1);
   }
+  allocStats.numReallocs++;
   collection->items = newitems;
   collection->capacity = newsize;
 }
@@ -59,20 +229,60 @@ void testDataEntryClear(TestEntry *entry)
 
 //-----------------------------------------------------------------------------
 
+/**
+ * Default number of items of each collection, if the year range is unknown. A
+ * zone has exactly 12 samples per year, and most zones have at most 2
+ * transitions per year, each producing 2 items.
+ */
+static const int DEFAULT_NUM_ITEMS = 10;
+static const int SAMPLES_PER_YEAR = 12;
+static const int TRANSITION_ITEMS_PER_YEAR = 4;
+
+/** Minimum size of the arena blocks of a TestData. */
+static const size_t TEST_DATA_BLOCK_SIZE = 64 * 1024;
+
 void testDataInit(TestData *data)
 {
+  testDataInitPresized(data, DEFAULT_NUM_ITEMS, 0, 0);
+}
+
+void testDataInitPresized(
+    TestData *data,
+    int numEntries,
+    int startYear,
+    int untilYear)
+{
+  int numYears = untilYear - startYear;
+  if (numYears < 0) numYears = 0;
+  data->numTransitions = TRANSITION_ITEMS_PER_YEAR * numYears;
+  if (data->numTransitions < DEFAULT_NUM_ITEMS) {
+    data->numTransitions = DEFAULT_NUM_ITEMS;
+  }
+  data->numSamples = SAMPLES_PER_YEAR * numYears;
+  if (data->numSamples < DEFAULT_NUM_ITEMS) {
+    data->numSamples = DEFAULT_NUM_ITEMS;
+  }
+  if (numEntries < 1) numEntries = 1;
+
+  // Size the first block to hold all the entries and their items, so that a
+  // single malloc() is normally sufficient.
+  size_t size = arenaRound(sizeof(TestEntry) * numEntries)
+      + (arenaRound(sizeof(TestItem) * data->numTransitions)
+          + arenaRound(sizeof(TestItem) * data->numSamples))
+      * numEntries;
+  arenaInit(&data->arena,
+      (size > TEST_DATA_BLOCK_SIZE) ? size : TEST_DATA_BLOCK_SIZE);
+
   data->num_entries = 0;
-  data->capacity = 0;
-  data->entries = NULL;
-  testDataResize(data, 10);
+  data->capacity = numEntries;
+  data->entries = (TestEntry*) arenaAlloc(
+      &data->arena, sizeof(TestEntry) * numEntries);
 }
 
 void testDataClear(TestData *data)
 {
-  for (int i = data->num_entries - 1; i >= 0; i--) {
-    testDataEntryClear(&data->entries[i]);
-  }
-  free(data->entries);
+  // All entries and their items are in the arena.
+  arenaClear(&data->arena);
 
   data->num_entries = 0;
   data->capacity = 0;
@@ -81,12 +291,11 @@ void testDataClear(TestData *data)
 
 void testDataResize(TestData *data, int newsize)
 {
-  TestEntry* newentries = (TestEntry*) realloc(
-      data->entries, sizeof(TestEntry) * newsize);
-  if (newentries == NULL) {
-    fprintf(stderr, "testDataResize(): realloc failure\n");
-    exit(1);
-  }
+  // The old entries are abandoned until the arena is cleared.
+  TestEntry* newentries = (TestEntry*) arenaAlloc(
+      &data->arena, sizeof(TestEntry) * newsize);
+  memcpy(newentries, data->entries, sizeof(TestEntry) * data->num_entries);
+  allocStats.numArenaCopies++;
   data->entries = newentries;
   data->capacity = newsize;
 }
@@ -97,35 +306,95 @@ TestEntry *testDataNewEntry(TestData *data)
     testDataResize(data, data->capacity * 2);
   }
   TestEntry *entry = &data->entries[data->num_entries++];
-  test_data_entry_init(entry);
+  testCollectionInitArena(
+      &entry->transitions, &data->arena, data->numTransitions);
+  testCollectionInitArena(
+      &entry->samples, &data->arena, data->numSamples);
   return entry;
 }
 
 void testDataDeleteEntry(TestData *data)
 {
   data->num_entries--;
-  TestEntry *entry = &data->entries[data->num_entries];
-  testDataEntryClear(entry);
 }
 
 //-----------------------------------------------------------------------------
 
-static void printItem(const char *indent, const TestItem *item) {
-  printf("%s\"epoch\": %ld,\n", indent, item->epochSeconds);
-  printf("%s\"total_offset\": %d,\n", indent, item->utcOffset);
-  printf("%s\"dst_offset\": %d,\n", indent, item->dstOffset);
-  printf("%s\"y\": %d,\n", indent, item->year);
-  printf("%s\"M\": %d,\n", indent, item->month);
-  printf("%s\"d\": %d,\n", indent, item->day);
-  printf("%s\"h\": %d,\n", indent, item->hour);
-  printf("%s\"m\": %d,\n", indent, item->minute);
-  printf("%s\"s\": %d,\n", indent, item->second);
-  printf("%s\"abbrev\": \"%s\",\n", indent, item->abbrev);
-  printf("%s\"type\": \"%c\"\n", indent, item->type);
-}
-
-void printJson(
-  const TestData *testData,
+// Output buffer for the TestEntry records. The records make up almost all of
+// the output, so they are formatted by hand into this buffer instead of using
+// one printf() per field.
+static char outBuffer[64 * 1024];
+static size_t outLen = 0;
+
+static void outFlush() {
+  fwrite(outBuffer, 1, outLen, stdout);
+  outLen = 0;
+}
+
+static void outBytes(const char *s, size_t n) {
+  if (outLen + n > sizeof(outBuffer)) {
+    outFlush();
+    if (n > sizeof(outBuffer)) {
+      fwrite(s, 1, n, stdout);
+      return;
+    }
+  }
+  memcpy(outBuffer + outLen, s, n);
+  outLen += n;
+}
+
+static void outString(const char *s) {
+  outBytes(s, strlen(s));
+}
+
+static void outLong(long value) {
+  char buf[24];
+  char *end = buf + sizeof(buf);
+  char *p = end;
+  unsigned long u = (value < 0) ? -(unsigned long) value : (unsigned long) value;
+  do {
+    *--p = (char) ('0' + u % 10);
+    u /= 10;
+  } while (u != 0);
+  if (value < 0) *--p = '-';
+  outBytes(p, (size_t) (end - p));
+}
+
+static void printItem(const TestItem *item) {
+  outString("          \"epoch\": ");
+  outLong(item->epochSeconds);
+  outString(",\n          \"total_offset\": ");
+  outLong(item->utcOffset);
+  outString(",\n          \"dst_offset\": ");
+  outLong(item->dstOffset);
+  outString(",\n          \"y\": ");
+  outLong(item->year);
+  outString(",\n          \"M\": ");
+  outLong(item->month);
+  outString(",\n          \"d\": ");
+  outLong(item->day);
+  outString(",\n          \"h\": ");
+  outLong(item->hour);
+  outString(",\n          \"m\": ");
+  outLong(item->minute);
+  outString(",\n          \"s\": ");
+  outLong(item->second);
+  outString(",\n          \"abbrev\": \"");
+  outString(abbrevString(item->abbrevIndex));
+  outString("\",\n          \"type\": \"");
+  outBytes(&item->type, 1);
+  outString("\"\n");
+}
+
+static void printCollection(const TestCollection *collection) {
+  for (int i = 0; i < collection->numItems; i++) {
+    outString("        {\n");
+    printItem(&collection->items[i]);
+    outString((i < collection->numItems - 1) ? "        },\n" : "        }\n");
+  }
+}
+
+void printJsonHeader(
   int startYear,
   int untilYear,
   int epochYear,
@@ -134,10 +403,6 @@ void printJson(
   const char *tzVersion) {
 
   const char indent0[] = "  ";
-  const char indent1[] = "    ";
-  const char indent2[] = "      ";
-  const char indent3[] = "        ";
-  const char indent4[] = "          ";
 
   printf("{\n");
   printf("%s\"start_year\": %d,\n", indent0, startYear);
@@ -153,40 +418,62 @@ void printJson(
   // results are exact over the year intervals used by the corresponding zonedb*
   // databases.
   printf("%s\"offset_granularity\": 1,\n", indent0);
-  printf("%s\"test_data\": {\n", indent0);
-
-  // Print each zone
-  int num_zones = testData->num_entries;
-  for (int z = 0; z < num_zones; z++) {
-    const TestEntry *entry = &testData->entries[z];
-    const char *zone_name = entry->zone_name;
-    printf("%s\"%s\": {\n", indent1, zone_name);
-
-    // Print transitions
-    printf("%s\"%s\": [\n", indent2, "transitions");
-    const TestCollection *collection = &entry->transitions;
-    for (int i = 0; i < collection->numItems; i++) {
-      const TestItem *item = &collection->items[i];
-      printf("%s{\n", indent3);
-      printItem(indent4, item);
-      printf("%s}%s\n", indent3, (i < collection->numItems - 1) ? "," : "");
-    }
-    printf("%s],\n", indent2);
-
-    // Print samples
-    printf("%s\"%s\": [\n", indent2, "samples");
-    collection = &entry->samples;
-    for (int i = 0; i < collection->numItems; i++) {
-      const TestItem *item = &collection->items[i];
-      printf("%s{\n", indent3);
-      printItem(indent4, item);
-      printf("%s}%s\n", indent3, (i < collection->numItems - 1) ? "," : "");
-    }
-    printf("%s]\n", indent2);
+  printf("%s\"test_data\": {", indent0);
+}
 
-    printf("%s}%s\n", indent1, (z < testData->num_entries - 1) ? "," : "");
-  }
+void printJsonEntry(const TestEntry *entry, bool first) {
+  // The separator of the previous entry is written here, because the caller
+  // does not know if an entry is the last one until the zones are exhausted.
+  outString(first ? "\n    \"" : ",\n    \"");
+  outString(entry->zone_name);
+  outString("\": {\n");
+
+  outString("      \"transitions\": [\n");
+  printCollection(&entry->transitions);
+  outString("      ],\n");
+
+  outString("      \"samples\": [\n");
+  printCollection(&entry->samples);
+  outString("      ]\n");
 
-  printf("%s}\n", indent0);
+  outString("    }");
+
+  // Hand the entry to the consumer of the STDOUT as soon as it is complete.
+  outFlush();
+  fflush(stdout);
+}
+
+void printJsonFooter() {
+  printf("\n  }\n");
   printf("}\n");
 }
+
+//-----------------------------------------------------------------------------
+
+static void toBinItem(BinItem *binItem, const TestItem *item) {
+  binItem->epochSeconds = item->epochSeconds;
+  binItem->totalOffset = item->utcOffset;
+  binItem->dstOffset = item->dstOffset;
+  binItem->year = item->year;
+  binItem->month = item->month;
+  binItem->day = item->day;
+  binItem->hour = item->hour;
+  binItem->minute = item->minute;
+  binItem->second = item->second;
+  binItem->abbrev = abbrevString(item->abbrevIndex);
+  binItem->type = item->type;
+}
+
+int8_t writeBinEntry(BinWriter *writer, const TestEntry *entry) {
+  const TestCollection *transitions = &entry->transitions;
+  const TestCollection *samples = &entry->samples;
+  std::vector<BinItem> items(transitions->numItems + samples->numItems);
+  for (int i = 0; i < transitions->numItems; i++) {
+    toBinItem(&items[i], &transitions->items[i]);
+  }
+  for (int i = 0; i < samples->numItems; i++) {
+    toBinItem(&items[transitions->numItems + i], &samples->items[i]);
+  }
+  return writer->writeZone(entry->zone_name, items.data(),
+      transitions->numItems, samples->numItems);
+}
@@ -1,7 +1,10 @@
 #ifndef COMPARE_ACETIME_TEST_DATA_H
 #define COMPARE_ACETIME_TEST_DATA_H
 
+#include <atomic>
+#include <mutex>
 #include <AceTime.h> // kAbbrevSize
+#include "../binary_validation/binary_validation.h"
 
 /** Buffer size of the abbreviation. Must be synchronized with AceTime.h */
 #define MAX_ABBREV_SIZE  ace_time::internal::kAbbrevSize
@@ -31,34 +34,104 @@ struct DateTime {
 
 /**
  * A test item, containing the epochSeconds with its expected DateTime
- * components.
+ * components. The fields are packed into 24 bytes, and the abbreviation is
+ * stored as an index into the interned table of abbrevIntern(), which is
+ * expanded only when the item is printed.
  */
 struct TestItem {
-  long epochSeconds;
-  int utcOffset; // seconds
-  int dstOffset; // seconds
-  int year;
-  unsigned month;
-  unsigned day;
-  int hour;
-  int minute;
-  int second;
-  char abbrev[MAX_ABBREV_SIZE];
+  int64_t epochSeconds;
+  int32_t utcOffset; // seconds
+  int16_t dstOffset; // seconds
+  int16_t year;
+  uint16_t abbrevIndex; // index from abbrevIntern()
+  uint8_t month;
+  uint8_t day;
+  uint8_t hour;
+  uint8_t minute;
+  uint8_t second;
   char type; //'A', 'B', 'a', 'b', 'S'
 };
 
-/** A growable collection of test items. */
+static_assert(sizeof(TestItem) == 24, "TestItem must be 24 bytes");
+
+/** Maximum number of distinct abbreviations in the interned table. */
+#define MAX_ABBREVS 4096
+
+/**
+ * Return the index of the abbreviation in the global interned table, adding it
+ * if necessary. The abbreviation is truncated to MAX_ABBREV_SIZE - 1
+ * characters. Thread-safe. Exits the program if the table is full.
+ */
+uint16_t abbrevIntern(const char *abbrev);
+
+/**
+ * Return the abbreviation at the given index of the interned table. The index
+ * must have been returned by abbrevIntern().
+ */
+const char *abbrevString(uint16_t index);
+
+/** Counters of the memory allocations of the TestData. */
+struct AllocStats {
+  std::atomic<long> numMallocs; // arena blocks
+  std::atomic<long> numBytes; // bytes of the arena blocks
+  std::atomic<long> numReallocs; // resizes of collections on the heap
+  std::atomic<long> numArenaCopies; // resizes in an arena
+};
+
+extern AllocStats allocStats;
+
+/** Print the allocStats on the STDERR. */
+void printAllocStats();
+
+//-----------------------------------------------------------------------------
+
+struct ArenaBlock;
+
+/**
+ * A bump allocator which allocates from large blocks, and frees all of them at
+ * once in arenaClear(). Individual allocations are never freed. The
+ * allocations are serialized by a mutex, so that the worker threads can grow
+ * the collections of their entries concurrently.
+ */
+struct Arena {
+  ArenaBlock *blocks; // newest first
+  size_t blockSize; // minimum size of each block
+  std::mutex mutex;
+};
+
+/** Initialize the arena. No memory is allocated until arenaAlloc(). */
+void arenaInit(Arena *arena, size_t blockSize);
+
+/** Allocate 'size' bytes from the arena, aligned to 16 bytes. */
+void *arenaAlloc(Arena *arena, size_t size);
+
+/** Free all blocks of the arena. */
+void arenaClear(Arena *arena);
+
+//-----------------------------------------------------------------------------
+
+/**
+ * A growable collection of test items. The items are allocated in the 'arena'
+ * if it is not NULL, otherwise on the heap.
+ */
 struct TestCollection {
   int capacity;
   int numItems;
   TestItem *items;
+  Arena *arena;
 };
 
 //-----------------------------------------------------------------------------
 
-/** Initialize the given TestCollection. */
+/** Initialize the given TestCollection on the heap. */
 void testCollectionInit(TestCollection *collection);
 
+/** Initialize the given TestCollection in the arena, with 'capacity' items. */
+void testCollectionInitArena(
+    TestCollection *collection,
+    Arena *arena,
+    int capacity);
+
 /** Free the given TestCollection. */
 void testCollectionClear(TestCollection *collection);
 
@@ -85,17 +158,35 @@ struct TestEntry {
 
 //-----------------------------------------------------------------------------
 
-/** Array of test entries, for all zones. */
+/**
+ * Array of test entries, for all zones. The entries and their items are
+ * allocated in the arena, and are all freed by testDataClear().
+ */
 struct TestData {
   int capacity;
   int num_entries;
   TestEntry *entries;
+  Arena arena;
+  int numTransitions; // initial capacity of the transitions of each entry
+  int numSamples; // initial capacity of the samples of each entry
 };
 
 /** Initialize the given TestData. */
 void testDataInit(TestData *data);
 
-/** Clear the given TestData. */
+/**
+ * Initialize the given TestData for 'numEntries' zones over the years
+ * [startYear, untilYear). The collections of each entry are presized for 12
+ * samples and 4 transition items per year, and all of them are allocated in a
+ * single arena block, so that most zones need no further allocation.
+ */
+void testDataInitPresized(
+    TestData *data,
+    int numEntries,
+    int startYear,
+    int untilYear);
+
+/** Free all entries of the given TestData at once. */
 void testDataClear(TestData *data);
 
 /** Resize the array of entries. */
@@ -114,10 +205,11 @@ void testDataDeleteEntry(TestData *data);
 
 /**
  * Generate the JSON output on STDOUT which will be redirect into
- * 'validation_data.json' file. Adopted from GenerateData.java.
+ * 'validation_data.json' file. Adopted from GenerateData.java. The output is
+ * streamed one zone at a time: printJsonHeader(), then printJsonEntry() for
+ * each zone as soon as it is complete, then printJsonFooter().
  */
-void printJson(
-  const TestData *testData,
+void printJsonHeader(
   int startYear,
   int untilYear,
   int epochYear,
@@ -125,4 +217,19 @@ void printJson(
   const char *version, // library version
   const char *tzVersion); // TZDB version
 
+/**
+ * Print the given TestEntry, then flush the STDOUT. The 'first' flag must be
+ * true for the first entry, and false for the others.
+ */
+void printJsonEntry(const TestEntry *entry, bool first);
+
+/** Print the end of the JSON output. */
+void printJsonFooter();
+
+/**
+ * Write the given TestEntry using the BinWriter of the binary validation
+ * format. Returns non-zero on error.
+ */
+int8_t writeBinEntry(BinWriter *writer, const TestEntry *entry);
+
 #endif
@@ -0,0 +1,281 @@
+#include <stdio.h>
+#include <string.h> // strcmp()
+#include <vector>
+#include "verify.h"
+
+/** The baseline file. */
+static BinReader baseline;
+
+/** Set for each zone of the baseline passed to verifyZoneInit(). */
+static std::vector<bool> zonesSeen;
+
+static bool isSubset; // this run is not 'complete', see diff.py
+static bool checkAbbrev;
+static bool checkDst;
+static int verifyStartYear;
+static int verifyUntilYear;
+
+static int numZonesVerified;
+static int numZonesFailed;
+static int numZonesSkipped;
+
+int8_t verifyOpen(
+    const char *path,
+    int startYear,
+    int untilYear,
+    int epochYear,
+    const char *scope) {
+
+  if (binOpenFile(&baseline, path)) return 1;
+
+  const BinHeader& header = baseline.header();
+  isSubset = strcmp(scope, "complete") != 0;
+  checkAbbrev = header.hasValidAbbrev;
+  checkDst = header.hasValidDst;
+  verifyStartYear = startYear;
+  verifyUntilYear = untilYear;
+  zonesSeen.assign(baseline.numZones(), false);
+
+  if (strcmp(header.scope, "complete") != 0) {
+    fprintf(stderr, "Baseline '%s' must have scope 'complete'\n", path);
+    return 1;
+  }
+  if (header.epochYear != epochYear) {
+    fprintf(stderr, "Baseline '%s' has epoch_year %d\n",
+        path, header.epochYear);
+    return 1;
+  }
+  bool yearsValid = isSubset
+      ? (startYear >= header.startYear && untilYear <= header.untilYear)
+      : (startYear == header.startYear && untilYear == header.untilYear);
+  if (! yearsValid) {
+    fprintf(stderr, "Baseline '%s' has years [%d, %d)\n",
+        path, header.startYear, header.untilYear);
+    return 1;
+  }
+  return 0;
+}
+
+void verifyZoneInit(ZoneVerification *verification, const char *zoneName) {
+  *verification = ZoneVerification();
+  verification->zoneIndex = baseline.findZone(zoneName);
+  if (verification->zoneIndex < 0) {
+    printf("ERROR %s: not in baseline\n", zoneName);
+    verification->failed = true;
+  } else {
+    zonesSeen[verification->zoneIndex] = true;
+  }
+}
+
+//-----------------------------------------------------------------------------
+
+/** Print the mismatch of a single field, and fail the zone. */
+static bool fail(
+    ZoneVerification *verification,
+    const char *zoneName,
+    const char *label,
+    const char *field,
+    const VerifyCursor& cursor,
+    long long observed,
+    long long expected) {
+  printf("ERROR %s %s '%s': obs[%u] (%lld) != exp[%u] (%lld)\n",
+      zoneName, label, field, cursor.io, observed, cursor.ie, expected);
+  verification->failed = true;
+  return true;
+}
+
+static bool isSilent(char type) {
+  return type == 'a' || type == 'b';
+}
+
+/**
+ * Compare the observed items of 'collection' from the 'cursor' against the
+ * expected items [begin, end) of the baseline 'zone'. Returns true on the first
+ * mismatch.
+ */
+static bool verifyItems(
+    ZoneVerification *verification,
+    const char *zoneName,
+    const char *label,
+    VerifyCursor& cursor,
+    const TestCollection& collection,
+    const BinZone& zone,
+    uint32_t begin,
+    uint32_t end) {
+
+  const uint32_t numObserved = collection.numItems;
+  if (numObserved == 0) return false;
+
+  // Synchronize the year if the observed is a subset of the expected.
+  if (! cursor.synced) {
+    cursor.synced = true;
+    if (isSubset) {
+      int year = collection.items[0].year;
+      while (cursor.ie < end - begin
+          && binYear(zone.dateTimes[begin + cursor.ie]) < year) {
+        cursor.ie++;
+      }
+    }
+  }
+
+  while (cursor.io < numObserved && cursor.ie < end - begin) {
+    const TestItem& obs = collection.items[cursor.io];
+    const uint32_t e = begin + cursor.ie;
+
+    // Skip silent transitions if not supported by the baseline.
+    if (! checkDst) {
+      if (isSilent(zone.types[e])) {
+        cursor.ie++;
+        continue;
+      }
+      if (isSilent(obs.type)) {
+        cursor.io++;
+        continue;
+      }
+    }
+
+    // The offset_granularity of AceTime is 1 second, so the total offsets are
+    // compared without truncation.
+    int64_t dt = zone.dateTimes[e];
+    if (obs.epochSeconds != zone.epochSeconds[e]) {
+      return fail(verification, zoneName, label, "epoch", cursor,
+          obs.epochSeconds, zone.epochSeconds[e]);
+    }
+    if (obs.utcOffset != zone.totalOffsets[e]) {
+      return fail(verification, zoneName, label, "total", cursor,
+          obs.utcOffset, zone.totalOffsets[e]);
+    }
+    if (checkDst && obs.dstOffset != zone.dstOffsets[e]) {
+      return fail(verification, zoneName, label, "dst", cursor,
+          obs.dstOffset, zone.dstOffsets[e]);
+    }
+    if (obs.year != binYear(dt)) {
+      return fail(verification, zoneName, label, "y", cursor,
+          obs.year, binYear(dt));
+    }
+    if (obs.month != binMonth(dt)) {
+      return fail(verification, zoneName, label, "M", cursor,
+          obs.month, binMonth(dt));
+    }
+    if (obs.day != binDay(dt)) {
+      return fail(verification, zoneName, label, "d", cursor,
+          obs.day, binDay(dt));
+    }
+    if (obs.hour != binHour(dt)) {
+      return fail(verification, zoneName, label, "h", cursor,
+          obs.hour, binHour(dt));
+    }
+    if (obs.minute != binMinute(dt)) {
+      return fail(verification, zoneName, label, "m", cursor,
+          obs.minute, binMinute(dt));
+    }
+    if (obs.second != binSecond(dt)) {
+      return fail(verification, zoneName, label, "s", cursor,
+          obs.second, binSecond(dt));
+    }
+    const char *abbrev = abbrevString(obs.abbrevIndex);
+    const char *expectedAbbrev = baseline.string(zone.abbrevIndexes[e]);
+    if (checkAbbrev && strcmp(abbrev, expectedAbbrev) != 0) {
+      printf("ERROR %s %s 'abbrev': obs[%u] (%s) != exp[%u] (%s)\n",
+          zoneName, label, cursor.io, abbrev, cursor.ie, expectedAbbrev);
+      verification->failed = true;
+      return true;
+    }
+
+    cursor.io++;
+    cursor.ie++;
+  }
+  return false;
+}
+
+bool verifyZone(ZoneVerification *verification, const TestEntry *entry) {
+  if (verification->failed) return true;
+
+  BinZone zone = baseline.zone(verification->zoneIndex);
+  return verifyItems(verification, entry->zone_name, "transitions",
+          verification->transitions, entry->transitions, zone,
+          0, zone.numTransitions)
+      || verifyItems(verification, entry->zone_name, "samples",
+          verification->samples, entry->samples, zone,
+          zone.numTransitions, zone.numItems());
+}
+
+static bool isCounted(char type) {
+  return type == 'A' || type == 'B' || type == 'S' || type == 'T';
+}
+
+/**
+ * Check the number of observed items, ignoring the silent transitions,
+ * against the number of expected items in [startYear, untilYear).
+ */
+static bool verifyLength(
+    ZoneVerification *verification,
+    const char *zoneName,
+    const char *label,
+    const TestCollection& collection,
+    const BinZone& zone,
+    uint32_t begin,
+    uint32_t end) {
+
+  int numObserved = 0;
+  for (int i = 0; i < collection.numItems; i++) {
+    if (isCounted(collection.items[i].type)) numObserved++;
+  }
+  int numExpected = 0;
+  for (uint32_t e = begin; e < end; e++) {
+    int year = binYear(zone.dateTimes[e]);
+    if (isCounted(zone.types[e])
+        && year >= verifyStartYear && year < verifyUntilYear) {
+      numExpected++;
+    }
+  }
+
+  bool valid = isSubset
+      ? (numObserved <= numExpected)
+      : (numObserved == numExpected);
+  if (valid) return false;
+  printf("ERROR %s %s: len(observed) (%d) %s len(expected) (%d)\n",
+      zoneName, label, numObserved, isSubset ? ">" : "!=", numExpected);
+  verification->failed = true;
+  return true;
+}
+
+void verifyFinishZone(ZoneVerification *verification, const TestEntry *entry) {
+  numZonesVerified++;
+
+  // A zone without any items is not supported by this run, and is not an
+  // error, unless it is missing from the baseline.
+  if (! verification->failed
+      && entry->transitions.numItems == 0
+      && entry->samples.numItems == 0) {
+    numZonesSkipped++;
+    return;
+  }
+
+  if (! verifyZone(verification, entry)) {
+    BinZone zone = baseline.zone(verification->zoneIndex);
+    if (! verifyLength(verification, entry->zone_name, "transitions",
+        entry->transitions, zone, 0, zone.numTransitions)) {
+      verifyLength(verification, entry->zone_name, "samples",
+          entry->samples, zone, zone.numTransitions, zone.numItems());
+    }
+  }
+  if (verification->failed) numZonesFailed++;
+}
+
+int8_t verifyFinish(bool checkMissing) {
+  int numMissing = 0;
+  if (checkMissing && ! isSubset) {
+    for (uint32_t i = 0; i < baseline.numZones(); i++) {
+      if (zonesSeen[i]) continue;
+      printf("ERROR %s: missing compared to baseline\n",
+          baseline.zone(i).name);
+      numMissing++;
+    }
+  }
+
+  printf("Verified %d zones: %d failed, %d skipped, %d missing\n",
+      numZonesVerified, numZonesFailed, numZonesSkipped, numMissing);
+  baseline.close();
+  return (numZonesFailed > 0 || numMissing > 0) ? 1 : 0;
+}
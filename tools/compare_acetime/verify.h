@@ -0,0 +1,75 @@
+#ifndef COMPARE_ACETIME_VERIFY_H
+#define COMPARE_ACETIME_VERIFY_H
+
+#include <stdint.h>
+#include "test_data.h"
+
+/**
+ * Compare the generated TestItems of each zone against a baseline validation
+ * file, given by the '--verify baseline' flag, instead of writing the output,
+ * using the same rules as tools/diff_validation/diff.py. The baseline is the
+ * binary file written by '--format bin', or a validation_data.json file, which
+ * is converted into the binary format when it is opened. Only the mismatches
+ * and a summary line are printed on the STDOUT.
+ *
+ * The items of a zone are compared incrementally by verifyZone(), as they are
+ * appended to its TestEntry, so that the '--fail_fast' flag can stop the
+ * processing of a zone after its first mismatch.
+ *
+ * None of these functions are thread-safe. They are called only between
+ * windows, when no worker thread is running.
+ */
+
+/** Position of the comparison in the transitions or samples of a zone. */
+struct VerifyCursor {
+  uint32_t io; // index of the next observed item
+  uint32_t ie; // index of the next expected item
+  bool synced; // the expected items were synced to the first observed year
+};
+
+/** State of the verification of a single zone. */
+struct ZoneVerification {
+  int32_t zoneIndex; // in the baseline, -1 if not found
+  bool failed;
+  VerifyCursor transitions;
+  VerifyCursor samples;
+};
+
+/**
+ * Open the baseline file, and check its header against the given flags of
+ * this run. Returns 0 on success, and 1 after printing an error on the STDERR.
+ */
+int8_t verifyOpen(
+    const char *path,
+    int startYear,
+    int untilYear,
+    int epochYear,
+    const char *scope);
+
+/**
+ * Initialize the verification of the given zone. A zone which is not in the
+ * baseline fails immediately.
+ */
+void verifyZoneInit(ZoneVerification *verification, const char *zoneName);
+
+/**
+ * Compare the items appended to the 'entry' since the previous call against
+ * the baseline, and print the first mismatch of the zone. Returns true if the
+ * zone has failed.
+ */
+bool verifyZone(ZoneVerification *verification, const TestEntry *entry);
+
+/**
+ * Compare the remaining items of the completed 'entry', then check the number
+ * of its items against the baseline.
+ */
+void verifyFinishZone(ZoneVerification *verification, const TestEntry *entry);
+
+/**
+ * Print the summary on the STDOUT, after the zones of the baseline missing
+ * from this run if 'checkMissing' is true, and close the baseline. Returns 0
+ * if every zone matched, 1 otherwise.
+ */
+int8_t verifyFinish(bool checkMissing);
+
+#endif
@@ -9,6 +9,10 @@
  *    --until_year until
  *    --epoch_year year
  *    --zonedb (zonedb|zonedball)
+ *    [--shard index/count]
+ *    [--costs costs.txt]
+ *    [--costs_out costs.txt]
+ *    [--cache_dir dir]
  *    < zones.txt
  *    > validation_data.json
  */
@@ -17,22 +21,33 @@
 #include <stdlib.h> // exit(), qsort()
 #include <string.h> // strcmp(), strncmp()
 #include <stdio.h> // printf(), fprintf()
+#include <time.h> // clock_gettime()
 #include <acetimec.h>
 #include "test_data.h"
 #include "sampling.h"
+#include "shard.h"
+#include "result_cache.h"
+
+// Version of the items generated by sampling.c, added to the keys of the
+// result cache. Increment it whenever a change of the code changes the output.
+#define OUTPUT_VERSION 1
 
 // Command line arguments
 int16_t start_year = 2000;
 int16_t until_year = 2100;
 int16_t epoch_year = 2050;
 const char *zonedb = NULL; // "zonedb", "zonedball"
+Shard shard = {0, 1};
+const char *costs_file = NULL;
+const char *costs_out_file = NULL;
+const char *cache_dir = NULL;
 
 AtcZoneRegistrar registrar;
 
-/** Insert TestItems for the given 'zone_name' into test_data. */
+/** Insert TestItems for the given 'zone_name' into 'entry'. */
 int8_t process_zone(
     AtcZoneProcessor *processor,
-    TestData *test_data,
+    TestEntry *entry,
     int i,
     const char *zone_name)
 {
@@ -46,8 +61,6 @@ int8_t process_zone(
 
   AtcTimeZone tz = {zone_info, processor};
 
-  // Create entry for a single zone
-  TestEntry *entry = test_data_new_entry(test_data);
   strncpy(entry->zone_name, zone_name, ZONE_NAME_SIZE - 1);
   entry->zone_name[ZONE_NAME_SIZE - 1] = '\0';
 
@@ -76,12 +89,67 @@ int8_t process_zone(
 }
 
 /**
- * Read the list of zones from the 'zones.txt' in the stdin. Ignore blank lines
- * and comments (starting with '#'), and process each zone, one per line.
+ * Set the 'key' of the result cache of the given zone. The zone data is
+ * compiled into the zonedb of the library, which is generated from a single
+ * TZDB version by each release, so the library version, the TZDB version and
+ * the --zonedb identify the ZoneInfo of the zone. The OUTPUT_VERSION stands for
+ * this program itself.
+ */
+static void zone_result_key(ResultKey *key, const char *zone_name)
+{
+  result_key_init(key);
+  result_key_add_string(key, "acetimec");
+  result_key_add_int(key, OUTPUT_VERSION);
+  result_key_add_string(key, ACE_TIME_C_VERSION_STRING);
+  result_key_add_string(key, kAtcZoneContext.tz_version);
+  result_key_add_string(key, zonedb);
+  result_key_add_int(key, start_year);
+  result_key_add_int(key, until_year);
+  result_key_add_int(key, epoch_year);
+  result_key_add_string(key, zone_name);
+}
+
+/**
+ * Fill the given 'entry' of the zone from the --cache_dir if possible,
+ * otherwise process the zone, and store the result into the cache.
+ */
+static int8_t process_or_load_zone(
+    AtcZoneProcessor *processor,
+    TestEntry *entry,
+    int i,
+    const char *zone_name)
+{
+  if (cache_dir == NULL) return process_zone(processor, entry, i, zone_name);
+
+  ResultKey key;
+  zone_result_key(&key, zone_name);
+  if (result_cache_load(cache_dir, &key, zone_name, entry) == 0) {
+    fprintf(stderr, "[%d] Zone %s: cached\n", i, zone_name);
+    return kAtcErrOk;
+  }
+  int8_t err = process_zone(processor, entry, i, zone_name);
+  if (!err) result_cache_store(cache_dir, &key, entry);
+  return err;
+}
+
+/** Return the monotonic clock in seconds. */
+static double now_seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Read the list of zones from the 'zones.txt' in the stdin into a newly
+ * allocated array of strings. Ignore blank lines and comments (starting with
+ * '#'), and keep only the first word of each line.
  */
-int8_t process_zones(AtcZoneProcessor *processor, TestData *test_data) {
+char **read_zones(int *num_zones) {
+  int capacity = 16;
+  int n = 0;
+  char **zones = malloc(sizeof(char *) * capacity);
   char line[MAX_LINE_SIZE];
-  int i = 0;
   while (1) {
     // fgets() always NUL-terminates
     char *s = fgets(line, MAX_LINE_SIZE, stdin);
@@ -112,15 +180,69 @@ int8_t process_zones(AtcZoneProcessor *processor, TestData *test_data) {
     char* word = strtok_r(str, delim, &saveptr);
     if (word == NULL) continue;
 
-    int8_t err = process_zone(processor, test_data, i, line);
+    if (n >= capacity) {
+      capacity *= 2;
+      zones = realloc(zones, sizeof(char *) * capacity);
+    }
+    zones[n++] = strdup(word);
+  }
+
+  *num_zones = n;
+  return zones;
+}
+
+/**
+ * Process each zone on the stdin which belongs to the current shard, and print
+ * each zone on the stdout as soon as it is done, so that only a single zone is
+ * held in memory. If costs_out_file is given, write the elapsed seconds of each
+ * zone into it, to be used as the --costs file of the next run.
+ */
+int8_t process_zones(AtcZoneProcessor *processor) {
+  int num_zones = 0;
+  char **zones = read_zones(&num_zones);
+  bool *selected = malloc(sizeof(bool) * (num_zones + 1));
+  int8_t err = kAtcErrOk;
+  if (shard_select(&shard, costs_file, num_zones,
+      (const char * const *) zones, selected)) {
+    err = kAtcErrGeneric;
+  }
+
+  FILE *costs_out = NULL;
+  if (!err && costs_out_file != NULL) {
+    costs_out = fopen(costs_out_file, "w");
+    if (costs_out == NULL) {
+      fprintf(stderr, "Unable to open costs file '%s'\n", costs_out_file);
+      err = kAtcErrGeneric;
+    }
+  }
+
+  bool first = true;
+  for (int i = 0; !err && i < num_zones; i++) {
+    if (!selected[i]) continue;
+
+    double start = now_seconds();
+    TestData test_data;
+    test_data_init_presized(&test_data, 1, start_year, until_year);
+    TestEntry *entry = test_data_new_entry(&test_data);
+    err = process_or_load_zone(processor, entry, i, zones[i]);
     if (err) {
-      fprintf(stderr, "Error processor zone '%s'\n", line);
-      return err;
+      test_data_clear(&test_data);
+      fprintf(stderr, "Error processor zone '%s'\n", zones[i]);
+      break;
+    }
+    print_json_entry(entry, first);
+    first = false;
+    test_data_clear(&test_data);
+    if (costs_out != NULL) {
+      fprintf(costs_out, "%s %.6f\n", zones[i], now_seconds() - start);
     }
-    i++;
   }
 
-  return kAtcErrOk;
+  if (costs_out != NULL) fclose(costs_out);
+  for (int i = 0; i < num_zones; i++) free(zones[i]);
+  free(zones);
+  free(selected);
+  return err;
 }
 
 //-----------------------------------------------------------------------------
@@ -130,6 +252,8 @@ void usage_and_exit() {
     "Usage: compare_acetimec.out [--install_dir {dir}]\n"
     "   --start_year start --until_year until --epoch_year year\n"
     "   --zonedb (zonedb|zonedball)\n"
+    "   [--shard index/count] [--costs file] [--costs_out file]\n"
+    "   [--cache_dir dir]\n"
     "   < zones.txt\n");
   exit(1);
 }
@@ -169,6 +293,25 @@ int main(int argc, const char* const* argv) {
       SHIFT(argc, argv);
       if (argc == 0) usage_and_exit();
       db = argv[0];
+    } else if (argEquals(argv[0], "--shard")) {
+      SHIFT(argc, argv);
+      if (argc == 0) usage_and_exit();
+      if (shard_parse(&shard, argv[0])) {
+        fprintf(stderr, "Invalid --shard '%s'\n", argv[0]);
+        usage_and_exit();
+      }
+    } else if (argEquals(argv[0], "--costs")) {
+      SHIFT(argc, argv);
+      if (argc == 0) usage_and_exit();
+      costs_file = argv[0];
+    } else if (argEquals(argv[0], "--costs_out")) {
+      SHIFT(argc, argv);
+      if (argc == 0) usage_and_exit();
+      costs_out_file = argv[0];
+    } else if (argEquals(argv[0], "--cache_dir")) {
+      SHIFT(argc, argv);
+      if (argc == 0) usage_and_exit();
+      cache_dir = argv[0];
     } else if (argEquals(argv[0], "--")) {
       SHIFT(argc, argv);
       break;
@@ -222,21 +365,20 @@ int main(int argc, const char* const* argv) {
     usage_and_exit();
   }
 
+  if (cache_dir != NULL && result_cache_open(cache_dir)) exit(1);
+
   // Initialize an AtcZoneProcessor instance.
   AtcZoneProcessor processor;
   atc_processor_init(&processor);
 
-  // Process the zones on the STDIN.
-  TestData test_data;
-  test_data_init(&test_data);
-  int8_t err = process_zones(&processor, &test_data);
-  if (err) exit(1);
-
-  print_json(&test_data, start_year, until_year, epoch_year,
+  // Process the zones on the STDIN, printing each one as it completes.
+  print_json_header(start_year, until_year, epoch_year,
     ACE_TIME_C_VERSION_STRING, kAtcZoneContext.tz_version);
-
-  // Cleanup
-  test_data_clear(&test_data);
+  int8_t err = process_zones(&processor);
+  if (err) exit(1);
+  print_json_footer();
+  print_alloc_stats();
+  if (cache_dir != NULL) print_result_cache_stats();
 
   return 0;
 }
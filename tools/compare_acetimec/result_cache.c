@@ -0,0 +1,199 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h> // memcmp(), strncmp(), strlen()
+#include <sys/stat.h> // mkdir()
+#include <unistd.h> // getpid()
+#include "result_cache.h"
+
+/** Identifies a result cache file, and the version of its layout. */
+#define RESULT_CACHE_MAGIC "AVRC0001"
+#define RESULT_CACHE_MAGIC_SIZE 8
+
+/** Longest path of a file in the cache directory. */
+#define MAX_PATH_SIZE 1024
+
+ResultCacheStats result_cache_stats;
+
+void print_result_cache_stats(void)
+{
+  fprintf(stderr, "Result cache: %ld hits, %ld misses\n",
+      result_cache_stats.num_hits, result_cache_stats.num_misses);
+}
+
+int result_cache_open(const char *cache_dir)
+{
+  if (mkdir(cache_dir, 0777) != 0 && errno != EEXIST) {
+    fprintf(stderr, "Unable to create cache directory '%s'\n", cache_dir);
+    return 1;
+  }
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+void result_key_init(ResultKey *key)
+{
+  key->hash = 14695981039346656037ull;
+}
+
+void result_key_add(ResultKey *key, const void *data, size_t n)
+{
+  const uint8_t *p = data;
+  uint64_t hash = key->hash;
+  for (size_t i = 0; i < n; i++) {
+    hash = (hash ^ p[i]) * 1099511628211ull;
+  }
+  key->hash = hash;
+}
+
+void result_key_add_string(ResultKey *key, const char *s)
+{
+  result_key_add(key, s, strlen(s) + 1);
+}
+
+void result_key_add_int(ResultKey *key, long value)
+{
+  char buf[24];
+  snprintf(buf, sizeof(buf), "%ld", value);
+  result_key_add_string(key, buf);
+}
+
+int result_key_add_file(ResultKey *key, const char *path)
+{
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) return 1;
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+    result_key_add(key, buf, n);
+  }
+  int err = ferror(f) ? 1 : 0;
+  fclose(f);
+  return err;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * Fixed header of a cache file. It is followed by the transitions then the
+ * samples, each one a TestItem followed by its abbreviation, because the
+ * abbrev_index is valid only in the process which interned it.
+ */
+typedef struct ResultHeader {
+  char magic[RESULT_CACHE_MAGIC_SIZE];
+  char zone_name[ZONE_NAME_SIZE];
+  int32_t num_transitions;
+  int32_t num_samples;
+} ResultHeader;
+
+static void result_cache_path(
+    char *path,
+    const char *cache_dir,
+    const ResultKey *key)
+{
+  snprintf(path, MAX_PATH_SIZE, "%s/%016llx.entry",
+      cache_dir, (unsigned long long) key->hash);
+}
+
+static int read_collection(
+    FILE *f,
+    TestCollection *collection,
+    int num_items)
+{
+  for (int i = 0; i < num_items; i++) {
+    TestItem *item = test_collection_new_item(collection);
+    char abbrev[kAtcAbbrevSize];
+    if (fread(item, sizeof(*item), 1, f) != 1) return 1;
+    if (fread(abbrev, sizeof(abbrev), 1, f) != 1) return 1;
+    abbrev[kAtcAbbrevSize - 1] = '\0';
+    item->abbrev_index = abbrev_intern(abbrev);
+  }
+  return 0;
+}
+
+static int write_collection(FILE *f, const TestCollection *collection)
+{
+  for (int i = 0; i < collection->num_items; i++) {
+    const TestItem *item = &collection->items[i];
+    char abbrev[kAtcAbbrevSize] = {0};
+    strncpy(abbrev, abbrev_string(item->abbrev_index), kAtcAbbrevSize - 1);
+    if (fwrite(item, sizeof(*item), 1, f) != 1) return 1;
+    if (fwrite(abbrev, sizeof(abbrev), 1, f) != 1) return 1;
+  }
+  return 0;
+}
+
+int result_cache_load(
+    const char *cache_dir,
+    const ResultKey *key,
+    const char *zone_name,
+    TestEntry *entry)
+{
+  char path[MAX_PATH_SIZE];
+  result_cache_path(path, cache_dir, key);
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) {
+    result_cache_stats.num_misses++;
+    return 1;
+  }
+
+  ResultHeader header;
+  int err = fread(&header, sizeof(header), 1, f) != 1
+      || memcmp(header.magic, RESULT_CACHE_MAGIC, sizeof(header.magic)) != 0
+      || strncmp(header.zone_name, zone_name, ZONE_NAME_SIZE) != 0
+      || header.num_transitions < 0
+      || header.num_samples < 0;
+  if (!err) {
+    err = read_collection(f, &entry->transitions, header.num_transitions)
+        || read_collection(f, &entry->samples, header.num_samples)
+        || fgetc(f) != EOF;
+  }
+  fclose(f);
+
+  if (err) {
+    // Discard the partial items of a truncated or foreign file.
+    entry->transitions.num_items = 0;
+    entry->samples.num_items = 0;
+    result_cache_stats.num_misses++;
+    return 1;
+  }
+  memcpy(entry->zone_name, header.zone_name, ZONE_NAME_SIZE);
+  entry->zone_name[ZONE_NAME_SIZE - 1] = '\0';
+  result_cache_stats.num_hits++;
+  return 0;
+}
+
+int result_cache_store(
+    const char *cache_dir,
+    const ResultKey *key,
+    const TestEntry *entry)
+{
+  char path[MAX_PATH_SIZE];
+  char tmp_path[MAX_PATH_SIZE + 32];
+  result_cache_path(path, cache_dir, key);
+  snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, (int) getpid());
+
+  FILE *f = fopen(tmp_path, "wb");
+  if (f == NULL) {
+    fprintf(stderr, "Unable to open cache file '%s'\n", tmp_path);
+    return 1;
+  }
+
+  ResultHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, RESULT_CACHE_MAGIC, sizeof(header.magic));
+  memcpy(header.zone_name, entry->zone_name, ZONE_NAME_SIZE);
+  header.num_transitions = entry->transitions.num_items;
+  header.num_samples = entry->samples.num_items;
+
+  int err = fwrite(&header, sizeof(header), 1, f) != 1
+      || write_collection(f, &entry->transitions)
+      || write_collection(f, &entry->samples);
+  if (fclose(f) != 0) err = 1;
+  if (!err && rename(tmp_path, path) != 0) err = 1;
+  if (err) {
+    fprintf(stderr, "Unable to write cache file '%s'\n", path);
+    remove(tmp_path);
+  }
+  return err;
+}
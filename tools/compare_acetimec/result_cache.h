@@ -0,0 +1,76 @@
+#ifndef COMPARE_ACETIMEC_RESULT_CACHE_H
+#define COMPARE_ACETIMEC_RESULT_CACHE_H
+
+#include <stddef.h> // size_t
+#include <stdint.h>
+#include "test_data.h"
+
+/**
+ * A directory of the TestEntry of each zone from previous runs, given by the
+ * '--cache_dir dir' flag, so that a rerun recomputes only the zones whose
+ * inputs have changed, and an interrupted run resumes where it stopped. Each
+ * zone is stored in its own file, named by a ResultKey which hashes everything
+ * that determines the TestEntry: the zone name, the zone data, the flags, and
+ * the library version.
+ */
+typedef struct ResultKey {
+  uint64_t hash; // 64-bit FNV-1a
+} ResultKey;
+
+/** Counters of the result cache, printed by print_result_cache_stats(). */
+typedef struct ResultCacheStats {
+  long num_hits;
+  long num_misses;
+} ResultCacheStats;
+
+extern ResultCacheStats result_cache_stats;
+
+/** Print the result_cache_stats on the STDERR. */
+void print_result_cache_stats(void);
+
+/**
+ * Create the 'cache_dir' if it does not exist. Returns 0 on success, 1 on
+ * failure.
+ */
+int result_cache_open(const char *cache_dir);
+
+/** Initialize the given key to the hash of no data. */
+void result_key_init(ResultKey *key);
+
+/** Add the 'n' bytes of 'data' to the key. */
+void result_key_add(ResultKey *key, const void *data, size_t n);
+
+/** Add the string 's', including its terminating NUL, to the key. */
+void result_key_add_string(ResultKey *key, const char *s);
+
+/** Add the decimal value of 'value' to the key. */
+void result_key_add_int(ResultKey *key, long value);
+
+/**
+ * Add the contents of the file at 'path' to the key. Returns 0 on success, 1
+ * if the file cannot be read.
+ */
+int result_key_add_file(ResultKey *key, const char *path);
+
+/**
+ * Append the items stored under 'key' in 'cache_dir' to the given empty
+ * 'entry', and set its zone name. Returns 0 on a hit, 1 if there is no valid
+ * file for the key, or if it was written for a different 'zone_name'.
+ */
+int result_cache_load(
+    const char *cache_dir,
+    const ResultKey *key,
+    const char *zone_name,
+    TestEntry *entry);
+
+/**
+ * Store the given 'entry' under 'key' in 'cache_dir'. The file is written
+ * under a temporary name, then renamed, so that an interrupted run never leaves
+ * a partial file behind. Returns 0 on success, 1 on failure.
+ */
+int result_cache_store(
+    const char *cache_dir,
+    const ResultKey *key,
+    const TestEntry *entry);
+
+#endif
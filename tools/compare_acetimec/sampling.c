@@ -1,5 +1,4 @@
 #include <stdint.h>
-#include <string.h> // strncpy()
 #include <stdio.h> // printf()
 #include <acetimec.h>
 #include "sampling.h"
@@ -31,8 +30,7 @@ static int8_t create_test_item_from_epoch_seconds(
   atc_zoned_extra_from_unix_seconds(&zet, unix_seconds, tz);
   if ((atc_zoned_date_time_is_error(&zdt))) return kAtcErrGeneric;
 
-  strncpy(ti->abbrev, zet.abbrev, kAtcAbbrevSize);
-  ti->abbrev[kAtcAbbrevSize - 1] = '\0';
+  ti->abbrev_index = abbrev_intern(zet.abbrev);
   ti->dst_offset = zet.dst_offset_seconds;
   ti->utc_offset = zet.std_offset_seconds + zet.dst_offset_seconds;
 
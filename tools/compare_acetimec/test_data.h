@@ -1,6 +1,9 @@
 #ifndef COMPARE_ACETIMEC_TEST_DATA_H
 #define COMPARE_ACETIMEC_TEST_DATA_H
 
+#include <stdbool.h>
+#include <stddef.h> // size_t
+#include <stdint.h>
 #include <acetimec.h> // kAtcAbbrevSize
 
 /** Buffer size of each line from zones.txt file. */
@@ -24,34 +27,96 @@ typedef struct DateTime {
 
 /**
  * A test item, containing the epoch_seconds with its expected DateTime
- * components.
+ * components. The fields are packed into 24 bytes, and the abbreviation is
+ * stored as an index into the interned table of abbrev_intern(), which is
+ * expanded only when the item is printed.
  */
 typedef struct TestItem {
-  long epoch_seconds;
-  int utc_offset; // seconds
-  int dst_offset; // seconds
-  int year;
-  unsigned month;
-  unsigned day;
-  int hour;
-  int minute;
-  int second;
-  char abbrev[kAtcAbbrevSize];
+  int64_t epoch_seconds;
+  int32_t utc_offset; // seconds
+  int16_t dst_offset; // seconds
+  int16_t year;
+  uint16_t abbrev_index; // index from abbrev_intern()
+  uint8_t month;
+  uint8_t day;
+  uint8_t hour;
+  uint8_t minute;
+  uint8_t second;
   char type; //'A', 'B', 'a', 'b', 'S'
 } TestItem;
 
-/** A growable collection of test items. */
+/** Maximum number of distinct abbreviations in the interned table. */
+#define MAX_ABBREVS 4096
+
+/**
+ * Return the index of the abbreviation in the global interned table, adding it
+ * if necessary. The abbreviation is truncated to kAtcAbbrevSize - 1
+ * characters. Exits the program if the table is full.
+ */
+uint16_t abbrev_intern(const char *abbrev);
+
+/** Return the abbreviation at the given index of the interned table. */
+const char *abbrev_string(uint16_t index);
+
+/** Counters of the memory allocations of the TestData. */
+typedef struct AllocStats {
+  long num_mallocs; // arena blocks
+  long num_bytes; // bytes of the arena blocks
+  long num_reallocs; // resizes of collections on the heap
+  long num_arena_copies; // resizes of collections or entries in an arena
+} AllocStats;
+
+extern AllocStats alloc_stats;
+
+/** Print the alloc_stats on the STDERR. */
+void print_alloc_stats(void);
+
+//-----------------------------------------------------------------------------
+
+typedef struct ArenaBlock ArenaBlock;
+
+/**
+ * A bump allocator which allocates from large blocks, and frees all of them at
+ * once in arena_clear(). Individual allocations are never freed.
+ */
+typedef struct Arena {
+  ArenaBlock *blocks; // newest first
+  size_t block_size; // minimum size of each block
+} Arena;
+
+/** Initialize the arena. No memory is allocated until arena_alloc(). */
+void arena_init(Arena *arena, size_t block_size);
+
+/** Allocate 'size' bytes from the arena, aligned to 16 bytes. */
+void *arena_alloc(Arena *arena, size_t size);
+
+/** Free all blocks of the arena. */
+void arena_clear(Arena *arena);
+
+//-----------------------------------------------------------------------------
+
+/**
+ * A growable collection of test items. The items are allocated in the 'arena'
+ * if it is not NULL, otherwise on the heap.
+ */
 typedef struct TestCollection {
   int capacity;
   int num_items;
   TestItem *items;
+  Arena *arena;
 } TestCollection;
 
 //-----------------------------------------------------------------------------
 
-/** Initialize the given TestCollection. */
+/** Initialize the given TestCollection on the heap. */
 void test_collection_init(TestCollection *collection);
 
+/** Initialize the given TestCollection in the arena, with 'capacity' items. */
+void test_collection_init_arena(
+    TestCollection *collection,
+    Arena *arena,
+    int capacity);
+
 /** Free the given TestCollection. */
 void test_collection_clear(TestCollection *collection);
 
@@ -76,19 +141,43 @@ typedef struct TestEntry {
   TestCollection samples;
 } TestEntry;
 
+/** Initialize the given TestEntry for a zone. */
+void test_data_entry_init(TestEntry *entry);
+
+/** Clear the given TestEntry for a zone. */
+void test_data_entry_clear(TestEntry *entry);
+
 //-----------------------------------------------------------------------------
 
-/** Array of test entries, for all zones. */
+/**
+ * Array of test entries, for all zones. The entries and their items are
+ * allocated in the arena, and are all freed by test_data_clear().
+ */
 typedef struct TestData {
   int capacity;
   int num_entries;
   TestEntry *entries;
+  Arena arena;
+  int num_transitions; // initial capacity of the transitions of each entry
+  int num_samples; // initial capacity of the samples of each entry
 } TestData;
 
 /** Initialize the given TestData. */
 void test_data_init(TestData *data);
 
-/** Clear the given TestData. */
+/**
+ * Initialize the given TestData for 'num_entries' zones over the years
+ * [start_year, until_year). The collections of each entry are presized for 12
+ * samples and 4 transition items per year, and all of them are allocated in a
+ * single arena block, so that most zones need no further allocation.
+ */
+void test_data_init_presized(
+    TestData *data,
+    int num_entries,
+    int start_year,
+    int until_year);
+
+/** Free all entries of the given TestData at once. */
 void test_data_clear(TestData *data);
 
 /** Resize the array of entries. */
@@ -111,14 +200,24 @@ void test_data_delete_entry(TestData *data);
 
 /**
  * Generate the JSON output on STDOUT which will be redirect into
- * 'validation_data.json' file. Adopted from GenerateData.java.
+ * 'validation_data.json' file. Adopted from GenerateData.java. The output is
+ * streamed one zone at a time: print_json_header(), then print_json_entry()
+ * for each zone as soon as it is complete, then print_json_footer().
  */
-void print_json(
-  const TestData *test_data,
+void print_json_header(
   int start_year,
   int until_year,
   int epoch_year,
   const char *version, // library version
   const char *tz_version); // TZDB version
 
+/**
+ * Print the given TestEntry, then flush the STDOUT. The 'first' flag must be
+ * true for the first entry, and false for the others.
+ */
+void print_json_entry(const TestEntry *entry, bool first);
+
+/** Print the end of the JSON output. */
+void print_json_footer(void);
+
 #endif
@@ -4,6 +4,10 @@
  * and tz.h library. The Hinnant date library requires the --tz_version flag
  * even though we don't need it here.
  *
+ * The --snapshot_out flag writes the sys_info intervals of the zones into a
+ * snapshot file, instead of the validation data, which the --snapshot flag of
+ * later runs loads instead of parsing the TZDB.
+ *
  * Usage:
  * $ ./generate_data.out
  *    [--install_dir {dir}]
@@ -11,16 +15,36 @@
  *    --start_year start
  *    --until_year until
  *    --epoch_year year
+ *    [--jobs num]
+ *    [--shard index/count]
+ *    [--costs costs.txt]
+ *    [--costs_out costs.txt]
+ *    [--cache_dir dir]
+ *    [--stats stats.json]
+ *    [--snapshot snapshot.bin | --snapshot_out snapshot.bin]
  *    < zones.txt
  *    > validation_data.json
  */
 
 #include <iostream> // getline()
+#include <fstream> // ifstream
 #include <map> // map<>
+#include <unordered_map> // unordered_map<>
+#include <unordered_set> // unordered_set<>
 #include <vector> // vector<>
 #include <algorithm> // sort()
+#include <sstream> // ostringstream
+#include <atomic>
+#include <mutex>
+#include <new> // bad_alloc
+#include <thread>
+#include <errno.h>
 #include <string.h> // strcmp(), strncmp()
 #include <stdio.h> // printf(), fprintf()
+#include <fcntl.h> // open()
+#include <sys/mman.h> // mmap(), munmap()
+#include <sys/stat.h> // mkdir(), fstat()
+#include <unistd.h> // getpid(), close()
 #include <chrono>
 #include <date/date.h>
 #include <date/tz.h> // time_zone
@@ -41,19 +65,20 @@ struct DateTime {
 
 /**
  * A test item, containing the epochSeconds with its expected DateTime
- * components.
+ * components. The abbreviation is an index into the table of abbrevIntern(),
+ * so that the items hold no strings.
  */
 struct TestItem {
   long epochSeconds;
   int utcOffset; // seconds
   int dstOffset; // seconds
-  string abbrev;
   int year;
   unsigned month;
   unsigned day;
   int hour;
   int minute;
   int second;
+  uint16_t abbrevIndex; // index from abbrevIntern()
   char type; //'A', 'B', 'a', 'b', 'S'
 };
 
@@ -62,11 +87,17 @@ typedef vector<TestItem> TestCollection;
 
 /** Test data for a single zone. */
 struct TestEntry {
+  string zoneName;
   TestCollection transitions;
   TestCollection samples;
 };
 
-typedef map<string, TestEntry> TestData;
+/**
+ * Test data of all zones. The entries are appended in the order that the zones
+ * are processed, then sorted by zone name once, by sortTestData(), before they
+ * are printed.
+ */
+typedef vector<TestEntry> TestData;
 
 /**
  * Difference between Unix epoch (1970-01-01) and AceTime epoch (2000-01-01).
@@ -77,6 +108,107 @@ long secondsToAceTimeEpochFromUnixEpoch = 946684800;
 int startYear = 2000;
 int untilYear = 2100;
 int epochYear = 2050;
+int numJobs = 1;
+int shardIndex = 0;
+int shardCount = 1; // 1 means no sharding
+string costsFile;
+string costsOutFile;
+string cacheDir;
+string statsFile;
+string snapshotFile;
+string snapshotOutFile;
+
+/**
+ * Version of the TZDB, from get_tzdb() or the --snapshot file, so that the
+ * tzdb is not loaded by get_tzdb() when the snapshot is used.
+ */
+string tzdbVersion;
+
+/** Version of Hinnant Date library. */
+const char kHinnantDateVersion[] = "3.0.0";
+
+/**
+ * Version of the items generated by this program, hashed into the cache keys.
+ * Increment it whenever a change of the code changes the output.
+ */
+const int kOutputVersion = 1;
+
+//-----------------------------------------------------------------------------
+
+/**
+ * Counters of all heap allocations through operator new, for the --stats
+ * file. Most of them are the std::string of the sys_info returned by each
+ * lookup of the Hinnant date library. They are counted only if
+ * countAllocations is set by --stats before any thread is started, and only
+ * with relaxed increments, so that the --jobs threads do not contend on them
+ * otherwise.
+ */
+bool countAllocations = false;
+atomic<long> numAllocations(0);
+atomic<long> numAllocatedBytes(0);
+
+void* operator new(size_t size) {
+  if (countAllocations) {
+    numAllocations.fetch_add(1, memory_order_relaxed);
+    numAllocatedBytes.fetch_add(size, memory_order_relaxed);
+  }
+  void* p = malloc(size ? size : 1);
+  if (p == nullptr) throw bad_alloc();
+  return p;
+}
+
+// Not inlined, so that GCC does not warn about free() on a pointer which it
+// sees was returned by operator new.
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+  free(p);
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * Table of the distinct abbreviations, shared by all threads, and the index of
+ * each one. Each thread also keeps its own copy of the index, so that the
+ * mutex is taken only for an abbreviation which is new to the thread.
+ */
+mutex abbrevMutex;
+vector<string> abbrevs;
+unordered_map<string, uint16_t> abbrevIndexes;
+thread_local unordered_map<string, uint16_t> threadAbbrevIndexes;
+
+/** Return the index of the abbreviation, adding it to the table if needed. */
+uint16_t abbrevIntern(const string& abbrev) {
+  auto it = threadAbbrevIndexes.find(abbrev);
+  if (it != threadAbbrevIndexes.end()) return it->second;
+
+  uint16_t index;
+  {
+    lock_guard<mutex> lock(abbrevMutex);
+    auto global = abbrevIndexes.find(abbrev);
+    if (global != abbrevIndexes.end()) {
+      index = global->second;
+    } else {
+      if (abbrevs.size() > UINT16_MAX) {
+        fprintf(stderr, "Too many abbreviations\n");
+        exit(1);
+      }
+      index = abbrevs.size();
+      abbrevs.push_back(abbrev);
+      abbrevIndexes.emplace(abbrev, index);
+    }
+  }
+  threadAbbrevIndexes.emplace(abbrev, index);
+  return index;
+}
+
+/**
+ * Return a copy of the abbreviation at the given index of the table, since
+ * another thread may grow the table. The abbreviations are short enough to
+ * not allocate.
+ */
+string abbrevString(uint16_t index) {
+  lock_guard<mutex> lock(abbrevMutex);
+  return abbrevs[index];
+}
 
 /**
  * Convert a zoned_time<> (which is an aggregation of time_zone and sys_time<>,
@@ -101,9 +233,9 @@ DateTime toDateTime(local_time<seconds> lt) {
 }
 
 /**
- * Convert the Unix epoch seconds into a ZonedDateTime, then convert that into
- * TestItem that has the Date/Time components broken out, along with the
- * expected DST offset and abbreviation.
+ * The fields of a sys_info which are used by the TestItems, with the
+ * abbreviation interned by abbrevIntern(), so that it holds no string, and can
+ * be read from the --snapshot file.
  *
  * According to https://github.com/HowardHinnant/date/wiki/Examples-and-Recipes
  * sys_info has the following structure:
@@ -117,11 +249,24 @@ DateTime toDateTime(local_time<seconds> lt) {
  *     std::string          abbrev;
  * };
  */
-TestItem toTestItem(const time_zone& tz, sys_seconds st, char type) {
-  sys_info info = tz.get_info(st);
+struct ZoneInterval {
+  sys_seconds begin;
+  sys_seconds end;
+  seconds offset;
+  minutes save;
+  uint16_t abbrevIndex; // index from abbrevIntern()
+};
+
+/**
+ * Convert the Unix epoch seconds into a ZonedDateTime, then convert that into
+ * TestItem that has the Date/Time components broken out, along with the
+ * expected DST offset and abbreviation, given the interval of 'st'. The local
+ * time is 'st' plus the UTC offset of the 'info', which is what zoned_time
+ * calculates, without another lookup of the sys_info.
+ */
+TestItem toTestItem(const ZoneInterval& info, sys_seconds st, char type) {
   seconds unixSeconds = floor<seconds>(st.time_since_epoch());
-  zoned_time<seconds> zdt = make_zoned(&tz, st);
-  local_time<seconds> lt = zdt.get_local_time();
+  local_time<seconds> lt{st.time_since_epoch() + info.offset};
   DateTime dateTime = toDateTime(lt);
   long epochSeconds = (long) unixSeconds.count()
       - secondsToAceTimeEpochFromUnixEpoch;
@@ -129,31 +274,55 @@ TestItem toTestItem(const time_zone& tz, sys_seconds st, char type) {
       epochSeconds,
       (int)info.offset.count(),
       (int)info.save.count() * 60,
-      info.abbrev,
       dateTime.year,
       dateTime.month,
       dateTime.day,
       dateTime.hour,
       dateTime.minute,
       dateTime.second,
+      info.abbrevIndex,
       type
   };
 }
 
-void addTestItem(TestCollection& testData, const string& zoneName,
-    const TestItem& item) {
+/**
+ * The consecutive sys_info intervals of a zone, from the one containing the
+ * second before startYear, to the one containing the second before untilYear.
+ * The 'end' of each interval is the 'begin' of the next.
+ */
+typedef vector<ZoneInterval> ZoneIntervals;
+
+/**
+ * Walk the sys_info intervals of the zone once, following 'info.end', so that
+ * the transitions and the samples are resolved from the same list without
+ * searching the transitions of the zone again.
+ */
+void addIntervals(ZoneIntervals& intervals, const time_zone& tz,
+    int startYear, int untilYear) {
+  sys_seconds curr = sys_days{January/1/startYear} + seconds(0);
+  sys_seconds end = sys_days{January/1/untilYear} + seconds(0);
+
+  sys_info info = tz.get_info(curr - seconds(1));
+  intervals.push_back(ZoneInterval{info.begin, info.end, info.offset,
+      info.save, abbrevIntern(info.abbrev)});
+  while (curr < end) {
+    info = tz.get_info(curr);
+    curr = info.end;
+    if (info.begin != intervals.back().begin) {
+      intervals.push_back(ZoneInterval{info.begin, info.end, info.offset,
+          info.save, abbrevIntern(info.abbrev)});
+    }
+  }
 }
 
 /**
- * Check if (a, b) defines a transition. The return values are:
+ * Check if the sys_info (a_info, b_info) of 2 adjacent seconds defines a
+ * transition. The return values are:
  * * 0 - no transition
  * * 1 - normal transition
  * * 2 - silent transition (STD and DST canceled each other out)
  */
-int isTransition(sys_seconds a, sys_seconds b, const time_zone& tz) {
-    sys_info a_info = tz.get_info(a);
-    sys_info b_info = tz.get_info(b);
-
+int isTransition(const ZoneInterval& a_info, const ZoneInterval& b_info) {
     int a_total_offset = a_info.offset.count();
     int b_total_offset = b_info.offset.count();
 
@@ -171,33 +340,30 @@ int isTransition(sys_seconds a, sys_seconds b, const time_zone& tz) {
 
 /**
  * Add a TestItem for one second before a DST transition, and right at the
- * the DST transition.
+ * the DST transition, which is the boundary between 2 adjacent intervals.
  */
-void addTransitions(TestCollection& collection, const time_zone& tz,
-    int startYear, int untilYear) {
-  sys_seconds curr = sys_days{January/1/startYear} + seconds(0);
-  sys_seconds end = sys_days{January/1/untilYear} + seconds(0);
+void addTransitions(TestCollection& collection,
+    const ZoneIntervals& intervals) {
+  for (size_t i = 1; i < intervals.size(); i++) {
+    const ZoneInterval& beforeInfo = intervals[i - 1];
+    const ZoneInterval& info = intervals[i];
+    sys_seconds curr = info.begin;
 
-  while (curr < end) {
     // One second before the DST transition.
     sys_seconds before = curr - seconds(1);
 
     // Check that (before, curr) pair is a real transition instead of a phantom
     // artifact of the implementation details of the Hinnant date library.
-    int status = isTransition(before, curr, tz);
+    int status = isTransition(beforeInfo, info);
 
     if (status > 0) {
       // One second before transition.
-      auto item = toTestItem(tz, before, (status == 1) ? 'A' : 'a');
-      collection.push_back(item);
+      collection.push_back(
+          toTestItem(beforeInfo, before, (status == 1) ? 'A' : 'a'));
 
       // At transition.
-      item = toTestItem(tz, curr, (status == 1) ? 'B' : 'b');
-      collection.push_back(item);
+      collection.push_back(toTestItem(info, curr, (status == 1) ? 'B' : 'b'));
     }
-
-    sys_info info = tz.get_info(curr);
-    curr = info.end;
   }
 }
 
@@ -220,67 +386,658 @@ void addTransitions(TestCollection& collection, const time_zone& tz,
  * check.
  *
  * The original attempt on the 2nd is marked with a type 'S'. If the 2nd of the
- * month (with the time of 00:00) is in the gap, it does not exist, so the
- * Hinnant date library seems to throw an exception. Unfortunately, I cannot
- * understand the documentation enough to figure out how to do what I want, so
- * just punt and use the next day. Use a loop to try every subsequent day of
- * month up to the 28th (which exists in all months). A sample using the 3rd or
- * subsequent days are marked with a type of 'T'.
- */
-void addMonthlySamples(TestCollection& collection, const time_zone& tz,
-    int startYear, int untilYear) {
+ * month (with the time of 00:00) is in the gap, it does not exist, which
+ * time_zone::get_info() would report as local_info::nonexistent, so just punt
+ * and use the next day. Use a loop to try every subsequent day of month up to
+ * the 28th (which exists in all months). A sample using the 3rd or subsequent
+ * days are marked with a type of 'T'. If 00:00 occurs twice, the earlier one
+ * is used, as with choose::earliest.
+ */
+void addMonthlySamples(TestCollection& collection,
+    const ZoneIntervals& intervals, int startYear, int untilYear) {
 
+  // The samples are in increasing local time, so the interval of each one is
+  // found by advancing a cursor, instead of calling time_zone::get_info().
+  size_t i = 0;
   for (int y = startYear; y < untilYear; y++) {
     for (int m = 1; m <= 12; m++) {
       char type = 'S';
       for (int d = 2; d <= 28; d++) {
-        local_days ld = local_days{month(m)/d/year(y)};
-        try {
-          // Try to obtain sample at given local seconds.
-          zoned_time<seconds> zdt = make_zoned(&tz, ld + seconds(0));
-          sys_seconds ss = zdt.get_sys_time();
-          TestItem item = toTestItem(tz, ss, type);
-          collection.push_back(item);
-          break;
-        } catch (const ambiguous_local_time& e) {
-          // Choose the earlier one.
-          zoned_time<seconds> zdt = make_zoned(
-              &tz, ld + seconds(0), choose::earliest);
-          sys_seconds ss = zdt.get_sys_time();
-          TestItem item = toTestItem(tz, ss, type);
-          collection.push_back(item);
-          break;
-        } catch (const nonexistent_local_time& e) {
+        // Skip the intervals which end, in the local time, at or before the
+        // local midnight. The last interval ends after untilYear.
+        local_seconds ld = local_days{month(m)/d/year(y)} + seconds(0);
+        sys_seconds ss = sys_seconds{ld.time_since_epoch()};
+        while (i + 1 < intervals.size()
+            && intervals[i].end <= ss - intervals[i].offset) {
+          i++;
+        }
+
+        // If the local midnight is before the start of the interval, then it
+        // is in the gap after the previous interval.
+        const ZoneInterval& info = intervals[i];
+        if (ss - info.offset < info.begin) {
           // Loop to the next day
           type = 'T';
+          continue;
         }
+
+        // If the local midnight also occurs in the next interval, choose the
+        // earlier one, as with choose::earliest.
+        collection.push_back(toTestItem(info, ss - info.offset, type));
+        break;
       }
     }
   }
 }
 
-/** Insert TestItems for the given 'zoneName' into testData. */
+//-----------------------------------------------------------------------------
+
+/**
+ * The --snapshot file holds the ZoneIntervals of each zone over [startYear,
+ * untilYear) of the run which wrote it with --snapshot_out, which is all that
+ * is needed from the TZDB, so a run with --snapshot maps it into memory
+ * instead of parsing the TZDB text files, and never downloads anything. Its
+ * layout is a SnapshotHeader, followed by the SnapshotIntervals of all zones,
+ * the SnapshotZones sorted by name, the offset of each abbreviation, then the
+ * NUL terminated zone names and abbreviations. All integers use the byte order
+ * of the writer.
+ */
+const char kSnapshotMagic[] = "AVHS0001";
+const uint32_t kSnapshotByteOrderMark = 0x01020304;
+
+struct SnapshotHeader {
+  char magic[8]; // kSnapshotMagic without the NUL
+  uint32_t byteOrderMark;
+  int32_t startYear;
+  int32_t untilYear;
+  uint32_t numZones;
+  uint32_t numIntervals;
+  uint32_t numAbbrevs;
+  uint32_t charsSize;
+  uint32_t reserved;
+  char version[32]; // TZDB version
+};
+
+struct SnapshotInterval {
+  int64_t begin; // Unix seconds
+  int64_t end; // Unix seconds
+  int32_t offset; // seconds
+  int16_t save; // minutes
+  uint16_t abbrevIndex; // index of the abbreviation in the snapshot
+};
+
+struct SnapshotZone {
+  uint32_t nameOffset; // offset of the name in the chars
+  uint32_t firstInterval;
+  uint32_t numIntervals;
+};
+
+const uint8_t* snapshotData = nullptr;
+size_t snapshotSize;
+const SnapshotHeader* snapshotHeader;
+const SnapshotInterval* snapshotIntervals;
+const SnapshotZone* snapshotZones;
+const char* snapshotChars;
+
+/** The abbrevIntern() index of each abbreviation of the snapshot. */
+vector<uint16_t> snapshotAbbrevIndexes;
+
+/**
+ * Write the ZoneIntervals of the 'zones' over [startYear, untilYear) into the
+ * --snapshot_out file. Returns false on error.
+ */
+bool writeSnapshot(vector<string> zones) {
+  sort(zones.begin(), zones.end());
+  zones.erase(unique(zones.begin(), zones.end()), zones.end());
+
+  vector<SnapshotInterval> intervals;
+  vector<SnapshotZone> snapshotZones;
+  string chars;
+  for (const string& zoneName : zones) {
+    auto* tzp = locate_zone(zoneName);
+    if (tzp == nullptr) {
+      fprintf(stderr, "Zone %s not found\n", zoneName.c_str());
+      continue;
+    }
+    ZoneIntervals zoneIntervals;
+    addIntervals(zoneIntervals, *tzp, startYear, untilYear);
+    snapshotZones.push_back(SnapshotZone{(uint32_t) chars.size(),
+        (uint32_t) intervals.size(), (uint32_t) zoneIntervals.size()});
+    chars.append(zoneName.c_str(), zoneName.size() + 1);
+    for (const ZoneInterval& info : zoneIntervals) {
+      intervals.push_back(SnapshotInterval{
+          info.begin.time_since_epoch().count(),
+          info.end.time_since_epoch().count(),
+          (int32_t) info.offset.count(),
+          (int16_t) info.save.count(),
+          info.abbrevIndex});
+    }
+  }
+
+  // The zones are processed on a single thread, so the interned abbreviations
+  // are numbered the same in the snapshot.
+  vector<uint32_t> abbrevOffsets;
+  for (const string& abbrev : abbrevs) {
+    abbrevOffsets.push_back(chars.size());
+    chars.append(abbrev.c_str(), abbrev.size() + 1);
+  }
+
+  SnapshotHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kSnapshotMagic, sizeof(header.magic));
+  header.byteOrderMark = kSnapshotByteOrderMark;
+  header.startYear = startYear;
+  header.untilYear = untilYear;
+  header.numZones = snapshotZones.size();
+  header.numIntervals = intervals.size();
+  header.numAbbrevs = abbrevOffsets.size();
+  header.charsSize = chars.size();
+  snprintf(header.version, sizeof(header.version), "%s", tzdbVersion.c_str());
+
+  FILE* f = fopen(snapshotOutFile.c_str(), "wb");
+  if (f == nullptr) {
+    fprintf(stderr, "Unable to open snapshot file '%s'\n",
+        snapshotOutFile.c_str());
+    return false;
+  }
+  fwrite(&header, sizeof(header), 1, f);
+  fwrite(intervals.data(), sizeof(SnapshotInterval), intervals.size(), f);
+  fwrite(snapshotZones.data(), sizeof(SnapshotZone), snapshotZones.size(), f);
+  fwrite(abbrevOffsets.data(), sizeof(uint32_t), abbrevOffsets.size(), f);
+  fwrite(chars.data(), 1, chars.size(), f);
+  bool err = ferror(f);
+  if (fclose(f) != 0) err = true;
+  if (err) {
+    fprintf(stderr, "Unable to write snapshot file '%s'\n",
+        snapshotOutFile.c_str());
+    return false;
+  }
+  fprintf(stderr, "Wrote snapshot of %d zones, %d intervals\n",
+      (int) snapshotZones.size(), (int) intervals.size());
+  return true;
+}
+
+/**
+ * Map the --snapshot file into memory, and check it against the flags of this
+ * run. Returns false after printing an error.
+ */
+bool openSnapshot() {
+  const char* path = snapshotFile.c_str();
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "Unable to open snapshot file '%s'\n", path);
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(SnapshotHeader)) {
+    fprintf(stderr, "Snapshot file '%s' is too short\n", path);
+    close(fd);
+    return false;
+  }
+  snapshotSize = st.st_size;
+  void* addr = mmap(nullptr, snapshotSize, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    fprintf(stderr, "Unable to mmap snapshot file '%s'\n", path);
+    return false;
+  }
+  snapshotData = (const uint8_t*) addr;
+
+  const SnapshotHeader* header = (const SnapshotHeader*) snapshotData;
+  if (memcmp(header->magic, kSnapshotMagic, sizeof(header->magic)) != 0
+      || header->byteOrderMark != kSnapshotByteOrderMark) {
+    fprintf(stderr, "File '%s' is not a snapshot of this machine\n", path);
+    return false;
+  }
+  uint64_t intervalsOffset = sizeof(SnapshotHeader);
+  uint64_t zonesOffset = intervalsOffset
+      + (uint64_t) header->numIntervals * sizeof(SnapshotInterval);
+  uint64_t abbrevsOffset = zonesOffset
+      + (uint64_t) header->numZones * sizeof(SnapshotZone);
+  uint64_t charsOffset = abbrevsOffset
+      + (uint64_t) header->numAbbrevs * sizeof(uint32_t);
+  if (charsOffset + header->charsSize != snapshotSize
+      || header->charsSize == 0
+      || snapshotData[snapshotSize - 1] != '\0'
+      || header->version[sizeof(header->version) - 1] != '\0') {
+    fprintf(stderr, "Snapshot file '%s' is corrupt\n", path);
+    return false;
+  }
+  snapshotHeader = header;
+  snapshotIntervals =
+      (const SnapshotInterval*) (snapshotData + intervalsOffset);
+  snapshotZones = (const SnapshotZone*) (snapshotData + zonesOffset);
+  snapshotChars = (const char*) (snapshotData + charsOffset);
+
+  const uint32_t* abbrevOffsets =
+      (const uint32_t*) (snapshotData + abbrevsOffset);
+  for (uint32_t i = 0; i < header->numZones; i++) {
+    const SnapshotZone& zone = snapshotZones[i];
+    if (zone.nameOffset >= header->charsSize
+        || zone.firstInterval > header->numIntervals
+        || zone.numIntervals == 0
+        || zone.numIntervals > header->numIntervals - zone.firstInterval) {
+      fprintf(stderr, "Snapshot file '%s' is corrupt\n", path);
+      return false;
+    }
+  }
+  for (uint32_t i = 0; i < header->numAbbrevs; i++) {
+    if (abbrevOffsets[i] >= header->charsSize) {
+      fprintf(stderr, "Snapshot file '%s' is corrupt\n", path);
+      return false;
+    }
+    snapshotAbbrevIndexes.push_back(
+        abbrevIntern(snapshotChars + abbrevOffsets[i]));
+  }
+  for (uint32_t i = 0; i < header->numIntervals; i++) {
+    if (snapshotIntervals[i].abbrevIndex >= header->numAbbrevs) {
+      fprintf(stderr, "Snapshot file '%s' is corrupt\n", path);
+      return false;
+    }
+  }
+
+  if (startYear < header->startYear || untilYear > header->untilYear) {
+    fprintf(stderr, "Snapshot file '%s' has years [%d, %d)\n",
+        path, header->startYear, header->untilYear);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Copy the ZoneIntervals of the given zone over [startYear, untilYear) from the
+ * snapshot, which may cover more years. Returns false if the zone is not in
+ * the snapshot.
+ */
+bool findSnapshotIntervals(ZoneIntervals& intervals, const string& zoneName,
+    int startYear, int untilYear) {
+  const SnapshotZone* zonesEnd = snapshotZones + snapshotHeader->numZones;
+  const SnapshotZone* zone = lower_bound(snapshotZones, zonesEnd, zoneName,
+    [](const SnapshotZone& z, const string& name) {
+      return strcmp(snapshotChars + z.nameOffset, name.c_str()) < 0;
+    }
+  );
+  if (zone == zonesEnd || zoneName != snapshotChars + zone->nameOffset) {
+    return false;
+  }
+
+  // Select the intervals from the one containing the second before startYear,
+  // to the one containing the second before untilYear, as addIntervals().
+  int64_t start = (sys_days{January/1/startYear} + seconds(0))
+      .time_since_epoch().count();
+  int64_t end = (sys_days{January/1/untilYear} + seconds(0))
+      .time_since_epoch().count();
+  const SnapshotInterval* first = snapshotIntervals + zone->firstInterval;
+  const SnapshotInterval* last = first + zone->numIntervals;
+  for (const SnapshotInterval* p = first; p != last; p++) {
+    if (p->end < start) continue;
+    intervals.push_back(ZoneInterval{
+        sys_seconds{seconds(p->begin)},
+        sys_seconds{seconds(p->end)},
+        seconds(p->offset),
+        minutes(p->save),
+        snapshotAbbrevIndexes[p->abbrevIndex]});
+    if (p->end >= end) break;
+  }
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * The --cache_dir flag keeps the TestEntry of each zone from previous runs in
+ * its own file, so that a rerun recomputes only the zones whose inputs have
+ * changed, and an interrupted run resumes where it stopped. The file name is a
+ * hash of everything that determines the TestEntry. Each file is a text file
+ * with a header line, the number of transitions and samples, then one line per
+ * TestItem.
+ */
+const char kResultCacheMagic[] = "AVRC0001";
+
+atomic<long> numCacheHits(0);
+atomic<long> numCacheMisses(0);
+
+/** Continue the 64-bit FNV-1a 'hash' with 's' and a NUL separator. */
+uint64_t hashString(uint64_t hash, const string& s) {
+  for (unsigned char c : s) {
+    hash = (hash ^ c) * 1099511628211ull;
+  }
+  return hash * 1099511628211ull;
+}
+
+/**
+ * Return the Zone lines of the zone as parsed from the TZDB text files, which
+ * name its Rules.
+ */
+string zoneText(const time_zone& tz) {
+  ostringstream text;
+  text << tz;
+  return text.str();
+}
+
+/** Return the contents of the intervals of a zone from the snapshot. */
+string intervalsText(const ZoneIntervals& intervals) {
+  ostringstream text;
+  for (const ZoneInterval& info : intervals) {
+    text << info.begin.time_since_epoch().count() << ' '
+        << info.offset.count() << ' ' << info.save.count() << ' '
+        << abbrevString(info.abbrevIndex) << '\n';
+  }
+  return text.str();
+}
+
+/**
+ * Return the path of the cache file of the given zone. The zone data is given
+ * by zoneText(), or by intervalsText() if --snapshot is used. The Zone lines
+ * name the Rules of the zone, so the TZDB version is also hashed, along with
+ * the flags, the library version and the kOutputVersion of this program.
+ */
+string cachePath(const string& zoneData, const string& zoneName) {
+  uint64_t hash = 14695981039346656037ull;
+  hash = hashString(hash, "hinnant");
+  hash = hashString(hash, to_string(kOutputVersion));
+  hash = hashString(hash, kHinnantDateVersion);
+  hash = hashString(hash, tzdbVersion);
+  hash = hashString(hash, to_string(startYear));
+  hash = hashString(hash, to_string(untilYear));
+  hash = hashString(hash, to_string(epochYear));
+  hash = hashString(hash, zoneName);
+  hash = hashString(hash, zoneData);
+
+  char name[32];
+  snprintf(name, sizeof(name), "/%016llx.entry", (unsigned long long) hash);
+  return cacheDir + name;
+}
+
+bool readCachedCollection(FILE* f, TestCollection& collection) {
+  int numItems;
+  if (fscanf(f, "%d", &numItems) != 1 || numItems < 0) return false;
+  for (int i = 0; i < numItems; i++) {
+    TestItem item;
+    char abbrev[32];
+    int n = fscanf(f, " %c %ld %d %d %d %u %u %d %d %d %31s",
+        &item.type, &item.epochSeconds, &item.utcOffset, &item.dstOffset,
+        &item.year, &item.month, &item.day, &item.hour, &item.minute,
+        &item.second, abbrev);
+    if (n != 11) return false;
+    item.abbrevIndex = abbrevIntern(abbrev);
+    collection.push_back(item);
+  }
+  return true;
+}
+
+void writeCachedCollection(FILE* f, const TestCollection& collection) {
+  fprintf(f, "%d\n", (int) collection.size());
+  for (const TestItem& item : collection) {
+    fprintf(f, "%c %ld %d %d %d %u %u %d %d %d %s\n",
+        item.type, item.epochSeconds, item.utcOffset, item.dstOffset,
+        item.year, item.month, item.day, item.hour, item.minute,
+        item.second, abbrevString(item.abbrevIndex).c_str());
+  }
+}
+
+/**
+ * Read the cache file at 'path' into the empty 'entry'. Returns false if the
+ * file does not exist, is truncated, or belongs to another zone.
+ */
+bool loadCachedEntry(const string& path, const string& zoneName,
+    TestEntry& entry) {
+  FILE* f = fopen(path.c_str(), "r");
+  if (f == nullptr) {
+    numCacheMisses++;
+    return false;
+  }
+
+  char magic[16];
+  char name[256];
+  bool ok = fscanf(f, "%15s %255s", magic, name) == 2
+      && strcmp(magic, kResultCacheMagic) == 0
+      && zoneName == name
+      && readCachedCollection(f, entry.transitions)
+      && readCachedCollection(f, entry.samples);
+  fclose(f);
+
+  if (! ok) {
+    entry.transitions.clear();
+    entry.samples.clear();
+    numCacheMisses++;
+    return false;
+  }
+  numCacheHits++;
+  return true;
+}
+
+/**
+ * Write the 'entry' into the cache file at 'path'. The file is written under a
+ * temporary name, unique to the process and thread, then renamed, so that an
+ * interrupted run never leaves a partial file behind.
+ */
+void storeCachedEntry(const string& path, const string& zoneName,
+    const TestEntry& entry) {
+  ostringstream threadId;
+  threadId << this_thread::get_id();
+  string tmpPath = path + "." + to_string(getpid()) + "." + threadId.str()
+      + ".tmp";
+  FILE* f = fopen(tmpPath.c_str(), "w");
+  if (f == nullptr) {
+    fprintf(stderr, "Unable to open cache file '%s'\n", tmpPath.c_str());
+    return;
+  }
+  fprintf(f, "%s %s\n", kResultCacheMagic, zoneName.c_str());
+  writeCachedCollection(f, entry.transitions);
+  writeCachedCollection(f, entry.samples);
+  bool err = ferror(f);
+  if (fclose(f) != 0) err = true;
+  if (! err && rename(tmpPath.c_str(), path.c_str()) != 0) err = true;
+  if (err) {
+    fprintf(stderr, "Unable to write cache file '%s'\n", path.c_str());
+    remove(tmpPath.c_str());
+  }
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * Insert TestItems for the given 'zoneName' into testData, or read them from
+ * the --cache_dir if they were stored by a previous run.
+ */
 void processZone(TestData& testData, const string& zoneName,
     int startYear, int untilYear) {
-  auto* tzp = locate_zone(zoneName);
-  if (tzp == nullptr) {
+  // Most zones have fewer than 2 transitions per year, each with 2 items.
+  int numYears = untilYear - startYear;
+  ZoneIntervals intervals;
+  intervals.reserve(2 * numYears + 2);
+
+  // With --snapshot, the intervals are copied from the snapshot instead.
+  const time_zone* tzp = nullptr;
+  bool found = (snapshotData != nullptr)
+      ? findSnapshotIntervals(intervals, zoneName, startYear, untilYear)
+      : (tzp = locate_zone(zoneName)) != nullptr;
+  if (! found) {
     fprintf(stderr, "Zone %s not found\n", zoneName.c_str());
     return;
   }
 
-  TestEntry& entry = testData[zoneName];
-  addTransitions(entry.transitions, *tzp, startYear, untilYear);
-  addMonthlySamples(entry.samples, *tzp, startYear, untilYear);
+  testData.emplace_back();
+  TestEntry& entry = testData.back();
+  entry.zoneName = zoneName;
+  string path;
+  if (! cacheDir.empty()) {
+    string zoneData = (tzp != nullptr)
+        ? zoneText(*tzp) : intervalsText(intervals);
+    path = cachePath(zoneData, zoneName);
+    if (loadCachedEntry(path, zoneName, entry)) return;
+  }
+
+  if (tzp != nullptr) addIntervals(intervals, *tzp, startYear, untilYear);
+  entry.transitions.reserve(4 * numYears);
+  entry.samples.reserve(12 * numYears);
+  addTransitions(entry.transitions, intervals);
+  addMonthlySamples(entry.samples, intervals, startYear, untilYear);
+
+  if (! path.empty()) storeCachedEntry(path, zoneName, entry);
 }
 
-/** Process each zoneName in zones and insert into testData map. */
-void processZones(TestData &testData, const vector<string>& zones) {
-  int i = 0;
-  for (string zoneName : zones) {
+/**
+ * Process the zones of 'zones' on a single worker thread into its own
+ * 'testData', taking the index of the next zone from 'nextZone' until all
+ * zones are taken, and record the elapsed seconds of each zone in 'seconds'.
+ */
+void processZonesOnThread(TestData& testData, const vector<string>& zones,
+    atomic<int>& nextZone, vector<double>& seconds) {
+  const int numZones = zones.size();
+  for (;;) {
+    int i = nextZone++;
+    if (i >= numZones) break;
+
+    const string& zoneName = zones[i];
     fprintf(stderr, "[%d] %s\n", i, zoneName.c_str());
+    auto startTime = steady_clock::now();
     processZone(testData, zoneName, startYear, untilYear);
-    i++;
+    duration<double> elapsed = steady_clock::now() - startTime;
+    seconds[i] = elapsed.count();
+  }
+}
+
+/**
+ * Process each zoneName in zones and insert into testData map, using
+ * 'numJobs' worker threads. The tzdb is not modified after reload_tzdb(), and
+ * each time_zone initializes its transitions under a std::call_once(), so the
+ * threads can share them. Each thread appends to its own TestData, which are
+ * merged into 'testData' at the end, then sorted by zone name, so the output
+ * does not depend on the number of threads. If the --costs_out flag is given,
+ * write the elapsed seconds of each zone into that file, to be used as the
+ * --costs file of the next run.
+ */
+void processZones(TestData &testData, const vector<string>& zones) {
+  FILE* costsOut = nullptr;
+  if (! costsOutFile.empty()) {
+    costsOut = fopen(costsOutFile.c_str(), "w");
+    if (costsOut == nullptr) {
+      fprintf(stderr, "Unable to open costs file '%s'\n",
+          costsOutFile.c_str());
+      exit(1);
+    }
+  }
+
+  atomic<int> nextZone(0);
+  vector<double> seconds(zones.size(), 0.0);
+  vector<TestData> threadData(numJobs);
+  if (numJobs <= 1) {
+    processZonesOnThread(threadData[0], zones, nextZone, seconds);
+  } else {
+    vector<thread> threads;
+    for (int j = 0; j < numJobs; j++) {
+      threads.emplace_back(processZonesOnThread, ref(threadData[j]),
+          cref(zones), ref(nextZone), ref(seconds));
+    }
+    for (auto& t : threads) {
+      t.join();
+    }
+  }
+  for (TestData& data : threadData) {
+    for (TestEntry& entry : data) {
+      testData.push_back(move(entry));
+    }
+  }
+
+  if (costsOut != nullptr) {
+    for (size_t i = 0; i < zones.size(); i++) {
+      fprintf(costsOut, "%s %.6f\n", zones[i].c_str(), seconds[i]);
+    }
+    fclose(costsOut);
+  }
+}
+
+/**
+ * Parse the "index/count" argument of the --shard flag. Returns false if the
+ * string is malformed or the index is out of range.
+ */
+bool parseShard(const char* s) {
+  char* end;
+  long index = strtol(s, &end, 10);
+  if (end == s || *end != '/') return false;
+  const char* t = end + 1;
+  long count = strtol(t, &end, 10);
+  if (end == t || *end != '\0') return false;
+  if (count < 1 || index < 0 || index >= count) return false;
+
+  shardIndex = (int) index;
+  shardCount = (int) count;
+  return true;
+}
+
+/**
+ * Return the zones which belong to the current shard. If the --costs file of
+ * "zone cost" lines from a previous run is given, the zones are assigned to
+ * the shards using the greedy longest-processing-time-first rule, so that the
+ * shards finish at about the same time even though a few zones dominate the
+ * run time. Zones missing from the file are assigned the average cost. Without
+ * the costs file, every zone has the same cost, which reduces to a round-robin
+ * assignment.
+ */
+vector<string> selectShard(const vector<string>& zones) {
+  int numZones = zones.size();
+  vector<double> zoneCosts(numZones, 1.0);
+
+  if (! costsFile.empty()) {
+    ifstream in(costsFile);
+    if (! in) {
+      fprintf(stderr, "Unable to read costs file '%s'\n", costsFile.c_str());
+      exit(1);
+    }
+
+    map<string, double> costs;
+    string line;
+    while (getline(in, line)) {
+      size_t comment = line.find('#');
+      if (comment != string::npos) line.erase(comment);
+      char zoneName[512];
+      double cost;
+      if (line.size() >= sizeof(zoneName)) continue;
+      if (sscanf(line.c_str(), "%s %lf", zoneName, &cost) != 2) continue;
+      costs[zoneName] = cost;
+    }
+
+    double average = 1.0;
+    if (! costs.empty()) {
+      double sum = 0.0;
+      for (const auto& p : costs) sum += p.second;
+      average = sum / costs.size();
+    }
+
+    for (int i = 0; i < numZones; i++) {
+      auto it = costs.find(zones[i]);
+      zoneCosts[i] = (it != costs.end()) ? it->second : average;
+    }
+  }
+
+  // Sort by descending cost, breaking ties by input order, so that every
+  // shard computes the same assignment.
+  vector<int> order(numZones);
+  for (int i = 0; i < numZones; i++) order[i] = i;
+  sort(order.begin(), order.end(), [&](int a, int b) {
+    if (zoneCosts[a] != zoneCosts[b]) return zoneCosts[a] > zoneCosts[b];
+    return a < b;
+  });
+
+  // Assign the most expensive remaining zone to the least loaded shard.
+  vector<bool> selected(numZones, false);
+  vector<double> shardLoads(shardCount, 0.0);
+  for (int i : order) {
+    int best = 0;
+    for (int s = 1; s < shardCount; s++) {
+      if (shardLoads[s] < shardLoads[best]) best = s;
+    }
+    shardLoads[best] += zoneCosts[i];
+    selected[i] = (best == shardIndex);
   }
+
+  vector<string> shardZones;
+  for (int i = 0; i < numZones; i++) {
+    if (selected[i]) shardZones.push_back(zones[i]);
+  }
+  return shardZones;
 }
 
 /**
@@ -292,32 +1049,34 @@ inline void ltrim(string &s) {
 	}));
 }
 
-/** Read the 'zones.txt' from the stdin, and process each zone. */
+/**
+ * Read the 'zones.txt' from the stdin, and process each zone. A zone listed
+ * more than once is kept only once, so that it has a single entry in the JSON
+ * output, as with the map<> of zone names used before.
+ */
 vector<string> readZones() {
   vector<string> zones;
+  unordered_set<string> seen;
   string line;
   while (getline(cin, line)) {
 		ltrim(line);
     if (line.empty()) continue;
     if (line[0] == '#') continue;
+    if (! seen.insert(line).second) continue;
     zones.push_back(line);
   }
 
   return zones;
 }
 
-/** Sort the TestItems according to epochSeconds. */
-/*
+/** Sort the TestEntries by zone name, the order of the JSON output. */
 void sortTestData(TestData& testData) {
-  for (auto& p : testData) {
-    sort(p.second.begin(), p.second.end(),
-      [](const TestItem& a, const TestItem& b) {
-        return a.epochSeconds < b.epochSeconds;
-      }
-    );
-  }
+  sort(testData.begin(), testData.end(),
+    [](const TestEntry& a, const TestEntry& b) {
+      return a.zoneName < b.zoneName;
+    }
+  );
 }
-*/
 
 void printTestItem(const char* indent, const TestItem& item) {
   printf("%s\"epoch\": %ld,\n", indent, item.epochSeconds);
@@ -329,7 +1088,8 @@ void printTestItem(const char* indent, const TestItem& item) {
   printf("%s\"h\": %d,\n", indent, item.hour);
   printf("%s\"m\": %d,\n", indent, item.minute);
   printf("%s\"s\": %d,\n", indent, item.second);
-  printf("%s\"abbrev\": \"%s\",\n", indent, item.abbrev.c_str());
+  printf("%s\"abbrev\": \"%s\",\n", indent,
+      abbrevString(item.abbrevIndex).c_str());
   printf("%s\"type\": \"%c\"\n", indent, item.type);
 }
 
@@ -341,10 +1101,10 @@ void printJson(const TestData& testData) {
   string indentUnit = "  ";
 
   // Version of Hinnant Date library
-  string version = "3.0.0";
+  string version = kHinnantDateVersion;
 
-  // TZDB version
-  string tzVersion = date::get_tzdb().version.c_str();
+  // TZDB version, from get_tzdb() or the --snapshot
+  const string& tzVersion = tzdbVersion;
 
   const char indent0[] = "  ";
   const char indent1[] = "    ";
@@ -368,10 +1128,8 @@ void printJson(const TestData& testData) {
   // Print each zone
   int zoneCount = 1;
   int numZones = testData.size();
-  for (const auto& zoneEntry : testData) {
-    string zoneName = zoneEntry.first;
-    const TestEntry& entry = zoneEntry.second;
-    printf("%s\"%s\": {\n", indent1, zoneName.c_str());
+  for (const TestEntry& entry : testData) {
+    printf("%s\"%s\": {\n", indent1, entry.zoneName.c_str());
 
     // Print transitions
     int itemCount = 1;
@@ -406,10 +1164,37 @@ void printJson(const TestData& testData) {
   printf("}\n");
 }
 
+/**
+ * Write the counters of the heap allocations and the sizes of the tables into
+ * the --stats file, as a JSON object.
+ */
+void writeStats(const TestData& testData) {
+  FILE* file = fopen(statsFile.c_str(), "w");
+  if (file == nullptr) {
+    fprintf(stderr, "Unable to open stats file '%s'\n", statsFile.c_str());
+    exit(1);
+  }
+  long numItems = 0;
+  for (const TestEntry& entry : testData) {
+    numItems += entry.transitions.size() + entry.samples.size();
+  }
+  fprintf(file, "{\n");
+  fprintf(file, "  \"allocations\": %ld,\n", numAllocations.load());
+  fprintf(file, "  \"allocated_bytes\": %ld,\n", numAllocatedBytes.load());
+  fprintf(file, "  \"zones\": %d,\n", (int) testData.size());
+  fprintf(file, "  \"items\": %ld,\n", numItems);
+  fprintf(file, "  \"abbrevs\": %d\n", (int) abbrevs.size());
+  fprintf(file, "}\n");
+  fclose(file);
+}
+
 void usageAndExit() {
   fprintf(stderr,
     "Usage: generate_data [--install_dir {dir}] [--tz_version {version}]\n"
     "   --start_year start --until_year until --epoch_year year\n"
+    "   [--jobs num] [--shard index/count] [--costs file] [--costs_out file]\n"
+    "   [--cache_dir dir] [--stats stats.json]\n"
+    "   [--snapshot snapshot.bin | --snapshot_out snapshot.bin]\n"
     "   < zones.txt\n");
   exit(1);
 }
@@ -430,6 +1215,7 @@ int main(int argc, const char* const* argv) {
   string epochYearStr = "";
   string tzVersion = "";
   string installDir = "";
+  string jobsStr = "1";
 
   shift(argc, argv);
   while (argc > 0) {
@@ -453,6 +1239,42 @@ int main(int argc, const char* const* argv) {
       shift(argc, argv);
       if (argc == 0) usageAndExit();
       installDir = argv[0];
+    } else if (argEquals(argv[0], "--jobs")) {
+      shift(argc, argv);
+      if (argc == 0) usageAndExit();
+      jobsStr = argv[0];
+    } else if (argEquals(argv[0], "--shard")) {
+      shift(argc, argv);
+      if (argc == 0) usageAndExit();
+      if (! parseShard(argv[0])) {
+        fprintf(stderr, "Invalid --shard '%s'\n", argv[0]);
+        usageAndExit();
+      }
+    } else if (argEquals(argv[0], "--costs")) {
+      shift(argc, argv);
+      if (argc == 0) usageAndExit();
+      costsFile = argv[0];
+    } else if (argEquals(argv[0], "--costs_out")) {
+      shift(argc, argv);
+      if (argc == 0) usageAndExit();
+      costsOutFile = argv[0];
+    } else if (argEquals(argv[0], "--cache_dir")) {
+      shift(argc, argv);
+      if (argc == 0) usageAndExit();
+      cacheDir = argv[0];
+    } else if (argEquals(argv[0], "--stats")) {
+      shift(argc, argv);
+      if (argc == 0) usageAndExit();
+      statsFile = argv[0];
+      countAllocations = true;
+    } else if (argEquals(argv[0], "--snapshot")) {
+      shift(argc, argv);
+      if (argc == 0) usageAndExit();
+      snapshotFile = argv[0];
+    } else if (argEquals(argv[0], "--snapshot_out")) {
+      shift(argc, argv);
+      if (argc == 0) usageAndExit();
+      snapshotOutFile = argv[0];
     } else if (argEquals(argv[0], "--")) {
       shift(argc, argv);
       break;
@@ -488,27 +1310,22 @@ int main(int argc, const char* const* argv) {
   startYear = atoi(startYearStr.c_str());
   untilYear = atoi(untilYearStr.c_str());
   epochYear = atoi(epochYearStr.c_str());
+  numJobs = atoi(jobsStr.c_str());
+  if (numJobs < 1) {
+    fprintf(stderr, "Invalid --jobs: %s\n", jobsStr.c_str());
+    usageAndExit();
+  }
 
-  // Set the install directory if specified. Otherwise the default is
-  // ~/Downloads/tzdata on a Linux or MacOS machine. See
-  // https://howardhinnant.github.io/date/tz.html#Installation.
-  if (! installDir.empty()) {
-    set_install(installDir);
+  if (! snapshotFile.empty() && ! snapshotOutFile.empty()) {
+    fprintf(stderr, "Cannot use both --snapshot and --snapshot_out\n");
+    usageAndExit();
   }
 
-  // Explicitly download load the TZ Database at the specified version if
-  // --tz_version is given. This works even if AUTO_DOWNLOAD=0. See
-  // https://github.com/HowardHinnant/date/wiki/Examples-and-Recipes#thoughts-on-reloading-the-iana-tzdb-for-long-running-programs
-  // and https://howardhinnant.github.io/date/tz.html#database.
-  if (! tzVersion.empty()) {
-    if (! remote_download(tzVersion)) {
-      fprintf(stderr, "Failed to download TZ Version %s\n", tzVersion.c_str());
-      exit(1);
-    }
-    if (! remote_install(tzVersion)) {
-      fprintf(stderr, "Failed to install TZ Version %s\n", tzVersion.c_str());
-      exit(1);
-    }
+  if (! cacheDir.empty()
+      && mkdir(cacheDir.c_str(), 0777) != 0 && errno != EEXIST) {
+    fprintf(stderr, "Unable to create cache directory '%s'\n",
+        cacheDir.c_str());
+    exit(1);
   }
 
   // Calculate the number of seconds from Unix epoch to the AceTime epoch.
@@ -518,28 +1335,77 @@ int main(int argc, const char* const* argv) {
   secondsToAceTimeEpochFromUnixEpoch =
       86400 * (long) aceTimeEpoch.time_since_epoch().count();
 
-  // Install the TZ database. Caution: If the source directory is pointed to
-  // the raw https://github.com/eggert/tz/ repo, it is not in the form that is
-  // expected (I think the 'version' file is missing), so the version returned
-  // by get_tzdb() will be in correct.
-  reload_tzdb();
-  if (tzVersion.empty()) {
-    fprintf(stderr, "Loaded existing TZ Version %s\n",
-        date::get_tzdb().version.c_str());
+  // Load the TZ database from the --snapshot file, strictly offline, or parse
+  // the TZDB text files. The elapsed time compares the two.
+  auto loadStartTime = steady_clock::now();
+  if (! snapshotFile.empty()) {
+    if (! openSnapshot()) exit(1);
+    tzdbVersion = snapshotHeader->version;
+    if (! tzVersion.empty() && tzVersion != tzdbVersion) {
+      fprintf(stderr, "Snapshot has TZ Version %s, not %s\n",
+          tzdbVersion.c_str(), tzVersion.c_str());
+      exit(1);
+    }
   } else {
-    fprintf(stderr, "Loaded TZ Version %s\n", tzVersion.c_str());
+    // Set the install directory if specified. Otherwise the default is
+    // ~/Downloads/tzdata on a Linux or MacOS machine. See
+    // https://howardhinnant.github.io/date/tz.html#Installation.
+    if (! installDir.empty()) {
+      set_install(installDir);
+    }
+
+    // Explicitly download load the TZ Database at the specified version if
+    // --tz_version is given. This works even if AUTO_DOWNLOAD=0. See
+    // https://github.com/HowardHinnant/date/wiki/Examples-and-Recipes#thoughts-on-reloading-the-iana-tzdb-for-long-running-programs
+    // and https://howardhinnant.github.io/date/tz.html#database.
+    if (! tzVersion.empty()) {
+      if (! remote_download(tzVersion)) {
+        fprintf(stderr, "Failed to download TZ Version %s\n",
+            tzVersion.c_str());
+        exit(1);
+      }
+      if (! remote_install(tzVersion)) {
+        fprintf(stderr, "Failed to install TZ Version %s\n",
+            tzVersion.c_str());
+        exit(1);
+      }
+    }
+
+    // Install the TZ database. Caution: If the source directory is pointed
+    // to the raw https://github.com/eggert/tz/ repo, it is not in the form
+    // that is expected (I think the 'version' file is missing), so the version
+    // returned by get_tzdb() will be in correct.
+    reload_tzdb();
+    tzdbVersion = get_tzdb().version;
   }
+  duration<double> loadSeconds = steady_clock::now() - loadStartTime;
+  fprintf(stderr, "Loaded %sTZ Version %s in %.3f seconds\n",
+      snapshotFile.empty() ? "" : "snapshot of ", tzdbVersion.c_str(),
+      loadSeconds.count());
 
-  // Process the zones on the STDIN
-  vector<string> zones = readZones();
+  // Write the snapshot of all the zones on the STDIN, instead of the
+  // validation data.
+  if (! snapshotOutFile.empty()) {
+    return writeSnapshot(readZones()) ? 0 : 1;
+  }
+
+  // Process the zones on the STDIN which belong to this shard.
+  vector<string> zones = selectShard(readZones());
 
   fprintf(stderr, "Generating validation data\n");
   TestData testData;
   processZones(testData, zones);
-  //sortTestData(testData);
+  sortTestData(testData);
 
   fprintf(stderr, "Writing validation data\n");
   printJson(testData);
+  if (! cacheDir.empty()) {
+    fprintf(stderr, "Result cache: %ld hits, %ld misses\n",
+        numCacheHits.load(), numCacheMisses.load());
+  }
+  if (! statsFile.empty()) {
+    writeStats(testData);
+  }
 
   fprintf(stderr, "Done\n");
   return 0;
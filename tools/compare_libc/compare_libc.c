@@ -7,6 +7,13 @@
  *    --start_year start
  *    --until_year until
  *    --epoch_year year
+ *    [--sampling_interval hours]
+ *    [--min_gap hours]
+ *    [--jobs num]
+ *    [--shard index/count]
+ *    [--costs costs.txt]
+ *    [--costs_out costs.txt]
+ *    [--cache_dir dir]
  *    < zones.txt
  *    > validation_data.json
  */
@@ -16,7 +23,7 @@
 #include <stdio.h> // printf(), fprintf(), stdin
 #include <stdint.h> // uint8_t
 #include <stdbool.h> // bool
-#include <time.h> // tzset()
+#include <time.h> // tzset(), clock_gettime()
 
 //gnu_get_libc_version(), https://stackoverflow.com/questions/9705660
 #if defined(__GNUC__) && defined(__linux__)
@@ -25,9 +32,15 @@
 
 #include "test_data.h"
 #include "sampling.h"
+#include "shard.h"
+#include "result_cache.h"
+#include "workers.h"
 
 #define MAX_LINE_SIZE 512
-#define SAMPLING_INTERVAL_HOURS 22
+
+// Version of the items generated by sampling.c, added to the keys of the
+// result cache. Increment it whenever a change of the code changes the output.
+#define OUTPUT_VERSION 1
 
 //-----------------------------------------------------------------------------
 
@@ -44,6 +57,9 @@ static void usage_and_exit(int status)
   fprintf(stderr,
     "Usage: generate_data.out [--help]\n"
     "   --start_year start --until_year until --epoch_year year\n"
+    "   [--sampling_interval hours] [--min_gap hours] [--jobs num]\n"
+    "   [--shard index/count] [--costs file] [--costs_out file]\n"
+    "   [--cache_dir dir]\n"
     "   < zones.txt > validation_data.json\n"
   );
   exit(status);
@@ -59,6 +75,13 @@ static bool arg_equals(const char* s, const char* t)
 int start_year = 0;
 int until_year = 0;
 int epoch_year = 0;
+int sampling_interval = 22; // hours
+int min_gap = 0; // hours, 0 means the stride is fixed at sampling_interval
+int num_jobs = 1; // worker processes, 1 means the zones are processed serially
+struct Shard shard = {0, 1};
+const char *costs_file = NULL;
+const char *costs_out_file = NULL;
+const char *cache_dir = NULL;
 
 /**
  * Parse command line flags.
@@ -72,6 +95,9 @@ static int parse_flags(int argc, char **argv)
   const char *start = "";
   const char *until = "";
   const char *epoch = "";
+  const char *interval = "22";
+  const char *gap = "0";
+  const char *jobs = "1";
   while (argc > 0) {
     if (arg_equals(argv[0], "--start_year")) {
       SHIFT(argc, argv);
@@ -85,6 +111,37 @@ static int parse_flags(int argc, char **argv)
       SHIFT(argc, argv);
       if (argc == 0) usage_and_exit(1);
       epoch = argv[0];
+    } else if (arg_equals(argv[0], "--sampling_interval")) {
+      SHIFT(argc, argv);
+      if (argc == 0) usage_and_exit(1);
+      interval = argv[0];
+    } else if (arg_equals(argv[0], "--min_gap")) {
+      SHIFT(argc, argv);
+      if (argc == 0) usage_and_exit(1);
+      gap = argv[0];
+    } else if (arg_equals(argv[0], "--jobs")) {
+      SHIFT(argc, argv);
+      if (argc == 0) usage_and_exit(1);
+      jobs = argv[0];
+    } else if (arg_equals(argv[0], "--shard")) {
+      SHIFT(argc, argv);
+      if (argc == 0) usage_and_exit(1);
+      if (shard_parse(&shard, argv[0])) {
+        fprintf(stderr, "Invalid --shard '%s'\n", argv[0]);
+        usage_and_exit(1);
+      }
+    } else if (arg_equals(argv[0], "--costs")) {
+      SHIFT(argc, argv);
+      if (argc == 0) usage_and_exit(1);
+      costs_file = argv[0];
+    } else if (arg_equals(argv[0], "--costs_out")) {
+      SHIFT(argc, argv);
+      if (argc == 0) usage_and_exit(1);
+      costs_out_file = argv[0];
+    } else if (arg_equals(argv[0], "--cache_dir")) {
+      SHIFT(argc, argv);
+      if (argc == 0) usage_and_exit(1);
+      cache_dir = argv[0];
     } else if (arg_equals(argv[0], "--")) {
       SHIFT(argc, argv);
       break;
@@ -116,6 +173,22 @@ static int parse_flags(int argc, char **argv)
   start_year = atoi(start);
   until_year = atoi(until);
   epoch_year = atoi(epoch);
+  sampling_interval = atoi(interval);
+  min_gap = atoi(gap);
+  num_jobs = atoi(jobs);
+  // Limit both to 1 year, the same as compare_acetime.
+  if (sampling_interval < 1 || sampling_interval > 8760) {
+    fprintf(stderr, "Invalid --sampling_interval: %s\n", interval);
+    usage_and_exit(1);
+  }
+  if (min_gap < 0 || min_gap > 8760) {
+    fprintf(stderr, "Invalid --min_gap: %s\n", gap);
+    usage_and_exit(1);
+  }
+  if (num_jobs < 1) {
+    fprintf(stderr, "Invalid --jobs: %s\n", jobs);
+    usage_and_exit(1);
+  }
 
   return argc_original - argc;
 }
@@ -153,7 +226,11 @@ uint8_t set_time_zone(const char *zone_name) {
   return invalid;
 }
 
-uint8_t process_zone(struct TestData *test_data, int i, const char *zone_name)
+/**
+ * Fill the given 'entry' with the test items of the zone. Returns non-zero if
+ * the zone is not found.
+ */
+uint8_t process_zone(struct TestEntry *entry, int i, const char *zone_name)
 {
   fprintf(stderr, "[%d] Zone %s\n", i, zone_name);
   uint8_t err = set_time_zone(zone_name);
@@ -162,13 +239,11 @@ uint8_t process_zone(struct TestData *test_data, int i, const char *zone_name)
     return err;
   }
 
-  // Create entry for a single zone
-  struct TestEntry *entry = test_data_new_entry(test_data);
   strncpy(entry->zone_name, zone_name, ZONE_NAME_SIZE - 1);
   entry->zone_name[ZONE_NAME_SIZE - 1] = '\0';
 
   add_transitions(&entry->transitions, zone_name, start_year, until_year,
-    SAMPLING_INTERVAL_HOURS);
+    sampling_interval, min_gap);
   add_monthly_samples(&entry->samples, zone_name, start_year, until_year);
 
   //test_collection_sort_items(entry);
@@ -176,11 +251,86 @@ uint8_t process_zone(struct TestData *test_data, int i, const char *zone_name)
   return 0;
 }
 
-// Read zones from the stdin.
-uint8_t process_zones(struct TestData *test_data)
+/** Return the version of the C library. */
+static const char *libc_version(void)
 {
+#if defined(__GNUC__) && defined(__linux__)
+  return gnu_get_libc_version();
+#else
+  return "unknown";
+#endif
+}
+
+/**
+ * Set the 'key' of the result cache of the given zone. The zone data is the
+ * TZif file of the zone, which is read by the C library under $TZDIR, or
+ * /usr/share/zoneinfo by default. The OUTPUT_VERSION stands for this program
+ * itself. Returns 1 if the file cannot be read, so
+ * that the zone is never cached from stale data.
+ */
+static int zone_result_key(struct ResultKey *key, const char *zone_name)
+{
+  const char *tzdir = getenv("TZDIR");
+  if (tzdir == NULL) tzdir = "/usr/share/zoneinfo";
+  char path[MAX_LINE_SIZE * 2];
+  snprintf(path, sizeof(path), "%s/%s", tzdir, zone_name);
+
+  result_key_init(key);
+  result_key_add_string(key, "libc");
+  result_key_add_int(key, OUTPUT_VERSION);
+  result_key_add_string(key, libc_version());
+  result_key_add_int(key, start_year);
+  result_key_add_int(key, until_year);
+  result_key_add_int(key, epoch_year);
+  result_key_add_int(key, sampling_interval);
+  result_key_add_int(key, min_gap);
+  result_key_add_string(key, zone_name);
+  return result_key_add_file(key, path);
+}
+
+/**
+ * Fill the given 'entry' of the zone from the --cache_dir if possible,
+ * otherwise process the zone, and store the result into the cache. Returns
+ * non-zero if the zone is not found.
+ */
+static uint8_t process_or_load_zone(
+    struct TestEntry *entry,
+    int i,
+    const char *zone_name)
+{
+  if (cache_dir == NULL) return process_zone(entry, i, zone_name);
+
+  struct ResultKey key;
+  if (zone_result_key(&key, zone_name)) {
+    return process_zone(entry, i, zone_name);
+  }
+  if (result_cache_load(cache_dir, &key, zone_name, entry) == 0) {
+    fprintf(stderr, "[%d] Zone %s: cached\n", i, zone_name);
+    return 0;
+  }
+  uint8_t err = process_zone(entry, i, zone_name);
+  if (!err) result_cache_store(cache_dir, &key, entry);
+  return err;
+}
+
+/** Return the monotonic clock in seconds. */
+static double now_seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Read zones from the stdin into a newly allocated array of strings. Blank
+ * lines and comments are skipped.
+ */
+char **read_zones(int *num_zones)
+{
+  int capacity = 16;
+  int n = 0;
+  char **zones = malloc(sizeof(char *) * capacity);
   char line[MAX_LINE_SIZE];
-  int i = 0;
   for (;;) {
     // fgets() always NUL-terminates
     const char *s = fgets(line, MAX_LINE_SIZE, stdin);
@@ -200,12 +350,89 @@ uint8_t process_zones(struct TestData *test_data)
     // Skip over comments
     if (line[0] == '#') continue;
 
-    int8_t err = process_zone(test_data, i, line);
-    if (err) return err;
-    i++;
+    if (n >= capacity) {
+      capacity *= 2;
+      zones = realloc(zones, sizeof(char *) * capacity);
+    }
+    zones[n++] = strdup(line);
   }
 
-  return 0;
+  *num_zones = n;
+  return zones;
+}
+
+/** Destination of the completed zones, in the order of the input zones. */
+struct ZoneOutput {
+  const char * const *zones;
+  FILE *costs_out;
+  bool first;
+};
+
+/** Print the 'entry' of zones[i], and its elapsed 'seconds' to the costs. */
+static void output_zone(
+    void *context,
+    int i,
+    const struct TestEntry *entry,
+    double seconds)
+{
+  struct ZoneOutput *output = context;
+  print_json_entry(entry, output->first);
+  output->first = false;
+  if (output->costs_out != NULL) {
+    fprintf(output->costs_out, "%s %.6f\n", output->zones[i], seconds);
+  }
+}
+
+/**
+ * Process the zones on the stdin which belong to the current shard, and print
+ * each zone on the stdout as soon as it is done, so that only a single zone is
+ * held in memory. If costs_out_file is given, write the elapsed seconds of each
+ * zone into it, to be used as the --costs file of the next run.
+ *
+ * If --jobs is greater than 1, the zones are processed on worker processes,
+ * and printed in the same order, holding only the zones which are completed
+ * ahead of an earlier zone.
+ */
+uint8_t process_zones(void)
+{
+  int num_zones = 0;
+  char **zones = read_zones(&num_zones);
+  bool *selected = malloc(sizeof(bool) * (num_zones + 1));
+  uint8_t err = shard_select(
+      &shard, costs_file, num_zones, (const char * const *) zones, selected);
+
+  FILE *costs_out = NULL;
+  if (!err && costs_out_file != NULL) {
+    costs_out = fopen(costs_out_file, "w");
+    if (costs_out == NULL) {
+      fprintf(stderr, "Unable to open costs file '%s'\n", costs_out_file);
+      err = 1;
+    }
+  }
+
+  struct ZoneOutput output = {(const char * const *) zones, costs_out, true};
+  if (!err && num_jobs > 1) {
+    err = workers_process_zones(num_jobs, num_zones,
+        (const char * const *) zones, selected, process_or_load_zone,
+        output_zone, &output);
+  }
+  for (int i = 0; !err && num_jobs <= 1 && i < num_zones; i++) {
+    if (!selected[i]) continue;
+
+    double start = now_seconds();
+    struct TestData test_data;
+    test_data_init_presized(&test_data, 1, start_year, until_year);
+    struct TestEntry *entry = test_data_new_entry(&test_data);
+    err = process_or_load_zone(entry, i, zones[i]);
+    if (!err) output_zone(&output, i, entry, now_seconds() - start);
+    test_data_clear(&test_data);
+  }
+
+  if (costs_out != NULL) fclose(costs_out);
+  for (int i = 0; i < num_zones; i++) free(zones[i]);
+  free(zones);
+  free(selected);
+  return err;
 }
 
 //-----------------------------------------------------------------------------
@@ -214,30 +441,25 @@ int main(int argc, char **argv )
 {
   parse_flags(argc, argv);
   set_ace_time_epoch_year(epoch_year);
+  if (cache_dir != NULL && result_cache_open(cache_dir)) exit(1);
 
-  struct TestData test_data;
-  test_data_init(&test_data);
-
-  int8_t err = process_zones(&test_data);
-  if (err) {
-    fprintf(stderr, "ERROR: code %d\n", err);
-    exit(1);
-  }
-
-  print_json(
-    &test_data,
+  print_json_header(
     start_year,
     until_year,
     epoch_year,
     "libc" /*source*/,
-  #if defined(__GNUC__) && defined(__linux__)
-    gnu_get_libc_version() /*version*/,
-  #else
-    "unknown" /*version*/,
-  #endif
+    libc_version() /*version*/,
     "2022g?" /*tz_version*/);
 
-  test_data_clear(&test_data);
+  int8_t err = process_zones();
+  if (err) {
+    fprintf(stderr, "ERROR: code %d\n", err);
+    exit(1);
+  }
+
+  print_json_footer();
+  print_alloc_stats();
+  if (cache_dir != NULL) print_result_cache_stats();
 
   return 0;
 }
@@ -1,6 +1,5 @@
 #include <stdbool.h>
 #include <stdint.h>
-#include <string.h> // strncpy()
 #include <time.h> // mktime(), timegm(), localtime_r()
 #include "sampling.h"
 
@@ -95,12 +94,7 @@ static int8_t create_test_item_from_epoch_seconds(
   ti->utc_offset = tms.tm_gmtoff;
   ti->type = type;
 
-  if (tms.tm_isdst) {
-    strncpy(ti->abbrev, tzname[1], MAX_ABBREV_SIZE);
-  } else {
-    strncpy(ti->abbrev, tzname[0], MAX_ABBREV_SIZE);
-  }
-  ti->abbrev[MAX_ABBREV_SIZE - 1] = '\0';
+  ti->abbrev_index = abbrev_intern(tms.tm_isdst ? tzname[1] : tzname[0]);
 
   // Don't know how to get this info from libc's time functions.
   ti->dst_offset = 0;
@@ -198,20 +192,49 @@ static void binary_search_transition(
   *t_right = right;
 }
 
+// Longest stride of the gallop. Every month has at least 28 days, so a step of
+// at most 28 days ends in either the same local month or the next one, and
+// cannot step over a whole month without checking it against rule_months.
+#define MAX_GALLOP_HOURS (28 * 24)
+
 void add_transitions(
     struct TestCollection *collection,
     const char *zone_name,
     int16_t start_year,
     int16_t until_year,
-    int interval_hours)
+    int interval_hours,
+    int min_gap_hours)
 {
+  time_t min_stride = (time_t) interval_hours * 3600;
+  time_t max_stride = (time_t) min_gap_hours * 3600;
+  if (max_stride > (time_t) MAX_GALLOP_HOURS * 3600) {
+    max_stride = (time_t) MAX_GALLOP_HOURS * 3600;
+  }
+  if (max_stride < min_stride) max_stride = min_stride;
+
+  // Bit (m-1) is set if a transition was found in local month 'm'.
+  uint16_t rule_months = 0;
+
   time_t t = to_unix_seconds(start_year, 1, 1, 0, 0, 0);
   t -= 86400; // go back one day because local TZ may not be UTC
   struct LocalDateTime ldt = to_local_date_time(t);
+  time_t stride = min_stride;
 
   for (;;) {
-    time_t t_next = t + interval_hours * 3600;
+    // Use the minimum stride in the months where transitions occur.
+    if (rule_months & (1 << (ldt.month - 1))) stride = min_stride;
+
+    time_t t_next = t + stride;
     struct LocalDateTime ldt_next = to_local_date_time(t_next);
+    if (stride > min_stride) {
+      // Retry with the minimum stride if the step would end in a month with
+      // transitions, or after the end of the interval.
+      if (ldt_next.year >= until_year
+          || (rule_months & (1 << (ldt_next.month - 1)))) {
+        stride = min_stride;
+        continue;
+      }
+    }
     if (ldt_next.year >= until_year) break;
 
     // Look for utc offset transition
@@ -224,6 +247,12 @@ void add_transitions(
           collection, zone_name, left_epoch_seconds, 'A');
       add_test_item_from_epoch_seconds(
           collection, zone_name, right_epoch_seconds, 'B');
+
+      rule_months |= (uint16_t) (1 << (to_local_date_time(right).month - 1));
+      stride = min_stride;
+    } else {
+      stride *= 2;
+      if (stride > max_stride) stride = max_stride;
     }
 
     t = t_next;
@@ -8,17 +8,27 @@ void set_ace_time_epoch_year(int epoch_year);
 
 /**
  * Add a TestItem for one second before a DST transition, and right at the
- * the DST transition. Calculates the active transitions inside the
- * AtcZoneProcessor structure for each each year from `start_year` to
- * `until_year`. Then extracts the transitions from the AtcTransitionStorage
- * structure. Similar to `compare_acetz/zptdgenerator.py`.
+ * the DST transition. The transitions are found by scanning the years from
+ * `start_year` to `until_year` with an adaptive stride, then doing a binary
+ * search within the stride which contains a transition.
+ *
+ * The stride starts at `interval_hours` and doubles after every step without a
+ * transition, up to `min_gap_hours` but at most 28 days, so that a step never
+ * skips a whole month. It falls back to `interval_hours` after each transition,
+ * and during the months in which a transition has already been found in an
+ * earlier year. Two transitions closer than `min_gap_hours` to each other can
+ * be missed, for example a pair which restores the original UTC offset within
+ * a single stride before any of its months has been seen. If `min_gap_hours`
+ * is less than or equal to `interval_hours`, the stride is fixed at
+ * `interval_hours`.
  */
 void add_transitions(
     struct TestCollection *collection,
     const char *zone_name,
     int16_t start_year,
     int16_t until_year,
-    int interval_hours);
+    int interval_hours,
+    int min_gap_hours);
 
 /**
  * Add a TestItem for the 1st of each month (using the local time)
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h> // malloc(), qsort(), bsearch()
+#include <string.h> // strcmp(), strchr()
+#include "shard.h"
+
+#define MAX_COST_LINE_SIZE 512
+
+int shard_parse(struct Shard *shard, const char *s)
+{
+  char *end;
+  long index = strtol(s, &end, 10);
+  if (end == s || *end != '/') return 1;
+  const char *t = end + 1;
+  long count = strtol(t, &end, 10);
+  if (end == t || *end != '\0') return 1;
+  if (count < 1 || index < 0 || index >= count) return 1;
+
+  shard->index = (int) index;
+  shard->count = (int) count;
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+/** A (zone, cost) pair read from the costs file. */
+struct ZoneCost {
+  char *zone_name;
+  double cost;
+};
+
+static int compare_zone_cost(const void *a, const void *b)
+{
+  const struct ZoneCost *ca = a;
+  const struct ZoneCost *cb = b;
+  return strcmp(ca->zone_name, cb->zone_name);
+}
+
+/**
+ * Read the "zone cost" lines of the given file into a newly allocated array
+ * sorted by zone name. Blank lines and comments (starting with '#') are
+ * ignored. Returns NULL if the file cannot be opened.
+ */
+static struct ZoneCost *read_costs(const char *costs_file, int *num_costs)
+{
+  FILE *f = fopen(costs_file, "r");
+  if (f == NULL) return NULL;
+
+  int capacity = 16;
+  int n = 0;
+  struct ZoneCost *costs = malloc(sizeof(struct ZoneCost) * capacity);
+  char line[MAX_COST_LINE_SIZE];
+  while (fgets(line, MAX_COST_LINE_SIZE, f) != NULL) {
+    char* comment = strchr(line, '#');
+    if (comment != NULL) comment[0] = '\0';
+
+    char zone_name[MAX_COST_LINE_SIZE];
+    double cost;
+    if (sscanf(line, "%s %lf", zone_name, &cost) != 2) continue;
+
+    if (n >= capacity) {
+      capacity *= 2;
+      costs = realloc(costs, sizeof(struct ZoneCost) * capacity);
+    }
+    costs[n].zone_name = strdup(zone_name);
+    costs[n].cost = cost;
+    n++;
+  }
+  fclose(f);
+
+  qsort(costs, n, sizeof(struct ZoneCost), compare_zone_cost);
+  *num_costs = n;
+  return costs;
+}
+
+/** Zone index and cost, sorted by descending cost for the LPT assignment. */
+struct ZoneLoad {
+  int zone_index;
+  double cost;
+};
+
+static int compare_zone_load(const void *a, const void *b)
+{
+  const struct ZoneLoad *la = a;
+  const struct ZoneLoad *lb = b;
+  if (la->cost > lb->cost) return -1;
+  if (la->cost < lb->cost) return 1;
+  // Break ties by input order, so that every shard computes the same result.
+  return la->zone_index - lb->zone_index;
+}
+
+int shard_select(
+    const struct Shard *shard,
+    const char *costs_file,
+    int num_zones,
+    const char * const *zone_names,
+    bool *selected)
+{
+  struct ZoneLoad *loads = malloc(sizeof(struct ZoneLoad) * num_zones);
+  for (int i = 0; i < num_zones; i++) {
+    loads[i].zone_index = i;
+    loads[i].cost = 1.0;
+  }
+
+  // Look up the cost of each zone, using the average for unknown zones.
+  if (costs_file != NULL) {
+    int num_costs = 0;
+    struct ZoneCost *costs = read_costs(costs_file, &num_costs);
+    if (costs == NULL) {
+      fprintf(stderr, "Unable to read costs file '%s'\n", costs_file);
+      free(loads);
+      return 1;
+    }
+
+    double average = 1.0;
+    if (num_costs > 0) {
+      double sum = 0.0;
+      for (int i = 0; i < num_costs; i++) sum += costs[i].cost;
+      average = sum / num_costs;
+    }
+
+    for (int i = 0; i < num_zones; i++) {
+      struct ZoneCost key = {(char *) zone_names[i], 0.0};
+      struct ZoneCost *found = bsearch(
+          &key, costs, num_costs, sizeof(struct ZoneCost), compare_zone_cost);
+      loads[i].cost = (found != NULL) ? found->cost : average;
+    }
+
+    for (int i = 0; i < num_costs; i++) free(costs[i].zone_name);
+    free(costs);
+  }
+
+  // Assign the most expensive remaining zone to the least loaded shard.
+  qsort(loads, num_zones, sizeof(struct ZoneLoad), compare_zone_load);
+  double *shard_loads = calloc(shard->count, sizeof(double));
+  for (int i = 0; i < num_zones; i++) {
+    int best = 0;
+    for (int s = 1; s < shard->count; s++) {
+      if (shard_loads[s] < shard_loads[best]) best = s;
+    }
+    shard_loads[best] += loads[i].cost;
+    selected[loads[i].zone_index] = (best == shard->index);
+  }
+
+  free(shard_loads);
+  free(loads);
+  return 0;
+}
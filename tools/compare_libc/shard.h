@@ -0,0 +1,43 @@
+#ifndef COMPARE_LIBC_SHARD_H
+#define COMPARE_LIBC_SHARD_H
+
+#include <stdbool.h>
+
+/**
+ * Selects the subset of zones processed by a single invocation, using the
+ * '--shard index/count' flag, so that 'count' copies of the program can run in
+ * parallel on disjoint subsets of zones.txt. The partial outputs are stitched
+ * back together by tools/merge_validation/merge.py.
+ */
+struct Shard {
+  int index; // [0, count)
+  int count; // 1 means no sharding
+};
+
+/**
+ * Parse the "index/count" string into the given Shard. Returns 0 on success, 1
+ * if the string is malformed or the index is out of range.
+ */
+int shard_parse(struct Shard *shard, const char *s);
+
+/**
+ * Set selected[i] to true if zone_names[i] belongs to the given shard.
+ *
+ * If 'costs_file' is not NULL, it is a text file of "zone cost" lines (as
+ * written by the --costs_out flag of a previous run), and the zones are
+ * assigned to the shards using the greedy longest-processing-time-first rule,
+ * so that the shards finish at about the same time even though a few zones
+ * dominate the run time. Zones missing from the file are assigned the average
+ * cost. If 'costs_file' is NULL, every zone has the same cost, which reduces
+ * to a round-robin assignment.
+ *
+ * Returns 0 on success, 1 if the 'costs_file' cannot be read.
+ */
+int shard_select(
+    const struct Shard *shard,
+    const char *costs_file,
+    int num_zones,
+    const char * const *zone_names,
+    bool *selected);
+
+#endif
@@ -1,18 +1,151 @@
 #include <stdio.h>
-#include <stdlib.h> // realloc(), qsort()
+#include <stdlib.h> // malloc(), realloc(), qsort()
+#include <string.h> // memcpy(), strlen(), strcmp()
 #include "test_data.h"
 
+struct AllocStats alloc_stats;
+
+void print_alloc_stats(void)
+{
+  fprintf(stderr,
+      "Allocations: %ld mallocs (%ld bytes), %ld reallocs, %ld arena copies\n",
+      alloc_stats.num_mallocs, alloc_stats.num_bytes,
+      alloc_stats.num_reallocs, alloc_stats.num_arena_copies);
+}
+
+//-----------------------------------------------------------------------------
+
+_Static_assert(sizeof(struct TestItem) == 24, "TestItem must be 24 bytes");
+
+// Size of the open addressing hash table of abbrev_intern(), a power of 2
+// which is at least twice MAX_ABBREVS.
+#define ABBREV_HASH_SIZE (2 * MAX_ABBREVS)
+
+static char abbrevs[MAX_ABBREVS][MAX_ABBREV_SIZE];
+static int num_abbrevs = 0;
+static uint16_t abbrev_slots[ABBREV_HASH_SIZE]; // index + 1, 0 means empty
+
+uint16_t abbrev_intern(const char *abbrev)
+{
+  // FNV-1a hash of the truncated abbreviation
+  char key[MAX_ABBREV_SIZE];
+  uint32_t hash = 2166136261u;
+  int len = 0;
+  for (; len < MAX_ABBREV_SIZE - 1 && abbrev[len] != '\0'; len++) {
+    key[len] = abbrev[len];
+    hash = (hash ^ (uint8_t) abbrev[len]) * 16777619u;
+  }
+  key[len] = '\0';
+
+  uint32_t slot = hash & (ABBREV_HASH_SIZE - 1);
+  for (;;) {
+    uint16_t entry = abbrev_slots[slot];
+    if (entry == 0) break;
+    if (strcmp(abbrevs[entry - 1], key) == 0) return entry - 1;
+    slot = (slot + 1) & (ABBREV_HASH_SIZE - 1);
+  }
+
+  if (num_abbrevs >= MAX_ABBREVS) {
+    fprintf(stderr, "Too many abbreviations (max %d)\n", MAX_ABBREVS);
+    exit(1);
+  }
+  memcpy(abbrevs[num_abbrevs], key, len + 1);
+  abbrev_slots[slot] = (uint16_t) (num_abbrevs + 1);
+  return (uint16_t) num_abbrevs++;
+}
+
+const char *abbrev_string(uint16_t index)
+{
+  return abbrevs[index];
+}
+
+//-----------------------------------------------------------------------------
+
+/** Alignment of each allocation in the arena. */
+#define ARENA_ALIGNMENT 16
+
+/** A single block of memory of an Arena. The data follows the header. */
+struct ArenaBlock {
+  struct ArenaBlock *next;
+  size_t capacity;
+  size_t used;
+};
+
+/** Size of the ArenaBlock header, rounded up to the ARENA_ALIGNMENT. */
+#define ARENA_HEADER_SIZE arena_round(sizeof(struct ArenaBlock))
+
+/** Round up the size to the ARENA_ALIGNMENT. */
+static size_t arena_round(size_t size)
+{
+  return (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+}
+
+void arena_init(struct Arena *arena, size_t block_size)
+{
+  arena->blocks = NULL;
+  arena->block_size = block_size;
+}
+
+void *arena_alloc(struct Arena *arena, size_t size)
+{
+  size = arena_round(size);
+  struct ArenaBlock *block = arena->blocks;
+  if (block == NULL || block->used + size > block->capacity) {
+    size_t capacity = (size > arena->block_size) ? size : arena->block_size;
+    block = malloc(ARENA_HEADER_SIZE + capacity);
+    if (block == NULL) {
+      fprintf(stderr, "arena_alloc(): malloc failure\n");
+      exit(1);
+    }
+    alloc_stats.num_mallocs++;
+    alloc_stats.num_bytes += (long) (ARENA_HEADER_SIZE + capacity);
+    block->next = arena->blocks;
+    block->capacity = capacity;
+    block->used = 0;
+    arena->blocks = block;
+  }
+  void *p = (char *) block + ARENA_HEADER_SIZE + block->used;
+  block->used += size;
+  return p;
+}
+
+void arena_clear(struct Arena *arena)
+{
+  struct ArenaBlock *block = arena->blocks;
+  while (block != NULL) {
+    struct ArenaBlock *next = block->next;
+    free(block);
+    block = next;
+  }
+  arena->blocks = NULL;
+}
+
+//-----------------------------------------------------------------------------
+
 void test_collection_init(struct TestCollection *collection)
 {
   collection->num_items = 0;
   collection->capacity = 0;
   collection->items = NULL;
+  collection->arena = NULL;
   test_collection_resize(collection, 10);
 }
 
+void test_collection_init_arena(
+    struct TestCollection *collection,
+    struct Arena *arena,
+    int capacity)
+{
+  collection->num_items = 0;
+  collection->capacity = capacity;
+  collection->items = arena_alloc(arena, sizeof(struct TestItem) * capacity);
+  collection->arena = arena;
+}
+
 void test_collection_clear(struct TestCollection *collection)
 {
-  free(collection->items);
+  // Items in an arena are freed with the arena.
+  if (collection->arena == NULL) free(collection->items);
   collection->num_items = 0;
   collection->capacity = 0;
   collection->items = NULL;
@@ -20,6 +153,19 @@ void test_collection_clear(struct TestCollection *collection)
 
 void test_collection_resize(struct TestCollection *collection, int newsize)
 {
+  if (collection->arena != NULL) {
+    // The old items are abandoned until the arena is cleared.
+    struct TestItem *newitems = arena_alloc(
+        collection->arena,
+        sizeof(struct TestItem) * newsize);
+    memcpy(newitems, collection->items,
+        sizeof(struct TestItem) * collection->num_items);
+    alloc_stats.num_arena_copies++;
+    collection->items = newitems;
+    collection->capacity = newsize;
+    return;
+  }
+
   struct TestItem *newitems = realloc(
       collection->items,
       sizeof(struct TestItem) * newsize);
@@ -27,6 +173,7 @@ void test_collection_resize(struct TestCollection *collection, int newsize)
     fprintf(stderr, "test_collection_resize(): realloc failure\n");
     exit(1);
   }
+  alloc_stats.num_reallocs++;
   collection->items = newitems;
   collection->capacity = newsize;
 }
@@ -78,20 +225,60 @@ void test_entry_clear(struct TestEntry *entry)
 
 //-----------------------------------------------------------------------------
 
+/**
+ * Default number of items of each collection, if the year range is unknown. A
+ * zone has exactly 12 samples per year, and most zones have at most 2
+ * transitions per year, each producing 2 items.
+ */
+#define DEFAULT_NUM_ITEMS 10
+#define SAMPLES_PER_YEAR 12
+#define TRANSITION_ITEMS_PER_YEAR 4
+
+/** Minimum size of the arena blocks of a TestData. */
+#define TEST_DATA_BLOCK_SIZE (64 * 1024)
+
 void test_data_init(struct TestData *data)
 {
+  test_data_init_presized(data, DEFAULT_NUM_ITEMS, 0, 0);
+}
+
+void test_data_init_presized(
+    struct TestData *data,
+    int num_entries,
+    int start_year,
+    int until_year)
+{
+  int num_years = until_year - start_year;
+  if (num_years < 0) num_years = 0;
+  data->num_transitions = TRANSITION_ITEMS_PER_YEAR * num_years;
+  if (data->num_transitions < DEFAULT_NUM_ITEMS) {
+    data->num_transitions = DEFAULT_NUM_ITEMS;
+  }
+  data->num_samples = SAMPLES_PER_YEAR * num_years;
+  if (data->num_samples < DEFAULT_NUM_ITEMS) {
+    data->num_samples = DEFAULT_NUM_ITEMS;
+  }
+  if (num_entries < 1) num_entries = 1;
+
+  // Size the first block to hold all the entries and their items, so that a
+  // single malloc() is normally sufficient.
+  size_t size = arena_round(sizeof(struct TestEntry) * num_entries)
+      + (arena_round(sizeof(struct TestItem) * data->num_transitions)
+          + arena_round(sizeof(struct TestItem) * data->num_samples))
+      * num_entries;
+  arena_init(&data->arena,
+      (size > TEST_DATA_BLOCK_SIZE) ? size : TEST_DATA_BLOCK_SIZE);
+
   data->num_entries = 0;
-  data->capacity = 0;
-  data->entries = NULL;
-  test_data_resize(data, 10);
+  data->capacity = num_entries;
+  data->entries = arena_alloc(
+      &data->arena, sizeof(struct TestEntry) * num_entries);
 }
 
 void test_data_clear(struct TestData *data)
 {
-  for (int i = data->num_entries - 1; i >= 0; i--) {
-    test_entry_clear(&data->entries[i]);
-  }
-  free(data->entries);
+  // All entries and their items are in the arena.
+  arena_clear(&data->arena);
 
   data->num_entries = 0;
   data->capacity = 0;
@@ -100,13 +287,13 @@ void test_data_clear(struct TestData *data)
 
 void test_data_resize(struct TestData *data, int newsize)
 {
-  struct TestEntry *newentries = realloc(
-      data->entries,
+  // The old entries are abandoned until the arena is cleared.
+  struct TestEntry *newentries = arena_alloc(
+      &data->arena,
       sizeof(struct TestEntry) * newsize);
-  if (newentries == NULL) {
-    fprintf(stderr, "test_entry_resize(): realloc failure\n");
-    exit(1);
-  }
+  memcpy(newentries, data->entries,
+      sizeof(struct TestEntry) * data->num_entries);
+  alloc_stats.num_arena_copies++;
   data->entries = newentries;
   data->capacity = newsize;
 }
@@ -117,36 +304,101 @@ struct TestEntry *test_data_new_entry(struct TestData *data)
     test_data_resize(data, data->capacity * 2);
   }
   struct TestEntry *entry = &data->entries[data->num_entries++];
-  test_entry_init(entry);
+  test_collection_init_arena(
+      &entry->transitions, &data->arena, data->num_transitions);
+  test_collection_init_arena(
+      &entry->samples, &data->arena, data->num_samples);
   return entry;
 }
 
 void test_data_delete_entry(struct TestData *data)
 {
   data->num_entries--;
-  struct TestEntry *entry = &data->entries[data->num_entries];
-  test_entry_clear(entry);
 }
 
 //-----------------------------------------------------------------------------
 
-static void print_item(const char *indent, const struct TestItem *item)
+// Output buffer for the TestEntry records. The records make up almost all of
+// the output, so they are formatted by hand into this buffer instead of using
+// one printf() per field.
+static char out_buffer[64 * 1024];
+static size_t out_len = 0;
+
+static void out_flush(void)
+{
+  fwrite(out_buffer, 1, out_len, stdout);
+  out_len = 0;
+}
+
+static void out_bytes(const char *s, size_t n)
 {
-  printf("%s\"epoch\": %ld,\n", indent, item->epoch_seconds);
-  printf("%s\"total_offset\": %d,\n", indent, item->utc_offset);
-  printf("%s\"dst_offset\": %d,\n", indent, item->dst_offset);
-  printf("%s\"y\": %d,\n", indent, item->year);
-  printf("%s\"M\": %d,\n", indent, item->month);
-  printf("%s\"d\": %d,\n", indent, item->day);
-  printf("%s\"h\": %d,\n", indent, item->hour);
-  printf("%s\"m\": %d,\n", indent, item->minute);
-  printf("%s\"s\": %d,\n", indent, item->second);
-  printf("%s\"abbrev\": \"%s\",\n", indent, item->abbrev);
-  printf("%s\"type\": \"%c\"\n", indent, item->type);
+  if (out_len + n > sizeof(out_buffer)) {
+    out_flush();
+    if (n > sizeof(out_buffer)) {
+      fwrite(s, 1, n, stdout);
+      return;
+    }
+  }
+  memcpy(out_buffer + out_len, s, n);
+  out_len += n;
 }
 
-void print_json(
-  const struct TestData *test_data,
+static void out_string(const char *s)
+{
+  out_bytes(s, strlen(s));
+}
+
+static void out_long(long value)
+{
+  char buf[24];
+  char *end = buf + sizeof(buf);
+  char *p = end;
+  unsigned long u = (value < 0) ? -(unsigned long) value : (unsigned long) value;
+  do {
+    *--p = (char) ('0' + u % 10);
+    u /= 10;
+  } while (u != 0);
+  if (value < 0) *--p = '-';
+  out_bytes(p, (size_t) (end - p));
+}
+
+static void print_item(const struct TestItem *item)
+{
+  out_string("          \"epoch\": ");
+  out_long(item->epoch_seconds);
+  out_string(",\n          \"total_offset\": ");
+  out_long(item->utc_offset);
+  out_string(",\n          \"dst_offset\": ");
+  out_long(item->dst_offset);
+  out_string(",\n          \"y\": ");
+  out_long(item->year);
+  out_string(",\n          \"M\": ");
+  out_long(item->month);
+  out_string(",\n          \"d\": ");
+  out_long(item->day);
+  out_string(",\n          \"h\": ");
+  out_long(item->hour);
+  out_string(",\n          \"m\": ");
+  out_long(item->minute);
+  out_string(",\n          \"s\": ");
+  out_long(item->second);
+  out_string(",\n          \"abbrev\": \"");
+  out_string(abbrev_string(item->abbrev_index));
+  out_string("\",\n          \"type\": \"");
+  out_bytes(&item->type, 1);
+  out_string("\"\n");
+}
+
+static void print_collection(const struct TestCollection *collection)
+{
+  for (int i = 0; i < collection->num_items; i++) {
+    out_string("        {\n");
+    print_item(&collection->items[i]);
+    out_string((i < collection->num_items - 1) ? "        },\n" : "        }\n");
+  }
+}
+
+void print_json_header(
   int start_year,
   int until_year,
   int epoch_year,
@@ -154,12 +406,7 @@ void print_json(
   const char *version,
   const char *tz_version)
 {
-
   const char indent0[] = "  ";
-  const char indent1[] = "    ";
-  const char indent2[] = "      ";
-  const char indent3[] = "        ";
-  const char indent4[] = "          ";
 
   printf("{\n");
   printf("%s\"start_year\": %d,\n", indent0, start_year);
@@ -172,40 +419,34 @@ void print_json(
   printf("%s\"has_valid_abbrev\": true,\n", indent0);
   printf("%s\"has_valid_dst\": false,\n", indent0);
   printf("%s\"offset_granularity\": 1,\n", indent0);
-  printf("%s\"test_data\": {\n", indent0);
-
-  // Print each zone
-  int num_zones = test_data->num_entries;
-  for (int z = 0; z < num_zones; z++) {
-    const struct TestEntry *entry = &test_data->entries[z];
-    const char *zone_name = entry->zone_name;
-    printf("%s\"%s\": {\n", indent1, zone_name);
-
-    // Print transitions
-    printf("%s\"%s\": [\n", indent2, "transitions");
-    const struct TestCollection *collection = &entry->transitions;
-    for (int i = 0; i < collection->num_items; i++) {
-      const struct TestItem *item = &collection->items[i];
-      printf("%s{\n", indent3);
-      print_item(indent4, item);
-      printf("%s}%s\n", indent3, (i < collection->num_items - 1) ? "," : "");
-    }
-    printf("%s],\n", indent2);
-
-    // Print samples
-    printf("%s\"%s\": [\n", indent2, "samples");
-    collection = &entry->samples;
-    for (int i = 0; i < collection->num_items; i++) {
-      const struct TestItem *item = &collection->items[i];
-      printf("%s{\n", indent3);
-      print_item(indent4, item);
-      printf("%s}%s\n", indent3, (i < collection->num_items - 1) ? "," : "");
-    }
-    printf("%s]\n", indent2);
+  printf("%s\"test_data\": {", indent0);
+}
 
-    printf("%s}%s\n", indent1, (z < test_data->num_entries - 1) ? "," : "");
-  }
+void print_json_entry(const struct TestEntry *entry, bool first)
+{
+  // The separator of the previous entry is written here, because the caller
+  // does not know if an entry is the last one until the zones are exhausted.
+  out_string(first ? "\n    \"" : ",\n    \"");
+  out_string(entry->zone_name);
+  out_string("\": {\n");
+
+  out_string("      \"transitions\": [\n");
+  print_collection(&entry->transitions);
+  out_string("      ],\n");
 
-  printf("%s}\n", indent0);
+  out_string("      \"samples\": [\n");
+  print_collection(&entry->samples);
+  out_string("      ]\n");
+
+  out_string("    }");
+
+  // Hand the entry to the consumer of the STDOUT as soon as it is complete.
+  out_flush();
+  fflush(stdout);
+}
+
+void print_json_footer(void)
+{
+  printf("\n  }\n");
   printf("}\n");
 }
@@ -0,0 +1,372 @@
+#include <stdio.h>
+#include <stdlib.h> // malloc(), calloc(), realloc(), free()
+#include <string.h> // memset(), memcpy(), memmove(), strncpy()
+#include <errno.h>
+#include <poll.h> // poll()
+#include <stdatomic.h> // atomic_int, atomic_bool
+#include <sys/mman.h> // mmap(), munmap()
+#include <sys/wait.h> // waitpid()
+#include <time.h> // clock_gettime()
+#include <unistd.h> // fork(), pipe(), read(), close(), _exit()
+#include "result_cache.h"
+#include "workers.h"
+
+/** Size of each read() from the pipe of a worker. */
+#define READ_SIZE (64 * 1024)
+
+/**
+ * The queue of zones shared by the parent and the workers, in an anonymous
+ * shared mapping, so that a worker which finishes early takes more zones.
+ */
+struct WorkQueue {
+  atomic_int next; // index into 'order' of the next zone to take
+  atomic_bool stop; // set when a zone has failed
+};
+
+/** Header of the record of each zone sent by a worker to the parent. */
+struct WorkerRecord {
+  int32_t index; // into 'zones'
+  int32_t err;
+  int32_t num_transitions;
+  int32_t num_samples;
+  int32_t cache_hits;
+  int32_t cache_misses;
+  double seconds;
+  char zone_name[ZONE_NAME_SIZE];
+};
+
+/**
+ * A TestItem of a record. The interned abbreviations are numbered differently
+ * by each process, so the abbreviation is sent as a string, and interned again
+ * by the parent.
+ */
+struct WorkerItem {
+  struct TestItem item;
+  char abbrev[MAX_ABBREV_SIZE];
+};
+
+/** The pipe of a worker, and the bytes received but not yet decoded. */
+struct WorkerPipe {
+  pid_t pid;
+  int fd; // -1 after the end of the file
+  uint8_t *buffer;
+  size_t len;
+  size_t capacity;
+};
+
+/** Return the monotonic clock in seconds. */
+static double now_seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//-----------------------------------------------------------------------------
+
+static void send_collection(FILE *out, const struct TestCollection *collection)
+{
+  struct WorkerItem witem;
+  memset(&witem, 0, sizeof(witem));
+  for (int i = 0; i < collection->num_items; i++) {
+    witem.item = collection->items[i];
+    // abbrev_intern() truncates to MAX_ABBREV_SIZE - 1 characters.
+    strncpy(witem.abbrev, abbrev_string(witem.item.abbrev_index),
+        MAX_ABBREV_SIZE);
+    fwrite(&witem, sizeof(witem), 1, out);
+  }
+}
+
+/**
+ * Take zones from the 'queue' until it is empty or stopped, and send the
+ * record of each one over 'fd'. Never returns.
+ */
+static void run_worker(
+    struct WorkQueue *queue,
+    int fd,
+    int num_order,
+    const int *order,
+    const char * const *zones,
+    WorkerZoneFn process_zone)
+{
+  FILE *out = fdopen(fd, "wb");
+  if (out == NULL) _exit(1);
+
+  while (!atomic_load(&queue->stop)) {
+    int k = atomic_fetch_add(&queue->next, 1);
+    if (k >= num_order) break;
+    int i = order[k];
+
+    double start = now_seconds();
+    struct ResultCacheStats cache_stats = result_cache_stats;
+    struct TestData test_data;
+    test_data_init(&test_data);
+    struct TestEntry *entry = test_data_new_entry(&test_data);
+    uint8_t err = process_zone(entry, i, zones[i]);
+
+    struct WorkerRecord record;
+    memset(&record, 0, sizeof(record));
+    record.index = i;
+    record.err = err;
+    record.num_transitions = err ? 0 : entry->transitions.num_items;
+    record.num_samples = err ? 0 : entry->samples.num_items;
+    record.cache_hits = result_cache_stats.num_hits - cache_stats.num_hits;
+    record.cache_misses =
+        result_cache_stats.num_misses - cache_stats.num_misses;
+    record.seconds = now_seconds() - start;
+    memcpy(record.zone_name, entry->zone_name, ZONE_NAME_SIZE);
+    fwrite(&record, sizeof(record), 1, out);
+    if (!err) {
+      send_collection(out, &entry->transitions);
+      send_collection(out, &entry->samples);
+    }
+    test_data_clear(&test_data);
+
+    // Hand each zone to the parent as soon as it is complete.
+    if (fflush(out) != 0) _exit(1);
+    if (err) break;
+  }
+
+  _exit(fclose(out) == 0 ? 0 : 1);
+}
+
+//-----------------------------------------------------------------------------
+
+static void receive_collection(
+    struct TestCollection *collection,
+    const struct WorkerItem *witems,
+    int num_items)
+{
+  if (num_items > collection->capacity) {
+    test_collection_resize(collection, num_items);
+  }
+  for (int i = 0; i < num_items; i++) {
+    struct TestItem *item = test_collection_new_item(collection);
+    *item = witems[i].item;
+    item->abbrev_index = abbrev_intern(witems[i].abbrev);
+  }
+}
+
+/**
+ * Decode the complete records in the buffer of the 'pipe' into 'results'.
+ * Returns 1 if a record refers to an invalid zone.
+ */
+static uint8_t receive_records(
+    struct WorkerPipe *pipe,
+    int num_zones,
+    struct TestData **results,
+    double *seconds,
+    uint8_t *errs)
+{
+  size_t pos = 0;
+  while (pipe->len - pos >= sizeof(struct WorkerRecord)) {
+    struct WorkerRecord record;
+    memcpy(&record, pipe->buffer + pos, sizeof(record));
+    if (record.num_transitions < 0 || record.num_samples < 0) {
+      fprintf(stderr, "Invalid record from worker %d\n", (int) pipe->pid);
+      return 1;
+    }
+    size_t size = sizeof(record) + sizeof(struct WorkerItem)
+        * ((size_t) record.num_transitions + (size_t) record.num_samples);
+    if (pipe->len - pos < size) break;
+    if (record.index < 0 || record.index >= num_zones
+        || results[record.index] != NULL) {
+      fprintf(stderr, "Invalid record from worker %d\n", (int) pipe->pid);
+      return 1;
+    }
+
+    // Copy the items out of the buffer, which may not be aligned.
+    struct WorkerItem *witems = malloc(size - sizeof(record) + 1);
+    memcpy(witems, pipe->buffer + pos + sizeof(record), size - sizeof(record));
+
+    struct TestData *test_data = malloc(sizeof(struct TestData));
+    test_data_init(test_data);
+    struct TestEntry *entry = test_data_new_entry(test_data);
+    memcpy(entry->zone_name, record.zone_name, ZONE_NAME_SIZE);
+    entry->zone_name[ZONE_NAME_SIZE - 1] = '\0';
+    receive_collection(&entry->transitions, witems, record.num_transitions);
+    receive_collection(&entry->samples, witems + record.num_transitions,
+        record.num_samples);
+    free(witems);
+
+    results[record.index] = test_data;
+    seconds[record.index] = record.seconds;
+    errs[record.index] = (uint8_t) record.err;
+    result_cache_stats.num_hits += record.cache_hits;
+    result_cache_stats.num_misses += record.cache_misses;
+    pos += size;
+  }
+
+  memmove(pipe->buffer, pipe->buffer + pos, pipe->len - pos);
+  pipe->len -= pos;
+  return 0;
+}
+
+/**
+ * Read the available bytes from the 'pipe' into its buffer. Closes the pipe
+ * at the end of the file. Returns 1 on a read error.
+ */
+static uint8_t read_pipe(struct WorkerPipe *pipe)
+{
+  if (pipe->capacity - pipe->len < READ_SIZE) {
+    pipe->capacity = 2 * pipe->capacity + READ_SIZE;
+    pipe->buffer = realloc(pipe->buffer, pipe->capacity);
+    if (pipe->buffer == NULL) {
+      fprintf(stderr, "read_pipe(): realloc failure\n");
+      exit(1);
+    }
+  }
+  ssize_t n = read(pipe->fd, pipe->buffer + pipe->len, READ_SIZE);
+  if (n < 0) {
+    if (errno == EINTR || errno == EAGAIN) return 0;
+    fprintf(stderr, "Unable to read from worker %d\n", (int) pipe->pid);
+    close(pipe->fd);
+    pipe->fd = -1;
+    return 1;
+  }
+  if (n == 0) {
+    close(pipe->fd);
+    pipe->fd = -1;
+  }
+  pipe->len += n;
+  return 0;
+}
+
+uint8_t workers_process_zones(
+    int num_jobs,
+    int num_zones,
+    const char * const *zones,
+    const bool *selected,
+    WorkerZoneFn process_zone,
+    WorkerResultFn on_result,
+    void *context)
+{
+  // The selected zones, in the order that they are taken and returned.
+  int *order = malloc(sizeof(int) * (num_zones + 1));
+  int num_order = 0;
+  for (int i = 0; i < num_zones; i++) {
+    if (selected[i]) order[num_order++] = i;
+  }
+
+  struct WorkQueue *queue = mmap(NULL, sizeof(struct WorkQueue),
+      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (queue == MAP_FAILED) {
+    fprintf(stderr, "Unable to mmap the work queue\n");
+    free(order);
+    return 1;
+  }
+  atomic_init(&queue->next, 0);
+  atomic_init(&queue->stop, false);
+
+  // The children inherit the buffer of the STDOUT, so it must be empty.
+  fflush(stdout);
+  fflush(stderr);
+
+  uint8_t err = 0;
+  struct WorkerPipe *pipes = calloc(num_jobs, sizeof(struct WorkerPipe));
+  int num_pipes = 0;
+  for (int w = 0; w < num_jobs; w++) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+      fprintf(stderr, "Unable to create the pipe of worker %d\n", w);
+      err = 1;
+      break;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+      fprintf(stderr, "Unable to fork worker %d\n", w);
+      close(fds[0]);
+      close(fds[1]);
+      err = 1;
+      break;
+    }
+    if (pid == 0) {
+      close(fds[0]);
+      for (int p = 0; p < num_pipes; p++) close(pipes[p].fd);
+      run_worker(queue, fds[1], num_order, order, zones, process_zone);
+    }
+    close(fds[1]);
+    pipes[num_pipes].pid = pid;
+    pipes[num_pipes].fd = fds[0];
+    num_pipes++;
+  }
+  if (err) atomic_store(&queue->stop, true);
+
+  // Receive the records in any order, and return them in the input order.
+  struct TestData **results = calloc(num_zones + 1, sizeof(struct TestData *));
+  double *seconds = calloc(num_zones + 1, sizeof(double));
+  uint8_t *errs = calloc(num_zones + 1, sizeof(uint8_t));
+  struct pollfd *pollfds = calloc(num_jobs, sizeof(struct pollfd));
+  int num_returned = 0;
+  for (;;) {
+    int num_open = 0;
+    for (int p = 0; p < num_pipes; p++) {
+      if (pipes[p].fd < 0) continue;
+      pollfds[num_open].fd = pipes[p].fd;
+      pollfds[num_open].events = POLLIN;
+      pollfds[num_open].revents = 0;
+      num_open++;
+    }
+    if (num_open == 0) break;
+    if (poll(pollfds, num_open, -1) < 0) {
+      if (errno == EINTR) continue;
+      fprintf(stderr, "Unable to poll the workers\n");
+      err = 1;
+      break;
+    }
+
+    for (int p = 0, q = 0; p < num_pipes; p++) {
+      if (pipes[p].fd < 0) continue;
+      if (pollfds[q++].revents == 0) continue;
+      if (read_pipe(&pipes[p])
+          || receive_records(&pipes[p], num_zones, results, seconds, errs)) {
+        err = 1;
+        atomic_store(&queue->stop, true);
+      }
+    }
+
+    // After a failure, the remaining records are drained but not returned.
+    while (!err && num_returned < num_order
+        && results[order[num_returned]] != NULL) {
+      int i = order[num_returned];
+      if (errs[i]) {
+        err = errs[i];
+        atomic_store(&queue->stop, true);
+        break;
+      }
+      on_result(context, i, &results[i]->entries[0], seconds[i]);
+      test_data_clear(results[i]);
+      num_returned++;
+    }
+  }
+
+  for (int p = 0; p < num_pipes; p++) {
+    int status;
+    if (waitpid(pipes[p].pid, &status, 0) < 0
+        || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      fprintf(stderr, "Worker %d failed\n", (int) pipes[p].pid);
+      if (!err) err = 1;
+    }
+    if (pipes[p].fd >= 0) close(pipes[p].fd);
+    free(pipes[p].buffer);
+  }
+  if (!err && num_returned < num_order) {
+    fprintf(stderr, "Workers returned %d of %d zones\n",
+        num_returned, num_order);
+    err = 1;
+  }
+
+  for (int i = 0; i < num_zones; i++) {
+    if (results[i] == NULL) continue;
+    test_data_clear(results[i]);
+    free(results[i]);
+  }
+  free(results);
+  free(seconds);
+  free(errs);
+  free(pollfds);
+  free(pipes);
+  munmap(queue, sizeof(struct WorkQueue));
+  free(order);
+  return err;
+}
@@ -0,0 +1,57 @@
+#ifndef COMPARE_LIBC_WORKERS_H
+#define COMPARE_LIBC_WORKERS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "test_data.h"
+
+/**
+ * Processes the zones on worker processes, given by the '--jobs N' flag. The
+ * time zone of the C library is set through the TZ environment variable and
+ * tzset(), which are global to the process, so the zones cannot be processed
+ * on threads. Instead, N workers are forked, each taking the next zone from a
+ * counter in shared memory, and each sends the TestEntry of its zones to the
+ * parent over its own pipe. The parent receives the entries in any order, and
+ * passes them to the caller in the order of the input zones.
+ */
+
+/**
+ * Fill the empty 'entry' of zones[i] in a worker. Returns non-zero if the zone
+ * cannot be processed.
+ */
+typedef uint8_t (*WorkerZoneFn)(
+    struct TestEntry *entry,
+    int i,
+    const char *zone_name);
+
+/**
+ * Receive the 'entry' of zones[i] in the parent, with the elapsed 'seconds' of
+ * the worker which processed it.
+ */
+typedef void (*WorkerResultFn)(
+    void *context,
+    int i,
+    const struct TestEntry *entry,
+    double seconds);
+
+/**
+ * Process each zones[i] whose selected[i] is true on 'num_jobs' worker
+ * processes using 'process_zone', and call 'on_result' in the parent for each
+ * of them, in the order of 'zones'. The counters of the result cache of the
+ * workers are added to the result_cache_stats of the parent.
+ *
+ * If 'process_zone' fails for a zone, the results before that zone are passed
+ * to 'on_result', the workers stop taking zones, and its error is returned, as
+ * if the zones were processed serially. Returns 1 if a worker cannot be
+ * started or terminates abnormally.
+ */
+uint8_t workers_process_zones(
+    int num_jobs,
+    int num_zones,
+    const char * const *zones,
+    const bool *selected,
+    WorkerZoneFn process_zone,
+    WorkerResultFn on_result,
+    void *context);
+
+#endif
@@ -0,0 +1,328 @@
+#!/usr/bin/env python3
+#
+# Copyright 2024 Brian T. Park
+#
+# MIT License
+
+"""
+Regenerate a validation JSON file for a new TZDB version by recomputing only
+the zones whose Zone or Rule data changed since the previous version.
+
+The 'zones' command compares the TZDB source files of the old and new versions
+and prints the zones of zones.txt which must be recomputed, including the
+zones missing from the old validation JSON file. The 'splice' command replaces
+those zones in a copy of the old validation JSON file with the entries of a
+validation JSON file generated for just those zones, and takes the header
+(e.g. 'tz_version') from the new file:
+
+Usage:
+$ delta.py zones --old_tzdb old/tzdb --new_tzdb tzdb --old old.json \\
+    --zones zones.txt > changed.txt
+$ compare_xxx.out ... < changed.txt > changed.json
+$ delta.py splice --old old.json --new changed.json --changed changed.txt \\
+    --zones zones.txt > validation_data.json
+
+The zones which are recomputed, and the reason, are reported on the STDERR.
+"""
+
+from typing import Dict, List, Optional, Set
+import argparse
+import logging
+import os
+import sys
+import json
+
+from acetimetools.datatypes.valtyping import (
+    TestData,
+    ValidationData
+)
+
+
+class DeltaFailed(Exception):
+    pass
+
+
+def main() -> None:
+    # Configure command line flags.
+    parser = argparse.ArgumentParser(
+        description='Recompute only the zones changed by a new TZDB version'
+    )
+    subparsers = parser.add_subparsers(dest='command', required=True)
+
+    zones_parser = subparsers.add_parser(
+        'zones',
+        help='Print the zones whose TZDB data changed',
+    )
+    zones_parser.add_argument(
+        '--old_tzdb',
+        type=str,
+        required=True,
+        help='Directory of the TZDB files of the previous version',
+    )
+    zones_parser.add_argument(
+        '--new_tzdb',
+        type=str,
+        required=True,
+        help='Directory of the TZDB files of the new version',
+    )
+    zones_parser.add_argument(
+        '--old',
+        type=str,
+        help='Validation data JSON file of the previous version',
+    )
+    zones_parser.add_argument(
+        '--zones',
+        type=str,
+        required=True,
+        help='zones.txt file of the zones to check',
+    )
+
+    splice_parser = subparsers.add_parser(
+        'splice',
+        help='Splice the recomputed zones into the old validation data',
+    )
+    splice_parser.add_argument(
+        '--old',
+        type=str,
+        required=True,
+        help='Validation data JSON file of the previous version',
+    )
+    splice_parser.add_argument(
+        '--new',
+        type=str,
+        required=True,
+        help='Validation data JSON file of the recomputed zones',
+    )
+    splice_parser.add_argument(
+        '--changed',
+        type=str,
+        required=True,
+        help='Zones recomputed in the --new file, written by the zones command',
+    )
+    splice_parser.add_argument(
+        '--zones',
+        type=str,
+        required=True,
+        help='zones.txt file which determines the zones and their order',
+    )
+
+    # Parse the command line arguments
+    args = parser.parse_args()
+
+    # Configure logging. This should normally be executed after the
+    # parser.parse_args() because it allows us set the logging.level using a
+    # flag.
+    logging.basicConfig(level=logging.INFO)
+
+    with open(args.zones) as f:
+        zones = read_zones(f.readlines())
+
+    try:
+        if args.command == 'zones':
+            old_data = read_tzdb(args.old_tzdb)
+            new_data = read_tzdb(args.new_tzdb)
+            old_zones: Optional[Set[str]] = None
+            if args.old:
+                logging.info(f'Reading {args.old}')
+                with open(args.old) as f:
+                    old_zones = set(json.load(f)['test_data'].keys())
+            for zone in changed_zones(zones, old_data, new_data, old_zones):
+                print(zone)
+        else:
+            logging.info(f'Reading {args.old}')
+            with open(args.old) as f:
+                old = json.load(f)
+            logging.info(f'Reading {args.new}')
+            with open(args.new) as f:
+                new = json.load(f)
+            with open(args.changed) as f:
+                changed = set(read_zones(f.readlines()))
+            json.dump(splice(old, new, zones, changed), sys.stdout, indent=2)
+            print()
+    except DeltaFailed as e:
+        logging.error(e)
+        sys.exit(1)
+
+
+def read_zones(lines: List[str]) -> List[str]:
+    """Return the first word of each line, ignoring comments and blank lines,
+    in the same way as the compare_xxx programs.
+    """
+    zones: List[str] = []
+    for line in lines:
+        line = line.split('#', 1)[0].strip()
+        if line:
+            zones.append(line.split()[0])
+    return zones
+
+
+class TzdbData:
+    """The Zone, Rule and Link lines of the TZDB files, with the comments
+    removed and the fields separated by a single space.
+    """
+
+    def __init__(self) -> None:
+        self.zones: Dict[str, List[str]] = {}
+        self.rules: Dict[str, List[str]] = {}
+        self.links: Dict[str, str] = {}  # link name -> target zone name
+
+
+def read_tzdb(tzdb_dir: str) -> TzdbData:
+    """Read the TZDB source files in 'tzdb_dir'. Files without any Zone, Rule
+    or Link lines (e.g. version.txt) contribute nothing.
+    """
+    if not os.path.isdir(tzdb_dir):
+        raise DeltaFailed(f'TZDB directory {tzdb_dir} not found')
+
+    data = TzdbData()
+    for name in sorted(os.listdir(tzdb_dir)):
+        path = os.path.join(tzdb_dir, name)
+        if not os.path.isfile(path):
+            continue
+        with open(path, encoding='utf-8', errors='replace') as f:
+            parse_tzdb_lines(f.readlines(), data)
+    return data
+
+
+def parse_tzdb_lines(lines: List[str], data: TzdbData) -> None:
+    """Add the Zone, Rule and Link lines to 'data'. The continuation lines of
+    a Zone start with whitespace, and are added to that Zone.
+    """
+    zone: Optional[List[str]] = None
+    for line in lines:
+        line = line.split('#', 1)[0]
+        words = line.split()
+        if not words:
+            continue
+        if line[0].isspace():
+            if zone is not None:
+                zone.append(' '.join(words))
+            continue
+
+        zone = None
+        keyword = words[0]
+        if keyword == 'Zone' and len(words) >= 2:
+            zone = [' '.join(words[2:])]
+            data.zones[words[1]] = zone
+        elif keyword == 'Rule' and len(words) >= 2:
+            data.rules.setdefault(words[1], []).append(' '.join(words[2:]))
+        elif keyword == 'Link' and len(words) >= 3:
+            data.links[words[2]] = words[1]
+
+
+def zone_fingerprint(data: TzdbData, name: str) -> Optional[List[str]]:
+    """Return the lines which determine the transitions of the zone or link
+    'name': its Zone lines, and the Rule lines named by the RULES field of
+    each of them. Returns None if the name is not defined.
+    """
+    lines: List[str] = []
+    target = data.links.get(name)
+    if target is not None:
+        lines.append(f'Link {target}')
+        name = target
+    zone = data.zones.get(name)
+    if zone is None:
+        return None
+
+    # The RULES field is the 2nd field of each Zone line (after the name is
+    # removed). It is '-', a fixed offset such as '1:00', or a Rule name.
+    for zone_line in zone:
+        lines.append(zone_line)
+        fields = zone_line.split()
+        if len(fields) < 2:
+            continue
+        rules = fields[1]
+        if rules == '-' or rules[0].isdigit() or rules[0] == '-':
+            continue
+        lines.extend(data.rules.get(rules, []))
+    return lines
+
+
+def changed_zones(
+    zones: List[str],
+    old_data: TzdbData,
+    new_data: TzdbData,
+    old_zones: Optional[Set[str]],
+) -> List[str]:
+    """Return the zones (in the order of 'zones') whose Zone or Rule lines
+    differ between the old and new TZDB data, or which are not in 'old_zones'
+    (if given), logging the reason for each.
+    """
+    changed: List[str] = []
+    for zone in zones:
+        old_lines = zone_fingerprint(old_data, zone)
+        new_lines = zone_fingerprint(new_data, zone)
+        if old_zones is not None and zone not in old_zones:
+            reason = 'missing'
+        elif old_lines == new_lines:
+            continue
+        elif old_lines is None:
+            reason = 'added'
+        elif new_lines is None:
+            reason = 'removed'
+        else:
+            reason = 'changed'
+        logging.info(f'Zone {zone}: {reason}')
+        changed.append(zone)
+    logging.info(f'{len(changed)} of {len(zones)} zones changed')
+    return changed
+
+
+def splice(
+    old: ValidationData,
+    new: ValidationData,
+    zones: List[str],
+    changed: Set[str],
+) -> ValidationData:
+    """Return the validation data of 'zones', in that order, with the header
+    of 'new'. The 'changed' zones are taken from 'new', and are omitted if the
+    new run did not produce them (e.g. a removed zone), the others are copied
+    from 'old'. The years of the two files must match.
+    """
+    for key in ['start_year', 'until_year', 'epoch_year', 'scope', 'source']:
+        if old.get(key) != new.get(key):  # type: ignore
+            raise DeltaFailed(
+                f"Field '{key}' does not match: "
+                f"old={old.get(key)}, new={new.get(key)}"  # type: ignore
+            )
+
+    old_data = old['test_data']
+    new_data = new['test_data']
+    test_data: TestData = {}
+    num_recomputed = 0
+    for zone in zones:
+        if zone in changed:
+            if zone in new_data:
+                test_data[zone] = new_data[zone]
+                num_recomputed += 1
+                logging.info(f'Zone {zone}: recomputed')
+            else:
+                logging.info(f'Zone {zone}: not found in new data')
+        elif zone in old_data:
+            test_data[zone] = old_data[zone]
+
+    extra = set(new_data.keys()) - changed
+    if extra:
+        raise DeltaFailed(f'Zones not in --changed file: {extra}')
+    if old.get('version') != new.get('version'):  # type: ignore
+        logging.warning(
+            f"Version changed from {old.get('version')} "  # type: ignore
+            f"to {new.get('version')}, "  # type: ignore
+            'the unchanged zones are not recomputed'
+        )
+    logging.info(
+        f'{num_recomputed} zones recomputed, '
+        f'{len(test_data) - num_recomputed} zones reused'
+    )
+
+    spliced = {
+        key: value
+        for key, value in new.items()
+        if key != 'test_data'
+    }
+    spliced['test_data'] = test_data
+    return spliced  # type: ignore
+
+
+if __name__ == '__main__':
+    main()
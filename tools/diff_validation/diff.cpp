@@ -0,0 +1,466 @@
+/*
+ * Compare the observed validation file with the expected (baseline) validation
+ * file, using the same rules as diff.py, but on multiple threads. Each file is
+ * either a validation_data.json file, which is converted once into the binary
+ * validation format, or the binary file itself, which is memory-mapped.
+ *
+ * Unlike diff.py, which stops at the first mismatch of each zone, every
+ * mismatched item of every zone is reported on the STDOUT, one line per item
+ * with all of its mismatched fields, followed by a summary line. The
+ * '--summary' flag also writes the counts of each failed zone into a JSON file.
+ *
+ * Usage:
+ * $ ./diff.out --observed file.(json|bin) --expected file.(json|bin)
+ *    [--jobs num] [--summary summary.json]
+ *
+ * Exits with status 0 upon detecting no diff, and 1 otherwise.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h> // exit(), atoi()
+#include <string.h> // strcmp()
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../binary_validation/binary_validation.h"
+
+/** The settings of the comparison, derived from the 2 headers. */
+struct DiffOptions {
+  bool isSubset;
+  bool checkAbbrev;
+  bool checkDst;
+  int startYear; // of the observed
+  int untilYear; // of the observed
+  int offsetGranularity; // of the observed
+};
+
+const int kStatusPassed = 0;
+const int kStatusSkipped = 1; // no observed items
+const int kStatusFailed = 2;
+const int kStatusExtra = 3; // not in the expected file
+const int kStatusMissing = 4; // not in the observed file
+
+/** The result of a single zone. */
+struct ZoneResult {
+  const char *zoneName;
+  int status;
+  int numTransitionMismatches; // items, including a length mismatch
+  int numSampleMismatches; // items, including a length mismatch
+  std::string report; // lines printed on the STDOUT
+};
+
+/** Append the formatted string to 'report'. */
+static void appendf(std::string& report, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void appendf(std::string& report, const char *fmt, ...) {
+  char buf[512];
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(buf, sizeof(buf), fmt, args);
+  va_end(args);
+  report += buf;
+}
+
+/** Integer division of 'a' by 'b' (> 0), truncated towards 0. */
+static int32_t truncateOffset(int32_t a, int32_t b) {
+  return (a / b) * b;
+}
+
+static bool isSilent(char type) {
+  return type == 'a' || type == 'b';
+}
+
+static bool isCounted(char type) {
+  return type == 'A' || type == 'B' || type == 'S' || type == 'T';
+}
+
+/**
+ * Compare the items [obsBegin, obsEnd) of the 'obs' zone with the items
+ * [expBegin, expEnd) of the 'exp' zone, in the same order as
+ * Differ.diff_test_items() of diff.py, then compare the number of items.
+ * Every mismatch is appended to the report. Returns the number of mismatched
+ * items, plus 1 for a length mismatch.
+ */
+static int diffItems(
+    const DiffOptions& options,
+    const BinReader& observed,
+    const BinZone& obs,
+    uint32_t obsBegin,
+    uint32_t obsEnd,
+    const BinReader& expected,
+    const BinZone& exp,
+    uint32_t expBegin,
+    uint32_t expEnd,
+    const char *label,
+    std::string& report) {
+
+  const uint32_t numObserved = obsEnd - obsBegin;
+  const uint32_t numExpected = expEnd - expBegin;
+  uint32_t io = 0;
+  uint32_t ie = 0;
+
+  // Synchronize the year if observed is a subset of expected.
+  if (options.isSubset && numObserved != 0) {
+    int year = binYear(obs.dateTimes[obsBegin]);
+    while (ie < numExpected && binYear(exp.dateTimes[expBegin + ie]) < year) {
+      ie++;
+    }
+  }
+
+  int numMismatches = 0;
+  const int32_t g = options.offsetGranularity;
+  while (io < numObserved && ie < numExpected) {
+    const uint32_t o = obsBegin + io;
+    const uint32_t e = expBegin + ie;
+
+    // Skip silent transitions if not supported by both datasets.
+    if (! options.checkDst) {
+      if (isSilent(exp.types[e])) {
+        ie++;
+        continue;
+      }
+      if (isSilent(obs.types[o])) {
+        io++;
+        continue;
+      }
+    }
+
+    std::string fields;
+    int64_t odt = obs.dateTimes[o];
+    int64_t edt = exp.dateTimes[e];
+    if (obs.epochSeconds[o] != exp.epochSeconds[e]) {
+      appendf(fields, " epoch (%lld != %lld)",
+          (long long) obs.epochSeconds[o], (long long) exp.epochSeconds[e]);
+    }
+    if (truncateOffset(obs.totalOffsets[o], g)
+        != truncateOffset(exp.totalOffsets[e], g)) {
+      appendf(fields, " total (%d != %d)",
+          obs.totalOffsets[o], exp.totalOffsets[e]);
+    }
+    if (options.checkDst && obs.dstOffsets[o] != exp.dstOffsets[e]) {
+      appendf(fields, " dst (%d != %d)", obs.dstOffsets[o], exp.dstOffsets[e]);
+    }
+    // The date and time components differ only if the packed values differ.
+    if (odt != edt) {
+      appendf(fields, " date (%04d-%02d-%02dT%02d:%02d:%02d"
+          " != %04d-%02d-%02dT%02d:%02d:%02d)",
+          binYear(odt), binMonth(odt), binDay(odt),
+          binHour(odt), binMinute(odt), binSecond(odt),
+          binYear(edt), binMonth(edt), binDay(edt),
+          binHour(edt), binMinute(edt), binSecond(edt));
+    }
+    if (options.checkAbbrev) {
+      const char *oabbrev = observed.string(obs.abbrevIndexes[o]);
+      const char *eabbrev = expected.string(exp.abbrevIndexes[e]);
+      if (strcmp(oabbrev, eabbrev) != 0) {
+        appendf(fields, " abbrev (%s != %s)", oabbrev, eabbrev);
+      }
+    }
+    if (! fields.empty()) {
+      appendf(report, "ERROR %s %s obs[%u] != exp[%u]:%s\n",
+          obs.name, label, io, ie, fields.c_str());
+      numMismatches++;
+    }
+
+    io++;
+    ie++;
+  }
+
+  // Verify the number of test items, ignoring the silent transitions.
+  int lenObserved = 0;
+  for (uint32_t o = obsBegin; o < obsEnd; o++) {
+    if (isCounted(obs.types[o])) lenObserved++;
+  }
+  int lenExpected = 0;
+  for (uint32_t e = expBegin; e < expEnd; e++) {
+    int year = binYear(exp.dateTimes[e]);
+    if (isCounted(exp.types[e])
+        && year >= options.startYear && year < options.untilYear) {
+      lenExpected++;
+    }
+  }
+  bool valid = options.isSubset
+      ? (lenObserved <= lenExpected)
+      : (lenObserved == lenExpected);
+  if (! valid) {
+    appendf(report, "ERROR %s %s: len(observed) (%d) %s len(expected) (%d)\n",
+        obs.name, label, lenObserved, options.isSubset ? ">" : "!=",
+        lenExpected);
+    numMismatches++;
+  }
+  return numMismatches;
+}
+
+/** Compare the observed zone at 'index' with the same zone of 'expected'. */
+static void diffZone(
+    const DiffOptions& options,
+    const BinReader& observed,
+    const BinReader& expected,
+    uint32_t index,
+    ZoneResult& result) {
+
+  BinZone obs = observed.zone(index);
+  result.zoneName = obs.name;
+  int32_t expIndex = expected.findZone(obs.name);
+  if (expIndex < 0) {
+    result.status = kStatusExtra;
+    appendf(result.report, "ERROR %s: extra zone compared to expected\n",
+        obs.name);
+    return;
+  }
+
+  // If transitions and samples are empty in observed, the zone is not
+  // supported by the observed.
+  if (obs.numItems() == 0) {
+    result.status = kStatusSkipped;
+    return;
+  }
+
+  BinZone exp = expected.zone(expIndex);
+  result.numTransitionMismatches = diffItems(options,
+      observed, obs, 0, obs.numTransitions,
+      expected, exp, 0, exp.numTransitions,
+      "transitions", result.report);
+  result.numSampleMismatches = diffItems(options,
+      observed, obs, obs.numTransitions, obs.numItems(),
+      expected, exp, exp.numTransitions, exp.numItems(),
+      "samples", result.report);
+  result.status = (result.numTransitionMismatches + result.numSampleMismatches)
+      ? kStatusFailed : kStatusPassed;
+}
+
+/**
+ * Compare the zones of 'observed' using 'numJobs' threads, which pull the next
+ * zone from a shared counter. Each zone writes only into its own ZoneResult,
+ * so the results are in the order of the observed zones.
+ */
+static void diffZones(
+    const DiffOptions& options,
+    const BinReader& observed,
+    const BinReader& expected,
+    int numJobs,
+    std::vector<ZoneResult>& results) {
+
+  std::atomic<uint32_t> next(0);
+  const uint32_t numZones = results.size();
+  auto worker = [&]() {
+    for (;;) {
+      uint32_t z = next++;
+      if (z >= numZones) break;
+      diffZone(options, observed, expected, z, results[z]);
+    }
+  };
+
+  if (numJobs <= 1) {
+    worker();
+    return;
+  }
+  std::vector<std::thread> threads;
+  for (int j = 0; j < numJobs; j++) {
+    threads.emplace_back(worker);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * Check the headers of the 2 files, as Differ.diff_header() of diff.py, and
+ * set the 'options'. Returns 0 on success, 1 after printing the error.
+ */
+static int8_t diffHeader(
+    const BinHeader& obs,
+    const BinHeader& exp,
+    DiffOptions& options) {
+
+  if (strcmp(exp.scope, "complete") != 0) {
+    printf("expected['scope'] must be 'complete'\n");
+    return 1;
+  }
+  options.isSubset = strcmp(obs.scope, "complete") != 0;
+  if (options.isSubset) printf("Observed is a subset of Expected\n");
+  options.checkAbbrev = obs.hasValidAbbrev && exp.hasValidAbbrev;
+  if (! options.checkAbbrev) printf("Disabling validation for abbrev\n");
+  options.checkDst = obs.hasValidDst && exp.hasValidDst;
+  if (! options.checkDst) printf("Disabling validation for DST offset\n");
+  options.startYear = obs.startYear;
+  options.untilYear = obs.untilYear;
+  options.offsetGranularity = obs.offsetGranularity;
+  if (options.offsetGranularity < 1) {
+    printf("observed[offset_granularity] must be positive\n");
+    return 1;
+  }
+
+  if (options.isSubset) {
+    if (obs.startYear < exp.startYear) {
+      printf("observed[start_year] < expected[start_year]\n");
+      return 1;
+    }
+    if (obs.untilYear > exp.untilYear) {
+      printf("observed[until_year] > expected[until_year]\n");
+      return 1;
+    }
+  } else {
+    if (obs.startYear != exp.startYear) {
+      printf("start_year different\n");
+      return 1;
+    }
+    if (obs.untilYear != exp.untilYear) {
+      printf("until_year different\n");
+      return 1;
+    }
+  }
+  if (obs.epochYear != exp.epochYear) {
+    printf("epoch_year different\n");
+    return 1;
+  }
+  return 0;
+}
+
+static const char *statusString(int status) {
+  switch (status) {
+    case kStatusPassed: return "passed";
+    case kStatusSkipped: return "skipped";
+    case kStatusFailed: return "failed";
+    case kStatusExtra: return "extra";
+    default: return "missing";
+  }
+}
+
+/** Counts of the zones of each status, and of the mismatched items. */
+struct DiffCounts {
+  int numZones[kStatusMissing + 1];
+  long numMismatches;
+};
+
+/**
+ * Write the counts, and the zones which did not pass, into the '--summary'
+ * JSON file. The zone names contain no characters which need escaping.
+ */
+static int8_t writeSummary(
+    const char *path,
+    const DiffCounts& counts,
+    const std::vector<ZoneResult>& results) {
+
+  FILE *f = fopen(path, "w");
+  if (f == nullptr) {
+    fprintf(stderr, "Unable to open summary file '%s'\n", path);
+    return 1;
+  }
+  fprintf(f, "{\n");
+  for (int s = kStatusPassed; s <= kStatusMissing; s++) {
+    fprintf(f, "  \"num_%s\": %d,\n", statusString(s), counts.numZones[s]);
+  }
+  fprintf(f, "  \"num_mismatches\": %ld,\n", counts.numMismatches);
+  fprintf(f, "  \"zones\": {");
+  bool first = true;
+  for (const ZoneResult& result : results) {
+    if (result.status == kStatusPassed || result.status == kStatusSkipped) {
+      continue;
+    }
+    fprintf(f, "%s\n    \"%s\": {\"status\": \"%s\", "
+        "\"transitions\": %d, \"samples\": %d}",
+        first ? "" : ",", result.zoneName, statusString(result.status),
+        result.numTransitionMismatches, result.numSampleMismatches);
+    first = false;
+  }
+  fprintf(f, "%s}\n}\n", first ? "" : "\n  ");
+  bool err = fclose(f) != 0;
+  if (err) fprintf(stderr, "Unable to write summary file '%s'\n", path);
+  return err ? 1 : 0;
+}
+
+//-----------------------------------------------------------------------------
+
+static void usageAndExit() {
+  fprintf(stderr,
+    "Usage: diff.out --observed file.(json|bin) --expected file.(json|bin)\n"
+    "   [--jobs num] [--summary summary.json]\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  const char *observedFile = nullptr;
+  const char *expectedFile = nullptr;
+  const char *summaryFile = nullptr;
+  int numJobs = std::thread::hardware_concurrency();
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 == argc) usageAndExit();
+    if (strcmp(argv[i], "--observed") == 0) {
+      observedFile = argv[++i];
+    } else if (strcmp(argv[i], "--expected") == 0) {
+      expectedFile = argv[++i];
+    } else if (strcmp(argv[i], "--summary") == 0) {
+      summaryFile = argv[++i];
+    } else if (strcmp(argv[i], "--jobs") == 0) {
+      numJobs = atoi(argv[++i]);
+      if (numJobs < 1) {
+        fprintf(stderr, "Invalid --jobs: %s\n", argv[i]);
+        usageAndExit();
+      }
+    } else {
+      usageAndExit();
+    }
+  }
+  if (observedFile == nullptr || expectedFile == nullptr) usageAndExit();
+  if (numJobs < 1) numJobs = 1;
+
+  printf("Reading %s\n", observedFile);
+  BinReader observed;
+  if (binOpenFile(&observed, observedFile)) exit(1);
+  printf("Reading %s\n", expectedFile);
+  BinReader expected;
+  if (binOpenFile(&expected, expectedFile)) exit(1);
+
+  DiffOptions options;
+  if (diffHeader(observed.header(), expected.header(), options)) exit(1);
+
+  std::vector<ZoneResult> results(observed.numZones());
+  for (ZoneResult& result : results) {
+    result.status = kStatusPassed;
+    result.numTransitionMismatches = 0;
+    result.numSampleMismatches = 0;
+  }
+  diffZones(options, observed, expected, numJobs, results);
+
+  // The zones of the expected which are not in the observed.
+  if (! options.isSubset) {
+    for (uint32_t i = 0; i < expected.numZones(); i++) {
+      const char *zoneName = expected.zone(i).name;
+      if (observed.findZone(zoneName) >= 0) continue;
+      ZoneResult result;
+      result.zoneName = zoneName;
+      result.status = kStatusMissing;
+      result.numTransitionMismatches = 0;
+      result.numSampleMismatches = 0;
+      appendf(result.report, "ERROR %s: missing zone compared to expected\n",
+          zoneName);
+      results.push_back(result);
+    }
+  }
+
+  DiffCounts counts = {{0}, 0};
+  for (const ZoneResult& result : results) {
+    fputs(result.report.c_str(), stdout);
+    counts.numZones[result.status]++;
+    counts.numMismatches += result.numTransitionMismatches
+        + result.numSampleMismatches;
+  }
+  printf("Diff: %d passed, %d skipped, %d failed, %d extra, %d missing, "
+      "%ld mismatches\n",
+      counts.numZones[kStatusPassed], counts.numZones[kStatusSkipped],
+      counts.numZones[kStatusFailed], counts.numZones[kStatusExtra],
+      counts.numZones[kStatusMissing], counts.numMismatches);
+
+  int8_t err = 0;
+  if (summaryFile != nullptr) err = writeSummary(summaryFile, counts, results);
+  bool valid = counts.numZones[kStatusFailed] == 0
+      && counts.numZones[kStatusExtra] == 0
+      && counts.numZones[kStatusMissing] == 0;
+  return (err || ! valid) ? 1 : 0;
+}
@@ -0,0 +1,205 @@
+/*
+ * Read the validation JSON data on the STDIN, or the JSON or binary validation
+ * file given as the argument, and print the same flat TXT format as flatten.py
+ * on the STDOUT. The JSON file is read one zone at a time, and the binary file
+ * is memory-mapped, so the memory does not grow with the size of the file.
+ *
+ * Usage:
+ * $ ./flatten.out [--blacklist file] [--ignore_blacklist] \
+ *    < validation_data.json > validation_data.txt
+ * $ ./flatten.out validation_data.(json|bin) > validation_data.txt
+ *
+ * The --blacklist and --ignore_blacklist flags are accepted for compatibility
+ * with flatten.py, which does not use the blacklist either.
+ */
+
+#include <stdio.h>
+#include <stdlib.h> // exit()
+#include <string.h> // strcmp(), memcmp()
+#include <vector>
+#include "../binary_validation/binary_validation.h"
+
+/** Size of the buffer of the STDOUT. */
+const size_t kOutputBufferSize = 64 * 1024;
+
+static void printHeader(const BinHeader &header) {
+  printf("HEADER\n");
+  printf("start_year %d\n", header.startYear);
+  printf("until_year %d\n", header.untilYear);
+  printf("epoch_year %d\n", header.epochYear);
+  printf("scope %s\n", header.scope);
+  // Python prints its booleans as True and False.
+  printf("has_valid_abbrev %s\n", header.hasValidAbbrev ? "True" : "False");
+  printf("has_valid_dst %s\n", header.hasValidDst ? "True" : "False");
+  printf("offset_granularity %d\n", header.offsetGranularity);
+  printf("\n");
+}
+
+/**
+ * Return the number of characters of the UTF-8 string 's', by which Python
+ * pads its strings, instead of the number of bytes used by printf().
+ */
+static int utf8Length(const char *s) {
+  int n = 0;
+  for (; *s != '\0'; s++) {
+    if ((*s & 0xC0) != 0x80) n++;
+  }
+  return n;
+}
+
+static void printItem(
+    uint32_t line,
+    int64_t epochSeconds,
+    int32_t totalOffset,
+    int32_t dstOffset,
+    int64_t dt,
+    const char *abbrev,
+    char type) {
+  if (abbrev[0] == '\0') abbrev = "-";
+  int padding = 7 - utf8Length(abbrev);
+  printf("%6u %11lld %6d %6d %4d %2d %2d %2d %2d %2d %*s%s %4c\n",
+      line, (long long) epochSeconds, totalOffset, dstOffset,
+      binYear(dt), binMonth(dt), binDay(dt),
+      binHour(dt), binMinute(dt), binSecond(dt),
+      (padding > 0) ? padding : 0, "", abbrev, type);
+}
+
+static void printItemsHeader(const char *label, uint32_t numItems) {
+  printf("%s %u\n", label, numItems);
+  if (numItems != 0) {
+    printf("# line       epoch    utc    dst    y  m  d  h  m  s  abbrev "
+        "type\n");
+  }
+}
+
+/** Print the items [begin, end) of a zone written by BinWriter. */
+static void printBinItems(
+    const BinReader &reader,
+    const BinZone &zone,
+    const char *label,
+    uint32_t begin,
+    uint32_t end) {
+
+  printItemsHeader(label, end - begin);
+  for (uint32_t i = begin; i < end; i++) {
+    printItem(i - begin, zone.epochSeconds[i], zone.totalOffsets[i],
+        zone.dstOffsets[i], zone.dateTimes[i],
+        reader.string(zone.abbrevIndexes[i]), zone.types[i]);
+  }
+}
+
+static int8_t flattenBin(const char *path) {
+  BinReader reader;
+  if (reader.open(path)) return 1;
+  printHeader(reader.header());
+  for (uint32_t z = 0; z < reader.numZones(); z++) {
+    BinZone zone = reader.zone(z);
+    printf("ZONE %s\n", zone.name);
+    printBinItems(reader, zone, "TRANSITIONS", 0, zone.numTransitions);
+    printBinItems(reader, zone, "SAMPLES", zone.numTransitions,
+        zone.numItems());
+    printf("\n");
+  }
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+/** Print each zone of the JSON file as soon as binReadJson() has read it. */
+class Flattener : public BinJsonHandler {
+  public:
+    int8_t header(const BinHeader &header) override {
+      printHeader(header);
+      return 0;
+    }
+
+    int8_t zone(
+        const char *zoneName,
+        const BinItem *items,
+        uint32_t numTransitions,
+        uint32_t numSamples) override {
+      printf("ZONE %s\n", zoneName);
+      printItems("TRANSITIONS", items, numTransitions);
+      printItems("SAMPLES", items + numTransitions, numSamples);
+      printf("\n");
+      return 0;
+    }
+
+    int8_t finish() override {
+      return 0;
+    }
+
+  private:
+    static void printItems(
+        const char *label,
+        const BinItem *items,
+        uint32_t numItems) {
+      printItemsHeader(label, numItems);
+      for (uint32_t i = 0; i < numItems; i++) {
+        const BinItem &item = items[i];
+        printItem(i, item.epochSeconds, item.totalOffset, item.dstOffset,
+            binPackDateTime(item.year, item.month, item.day,
+                item.hour, item.minute, item.second),
+            item.abbrev, item.type);
+      }
+    }
+};
+
+static int8_t flattenJson(FILE *file) {
+  Flattener flattener;
+  return binReadJson(file, &flattener);
+}
+
+/**
+ * Flatten the file at 'path', which is either a binary validation file,
+ * detected by its magic bytes, or a JSON file.
+ */
+static int8_t flattenFile(const char *path) {
+  FILE *file = fopen(path, "rb");
+  if (file == nullptr) {
+    fprintf(stderr, "Unable to open '%s'\n", path);
+    return 1;
+  }
+  char magic[8];
+  bool isBin = fread(magic, sizeof(magic), 1, file) == 1
+      && memcmp(magic, BIN_HEADER_MAGIC, sizeof(magic)) == 0;
+  int8_t err;
+  if (isBin) {
+    fclose(file);
+    err = flattenBin(path);
+  } else {
+    rewind(file);
+    err = flattenJson(file);
+    fclose(file);
+  }
+  return err;
+}
+
+//-----------------------------------------------------------------------------
+
+static void usageAndExit() {
+  fprintf(stderr,
+    "Usage: flatten.out [--blacklist file] [--ignore_blacklist]\n"
+    "   [validation_data.(json|bin)] < validation_data.json\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  const char *path = nullptr;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--blacklist") == 0) {
+      if (++i == argc) usageAndExit();
+    } else if (strcmp(argv[i], "--ignore_blacklist") == 0) {
+      // ignored
+    } else if (argv[i][0] == '-' || path != nullptr) {
+      usageAndExit();
+    } else {
+      path = argv[i];
+    }
+  }
+
+  setvbuf(stdout, nullptr, _IOFBF, kOutputBufferSize);
+  int8_t err = (path == nullptr) ? flattenJson(stdin) : flattenFile(path);
+  if (fflush(stdout) != 0) err = 1;
+  return err ? 1 : 0;
+}
@@ -0,0 +1,137 @@
+#!/usr/bin/env python3
+#
+# Copyright 2024 Brian T. Park
+#
+# MIT License
+
+"""
+Merge the partial validation JSON files written by the shards of a
+compare_xxx program (using the '--shard index/count' flag) into a single
+validation JSON file on the STDOUT.
+
+Usage:
+$ merge.py [--zones zones.txt] part0.json part1.json ... > validation_data.json
+"""
+
+from typing import Any, Dict, List, Optional
+import argparse
+import logging
+import sys
+import json
+
+from acetimetools.datatypes.valtyping import (
+    TestData,
+    ValidationData
+)
+
+
+class MergeFailed(Exception):
+    pass
+
+
+def main() -> None:
+    # Configure command line flags.
+    parser = argparse.ArgumentParser(
+        description='Merge the validation_data.json files of multiple shards'
+    )
+
+    # Optional zones.txt file, to preserve the original order of the zones.
+    parser.add_argument(
+        '--zones',
+        type=str,
+        help='zones.txt file which determines the order of the zones',
+    )
+
+    parser.add_argument(
+        'parts',
+        nargs='+',
+        help='Partial validation data JSON files, one for each shard',
+    )
+
+    # Parse the command line arguments
+    args = parser.parse_args()
+
+    # Configure logging. This should normally be executed after the
+    # parser.parse_args() because it allows us set the logging.level using a
+    # flag.
+    logging.basicConfig(level=logging.INFO)
+
+    parts: List[ValidationData] = []
+    for part in args.parts:
+        logging.info(f'Reading {part}')
+        with open(part) as f:
+            parts.append(json.load(f))
+
+    zones: Optional[List[str]] = None
+    if args.zones:
+        with open(args.zones) as f:
+            zones = read_zones(f.readlines())
+
+    try:
+        merged = merge(parts, zones)
+    except MergeFailed as e:
+        logging.error(e)
+        sys.exit(1)
+
+    json.dump(merged, sys.stdout, indent=2)
+    print()
+
+
+def read_zones(lines: List[str]) -> List[str]:
+    """Return the first word of each line, ignoring comments and blank lines,
+    in the same way as the compare_xxx programs.
+    """
+    zones: List[str] = []
+    for line in lines:
+        line = line.split('#', 1)[0].strip()
+        if line:
+            zones.append(line.split()[0])
+    return zones
+
+
+def merge(
+    parts: List[ValidationData],
+    zones: Optional[List[str]],
+) -> ValidationData:
+    """Return the union of the 'test_data' of each part. The header fields
+    (everything except 'test_data') must be identical in every part. If
+    'zones' is given, the zones are emitted in that order, otherwise sorted by
+    name.
+    """
+    if not parts:
+        raise MergeFailed('No parts to merge')
+
+    header = get_header(parts[0])
+    test_data: TestData = {}
+    for i, part in enumerate(parts):
+        if get_header(part) != header:
+            raise MergeFailed(f'Header of part {i} does not match part 0')
+        for zone, entry in part['test_data'].items():
+            if zone in test_data:
+                raise MergeFailed(f'Zone {zone} found in multiple parts')
+            test_data[zone] = entry
+
+    if zones is None:
+        ordered = sorted(test_data.keys())
+    else:
+        extra = set(test_data.keys()) - set(zones)
+        if extra:
+            raise MergeFailed(f'Zones not in --zones file: {extra}')
+        ordered = [zone for zone in zones if zone in test_data]
+
+    merged: Dict[str, Any] = dict(header)
+    merged['test_data'] = {zone: test_data[zone] for zone in ordered}
+    return merged  # type: ignore
+
+
+def get_header(validation_data: ValidationData) -> Dict[str, Any]:
+    """Return the fields other than 'test_data', preserving their order."""
+    return {
+        key: value
+        for key, value in validation_data.items()
+        if key != 'test_data'
+    }
+
+
+if __name__ == '__main__':
+    main()